@@ -0,0 +1,2183 @@
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <disk.h>
+#include <fs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define BENCH_FILENAME "bench_file"
+
+/* Size of the block cache when none is configured */
+#define DEFAULT_CACHE_BLOCKS 1024
+
+struct bench_arg {
+	int argc;
+	char **argv;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fill @buf with a pattern that depends on the byte's position */
+static void fill_pattern(char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = 'a' + (i * 7 + i / BLOCK_SIZE) % 26;
+}
+
+/* Create BENCH_FILENAME holding @size bytes of pattern data */
+static void make_bench_file(char *data, size_t size)
+{
+	int fd;
+
+	fs_delete(BENCH_FILENAME);
+	if (fs_create(BENCH_FILENAME))
+		die("Cannot create file");
+
+	fd = fs_open(BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open file");
+
+	if (fs_write(fd, data, size) != (int)size)
+		die("Short write of %zu bytes (disk too small?)", size);
+
+	fs_close(fd);
+}
+
+/*
+ * Sequential read: read whole files of growing size and report the time per
+ * block, which should stay flat if block lookup is O(1).
+ */
+void bench_seqread(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const size_t sizes_kb[] = { 256, 1024, 2048, 4096, 8192, 16384 };
+	const int reps = 5;
+	char *diskname, *data, *buf;
+	size_t i, max_size;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = b_arg->argv[0];
+	max_size = sizes_kb[ARRAY_SIZE(sizes_kb) - 1] * 1024;
+
+	data = malloc(max_size);
+	buf = malloc(max_size);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, max_size);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	printf("%10s %8s %12s %14s\n", "size_kb", "blocks", "read_ms", "us_per_block");
+	for (i = 0; i < ARRAY_SIZE(sizes_kb); i++) {
+		size_t size = sizes_kb[i] * 1024;
+		size_t blocks = size / BLOCK_SIZE;
+		double start, elapsed;
+		int fd, r;
+
+		make_bench_file(data, size);
+
+		start = now_sec();
+		for (r = 0; r < reps; r++) {
+			fd = fs_open(BENCH_FILENAME);
+			if (fd < 0)
+				die("Cannot open file");
+			if (fs_read(fd, buf, size) != (int)size)
+				die("Short read");
+			fs_close(fd);
+		}
+		elapsed = (now_sec() - start) / reps;
+
+		if (memcmp(data, buf, size))
+			die("Read back wrong data for %zu KiB", sizes_kb[i]);
+
+		printf("%10zu %8zu %12.3f %14.3f\n", sizes_kb[i], blocks,
+			   elapsed * 1e3, elapsed * 1e6 / blocks);
+	}
+
+	fs_delete(BENCH_FILENAME);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	free(data);
+	free(buf);
+}
+
+/*
+ * Small I/O: append a file 100 bytes at a time, then read it back 100 bytes at
+ * a time. Every call touches a partial block, so without the block cache each
+ * one costs a full read-modify-write of a block.
+ */
+void bench_smallio(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	const size_t chunk = 100, size = 60000;
+	struct fs_cache_stats stats;
+	char *diskname, *data, *buf;
+	double start, write_time, read_time;
+	size_t off;
+	int fd;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> [cache blocks]");
+
+	diskname = b_arg->argv[0];
+	if (b_arg->argc > 1)
+		fs_set_cache_size(strtoul(b_arg->argv[1], NULL, 0));
+
+	data = malloc(size);
+	buf = malloc(size);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	fs_delete(BENCH_FILENAME);
+	if (fs_create(BENCH_FILENAME))
+		die("Cannot create file");
+	fd = fs_open(BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open file");
+
+	start = now_sec();
+	for (off = 0; off < size; off += chunk)
+		if (fs_write(fd, data + off, chunk) != (int)chunk)
+			die("Short write");
+	write_time = now_sec() - start;
+
+	fs_lseek(fd, 0);
+	start = now_sec();
+	for (off = 0; off < size; off += chunk)
+		if (fs_read(fd, buf + off, chunk) != (int)chunk)
+			die("Short read");
+	read_time = now_sec() - start;
+
+	if (memcmp(data, buf, size))
+		die("Read back wrong data");
+
+	fs_cache_stats(&stats);
+	printf("%zu-byte writes: %.3f ms, %zu-byte reads: %.3f ms\n",
+		   chunk, write_time * 1e3, chunk, read_time * 1e3);
+	printf("cache hits=%llu misses=%llu evictions=%llu writebacks=%llu prefetches=%llu\n",
+		   stats.hits, stats.misses, stats.evictions, stats.writebacks,
+		   stats.prefetches);
+
+	fs_close(fd);
+	fs_delete(BENCH_FILENAME);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	free(data);
+	free(buf);
+}
+
+/*
+ * Sequential I/O: write and read back one large file with a single call each,
+ * and compare against pread()/pwrite() of the same amount straight on the disk
+ * image file.
+ */
+void bench_seqio(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	const size_t size = 16 * 1024 * 1024;
+	const int reps = 5;
+	double start, fs_write_time = 0, fs_read_time = 0;
+	double raw_write_time = 0, raw_read_time = 0;
+	char *diskname, *data, *buf;
+	int fd, r;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(size);
+	buf = malloc(size);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	/* Raw disk image bandwidth, skipping the metadata blocks at the start */
+	fd = open(diskname, O_RDWR);
+	if (fd < 0)
+		die("Cannot open diskname");
+	for (r = 0; r < reps; r++) {
+		start = now_sec();
+		if (pread(fd, buf, size, 64 * BLOCK_SIZE) != (ssize_t)size)
+			die("Short raw read");
+		raw_read_time += now_sec() - start;
+
+		start = now_sec();
+		if (pwrite(fd, buf, size, 64 * BLOCK_SIZE) != (ssize_t)size)
+			die("Short raw write");
+		raw_write_time += now_sec() - start;
+	}
+	close(fd);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	for (r = 0; r < reps; r++) {
+		fs_delete(BENCH_FILENAME);
+		if (fs_create(BENCH_FILENAME))
+			die("Cannot create file");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+
+		start = now_sec();
+		if (fs_write(fd, data, size) != (int)size)
+			die("Short write (disk too small?)");
+		fs_write_time += now_sec() - start;
+
+		fs_lseek(fd, 0);
+		start = now_sec();
+		if (fs_read(fd, buf, size) != (int)size)
+			die("Short read");
+		fs_read_time += now_sec() - start;
+
+		fs_close(fd);
+	}
+
+	if (memcmp(data, buf, size))
+		die("Read back wrong data");
+
+	fs_delete(BENCH_FILENAME);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("%-10s %12s %12s\n", "", "write_MB/s", "read_MB/s");
+	printf("%-10s %12.1f %12.1f\n", "raw image",
+		   reps * size / raw_write_time / 1e6, reps * size / raw_read_time / 1e6);
+	printf("%-10s %12.1f %12.1f\n", "libfs",
+		   reps * size / fs_write_time / 1e6, reps * size / fs_read_time / 1e6);
+
+	free(data);
+	free(buf);
+}
+
+struct disk_worker {
+	pthread_t thread;
+	unsigned int seed;
+	size_t num_blocks;
+	size_t ops;
+	int failed;
+};
+
+static void *disk_worker_run(void *arg)
+{
+	struct disk_worker *w = arg;
+	char buf[BLOCK_SIZE];
+	size_t i, block;
+
+	for (i = 0; i < w->ops; i++) {
+		block = rand_r(&w->seed) % w->num_blocks;
+		if (block_read(block, buf))
+			w->failed = 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * Multi-threaded disk: random block_read() calls from 1 to 16 threads at once.
+ * Put the image on a RAM-backed file system (e.g. /dev/shm) so the numbers
+ * measure the disk layer rather than the storage device.
+ */
+void bench_diskmt(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const int thread_counts[] = { 1, 2, 4, 8, 16 };
+	const size_t ops_per_thread = 200000;
+	struct disk_worker workers[16];
+	double start, elapsed, base = 0;
+	char *diskname;
+	size_t i;
+	int t, n;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = b_arg->argv[0];
+	if (block_disk_open(diskname))
+		die("Cannot open diskname");
+
+	printf("%8s %14s %10s\n", "threads", "blocks/s", "speedup");
+	for (i = 0; i < ARRAY_SIZE(thread_counts); i++) {
+		n = thread_counts[i];
+
+		start = now_sec();
+		for (t = 0; t < n; t++) {
+			workers[t].seed = t + 1;
+			workers[t].num_blocks = block_disk_count();
+			workers[t].ops = ops_per_thread;
+			workers[t].failed = 0;
+			if (pthread_create(&workers[t].thread, NULL,
+					   disk_worker_run, &workers[t]))
+				die("Cannot create thread");
+		}
+		for (t = 0; t < n; t++) {
+			pthread_join(workers[t].thread, NULL);
+			if (workers[t].failed)
+				die("block_read failed");
+		}
+		elapsed = now_sec() - start;
+
+		if (n == 1)
+			base = ops_per_thread / elapsed;
+		printf("%8d %14.0f %10.2f\n", n, n * ops_per_thread / elapsed,
+			   n * ops_per_thread / elapsed / base);
+	}
+
+	block_disk_close();
+}
+
+/*
+ * Multi-mount: mount every disk given at once and round-robin small files
+ * between them, to check that the contexts and their caches stay independent.
+ */
+void bench_multimount(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	const size_t size = 64 * 1024;
+	const int rounds = 20;
+	double start, elapsed;
+	char *data, *buf;
+	fs_ctx **ctxs;
+	int i, r, fd, n;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> [<diskname>...]");
+
+	n = b_arg->argc;
+	ctxs = malloc(n * sizeof(fs_ctx *));
+	data = malloc(size);
+	buf = malloc(size);
+	if (!ctxs || !data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	for (i = 0; i < n; i++) {
+		ctxs[i] = fs_mount_ctx(b_arg->argv[i]);
+		if (!ctxs[i])
+			die("Cannot mount %s", b_arg->argv[i]);
+	}
+
+	start = now_sec();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n; i++) {
+			/* Give each disk different content */
+			data[0] = 'A' + i % 26;
+
+			fs_delete_ctx(ctxs[i], BENCH_FILENAME);
+			if (fs_create_ctx(ctxs[i], BENCH_FILENAME))
+				die("Cannot create file on %s", b_arg->argv[i]);
+			fd = fs_open_ctx(ctxs[i], BENCH_FILENAME);
+			if (fd < 0)
+				die("Cannot open file on %s", b_arg->argv[i]);
+			if (fs_write_ctx(ctxs[i], fd, data, size) != (int)size)
+				die("Short write on %s", b_arg->argv[i]);
+			fs_close_ctx(ctxs[i], fd);
+		}
+
+		for (i = 0; i < n; i++) {
+			data[0] = 'A' + i % 26;
+
+			fd = fs_open_ctx(ctxs[i], BENCH_FILENAME);
+			if (fd < 0)
+				die("Cannot open file on %s", b_arg->argv[i]);
+			if (fs_read_ctx(ctxs[i], fd, buf, size) != (int)size)
+				die("Short read on %s", b_arg->argv[i]);
+			if (memcmp(data, buf, size))
+				die("Read back wrong data on %s", b_arg->argv[i]);
+			fs_close_ctx(ctxs[i], fd);
+		}
+	}
+	elapsed = now_sec() - start;
+
+	for (i = 0; i < n; i++) {
+		fs_delete_ctx(ctxs[i], BENCH_FILENAME);
+		if (fs_umount_ctx(ctxs[i]))
+			die("Cannot unmount %s", b_arg->argv[i]);
+	}
+
+	printf("%d disks mounted, %d rounds: %.3f ms, %.1f MB/s\n", n, rounds,
+		   elapsed * 1e3, 2.0 * rounds * n * size / elapsed / 1e6);
+
+	free(ctxs);
+	free(data);
+	free(buf);
+}
+
+/* One thread of the fsmt benchmark */
+struct fs_worker {
+	pthread_t thread;
+	unsigned int seed;
+	int fd;
+	size_t ops;
+	int write;
+	int failed;
+};
+
+/* Size of every file used by fsmt, small enough for 16-bit file offsets */
+#define FSMT_FILE_BLOCKS 15
+
+static void *fs_worker_run(void *arg)
+{
+	struct fs_worker *w = arg;
+	char buf[BLOCK_SIZE];
+	size_t i, block;
+
+	memset(buf, 'w', BLOCK_SIZE);
+	for (i = 0; i < w->ops; i++) {
+		block = rand_r(&w->seed) % FSMT_FILE_BLOCKS;
+		if (fs_lseek(w->fd, block * BLOCK_SIZE)) {
+			w->failed = 1;
+			break;
+		}
+
+		if (w->write) {
+			if (fs_write(w->fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+				w->failed = 1;
+		} else {
+			if (fs_read(w->fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+				w->failed = 1;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Run @n workers at once and return the total number of operations per
+ * second. Worker t uses file "fsmt_<t>", or "fsmt_0" if @shared is set.
+ */
+static double run_fs_workers(struct fs_worker *workers, int n, int shared,
+			     int write, size_t ops)
+{
+	char filename[FS_FILENAME_LEN];
+	double start, elapsed;
+	int t;
+
+	for (t = 0; t < n; t++) {
+		snprintf(filename, sizeof(filename), "fsmt_%d", shared ? 0 : t);
+		workers[t].fd = fs_open(filename);
+		if (workers[t].fd < 0)
+			die("Cannot open %s", filename);
+		workers[t].seed = t + 1;
+		workers[t].ops = ops;
+		workers[t].write = write;
+		workers[t].failed = 0;
+	}
+
+	start = now_sec();
+	for (t = 0; t < n; t++)
+		if (pthread_create(&workers[t].thread, NULL, fs_worker_run,
+				   &workers[t]))
+			die("Cannot create thread");
+	for (t = 0; t < n; t++)
+		pthread_join(workers[t].thread, NULL);
+	elapsed = now_sec() - start;
+
+	for (t = 0; t < n; t++) {
+		if (workers[t].failed)
+			die("Worker %d failed", t);
+		fs_close(workers[t].fd);
+	}
+
+	return n * ops / elapsed;
+}
+
+/*
+ * Multi-threaded file system: random 4 KiB reads and writes from 1 to 16
+ * threads at once. Readers of different files or of the same file should
+ * scale with the number of cores; writers only scale across different files.
+ */
+void bench_fsmt(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const int thread_counts[] = { 1, 2, 4, 8, 16 };
+	const size_t ops_per_thread = 50000;
+	struct fs_worker workers[16];
+	char filename[FS_FILENAME_LEN];
+	char *diskname, *data;
+	double own_read, shared_read, own_write;
+	size_t i, size = FSMT_FILE_BLOCKS * BLOCK_SIZE;
+	int t, fd;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = b_arg->argv[0];
+	data = malloc(size);
+	if (!data)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	for (t = 0; t < 16; t++) {
+		snprintf(filename, sizeof(filename), "fsmt_%d", t);
+		fs_delete(filename);
+		if (fs_create(filename))
+			die("Cannot create %s", filename);
+		fd = fs_open(filename);
+		if (fd < 0)
+			die("Cannot open %s", filename);
+		if (fs_write(fd, data, size) != (int)size)
+			die("Short write (disk too small?)");
+		fs_close(fd);
+	}
+
+	printf("%8s %18s %18s %18s\n", "threads", "read_own_ops/s",
+	       "read_shared_ops/s", "write_own_ops/s");
+	for (i = 0; i < ARRAY_SIZE(thread_counts); i++) {
+		own_read = run_fs_workers(workers, thread_counts[i], 0, 0,
+					  ops_per_thread);
+		shared_read = run_fs_workers(workers, thread_counts[i], 1, 0,
+					     ops_per_thread);
+		own_write = run_fs_workers(workers, thread_counts[i], 0, 1,
+					   ops_per_thread);
+		printf("%8d %18.0f %18.0f %18.0f\n", thread_counts[i], own_read,
+		       shared_read, own_write);
+	}
+
+	for (t = 0; t < 16; t++) {
+		snprintf(filename, sizeof(filename), "fsmt_%d", t);
+		fs_delete(filename);
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	free(data);
+}
+
+/*
+ * Backends: the same reads with the pread() backend and its block cache, the
+ * pread() backend without a cache, and the mmap() backend. Large reads show
+ * the cost of the copies, small reads the cost of a system call per block.
+ */
+void bench_backend(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const struct {
+		const char *name;
+		int backend;
+		size_t cache_blocks;
+	} configs[] = {
+		{ "pread+cache",	FS_BACKEND_PREAD,	DEFAULT_CACHE_BLOCKS },
+		{ "pread",		FS_BACKEND_PREAD,	0 },
+		{ "mmap",		FS_BACKEND_MMAP,	0 },
+	};
+	const size_t size = 16 * 1024 * 1024, chunk = 100, small_size = 60000;
+	const int reps = 5;
+	double start, large_time, small_time;
+	char *diskname, *data, *buf;
+	size_t i, off;
+	int fd, r;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(size);
+	buf = malloc(size);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	printf("%-12s %14s %18s\n", "backend", "16MiB_read_ms", "100B_read_us");
+	for (i = 0; i < ARRAY_SIZE(configs); i++) {
+		fs_set_backend(configs[i].backend);
+		fs_set_cache_size(configs[i].cache_blocks);
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+
+		make_bench_file(data, size);
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+
+		start = now_sec();
+		for (r = 0; r < reps; r++) {
+			fs_lseek(fd, 0);
+			if (fs_read(fd, buf, size) != (int)size)
+				die("Short read");
+		}
+		large_time = (now_sec() - start) / reps;
+		if (memcmp(data, buf, size))
+			die("Read back wrong data with %s", configs[i].name);
+
+		start = now_sec();
+		for (r = 0; r < reps; r++) {
+			fs_lseek(fd, 0);
+			for (off = 0; off < small_size; off += chunk)
+				if (fs_read(fd, buf + off, chunk) != (int)chunk)
+					die("Short read");
+		}
+		small_time = (now_sec() - start) / reps;
+		if (memcmp(data, buf, small_size))
+			die("Read back wrong data with %s", configs[i].name);
+
+		fs_close(fd);
+		fs_delete(BENCH_FILENAME);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%-12s %14.3f %18.3f\n", configs[i].name, large_time * 1e3,
+		       small_time * 1e6 / (small_size / chunk));
+	}
+
+	fs_set_backend(FS_BACKEND_PREAD);
+	fs_set_cache_size(DEFAULT_CACHE_BLOCKS);
+
+	free(data);
+	free(buf);
+}
+
+/* Cheap checksum standing in for a consumer that only looks at the bytes */
+static uint64_t checksum(const void *buf, size_t len, uint64_t sum)
+{
+	const uint8_t *p = buf;
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + sizeof(word) <= len; i += sizeof(word)) {
+		memcpy(&word, p + i, sizeof(word));
+		sum += word;
+	}
+	for (; i < len; i++)
+		sum += p[i];
+
+	return sum;
+}
+
+/*
+ * Views: checksum a file that is already in memory, once by copying it out
+ * with fs_read() and once by looking at it in place with fs_read_view(), with
+ * the block cache and with the mmap() backend.
+ */
+void bench_view(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const struct {
+		const char *name;
+		int backend;
+	} configs[] = {
+		{ "cache",	FS_BACKEND_PREAD },
+		{ "mmap",	FS_BACKEND_MMAP },
+	};
+	const size_t size = 2 * 1024 * 1024;
+	const int reps = 20;
+	struct iovec iov[64];
+	double start, read_time, view_time;
+	uint64_t read_sum = 0, view_sum = 0;
+	char *diskname, *data, *buf;
+	size_t i, off;
+	int fd, r, n, k;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(size);
+	buf = malloc(size);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	printf("%-8s %12s %12s\n", "backend", "read_ms", "view_ms");
+	for (i = 0; i < ARRAY_SIZE(configs); i++) {
+		fs_set_backend(configs[i].backend);
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+
+		make_bench_file(data, size);
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+
+		/* Bring the whole file into the cache */
+		for (off = 0; off < size; off += n) {
+			n = fs_read_view(fd, off, size - off, iov, 1);
+			if (n != 1)
+				die("Cannot view file");
+			fs_release_view(iov, n);
+			n = iov[0].iov_len;
+		}
+
+		start = now_sec();
+		for (r = 0; r < reps; r++) {
+			fs_lseek(fd, 0);
+			if (fs_read(fd, buf, size) != (int)size)
+				die("Short read");
+			read_sum = checksum(buf, size, 0);
+		}
+		read_time = (now_sec() - start) / reps;
+
+		start = now_sec();
+		for (r = 0; r < reps; r++) {
+			view_sum = 0;
+			for (off = 0; off < size;) {
+				n = fs_read_view(fd, off, size - off, iov,
+						 ARRAY_SIZE(iov));
+				if (n <= 0)
+					die("Cannot view file");
+				for (k = 0; k < n; k++) {
+					view_sum = checksum(iov[k].iov_base,
+							    iov[k].iov_len, view_sum);
+					off += iov[k].iov_len;
+				}
+				fs_release_view(iov, n);
+			}
+		}
+		view_time = (now_sec() - start) / reps;
+
+		if (read_sum != view_sum || read_sum != checksum(data, size, 0))
+			die("Checksums differ with %s", configs[i].name);
+
+		fs_close(fd);
+		fs_delete(BENCH_FILENAME);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%-8s %12.3f %12.3f\n", configs[i].name, read_time * 1e3,
+		       view_time * 1e3);
+	}
+
+	fs_set_backend(FS_BACKEND_PREAD);
+
+	free(data);
+	free(buf);
+}
+
+/*
+ * Overlapping async writes to a file that is closed and deleted while they
+ * are still in flight, followed by a new file that takes over the freed
+ * blocks. The new file must read back exactly what was written to it.
+ */
+static void aio_check_delete(char *data, size_t size)
+{
+	const size_t io_size = size / 4, step = size / 64;
+	struct fs_aio_completion done[32];
+	char *junk, *buf;
+	size_t i, reaped;
+	int fd, n;
+
+	junk = malloc(io_size);
+	buf = malloc(size);
+	if (!junk || !buf)
+		die("Cannot malloc");
+	memset(junk, 'X', io_size);
+
+	make_bench_file(data, size);
+	fd = fs_open(BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open file");
+
+	/*
+	 * Each request overlaps the next 15, and together they queue far more
+	 * work than the synchronous rewrite below, so most are still pending
+	 * when the blocks change hands.
+	 */
+	for (i = 0; i < ARRAY_SIZE(done); i++)
+		if (fs_write_async(fd, junk, io_size, i * step, i))
+			die("Cannot submit write");
+
+	fs_close(fd);
+	if (fs_delete(BENCH_FILENAME))
+		die("Cannot delete file");
+
+	/* Reuse the blocks before reaping the requests on the old file */
+	make_bench_file(data, size);
+
+	for (reaped = 0; reaped < ARRAY_SIZE(done); reaped += n) {
+		n = fs_aio_reap(done, ARRAY_SIZE(done), 1);
+		if (n < 0)
+			die("Cannot reap requests");
+	}
+
+	fd = fs_open(BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open file");
+	if (fs_read(fd, buf, size) != (int)size || memcmp(buf, data, size))
+		die("Async write landed in a deleted file's blocks");
+	fs_close(fd);
+
+	free(junk);
+	free(buf);
+}
+
+/*
+ * Async queue depth: random 4 KiB reads through fs_read_async(), keeping a
+ * fixed number of requests in flight, with the block cache disabled so that
+ * every read goes to the disk image. Every read is checked against the file
+ * contents, and a final pass checks async writes racing with fs_delete().
+ */
+void bench_aioqd(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const int depths[] = { 1, 2, 4, 8, 16, 32 };
+	const size_t size = 16 * 1024 * 1024, io_size = BLOCK_SIZE;
+	const size_t num_ios = 20000;
+	struct fs_aio_completion done[32];
+	size_t offsets[32], free_slots[32], num_free;
+	char *diskname, *data, *bufs;
+	size_t i, submitted, completed, blocks = size / io_size;
+	unsigned int seed = 1;
+	double start, elapsed;
+	int fd, n, k, depth;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(size);
+	bufs = malloc(32 * io_size);
+	if (!data || !bufs)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	fs_set_cache_size(0);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	make_bench_file(data, size);
+	fd = fs_open(BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open file");
+
+	printf("%8s %12s %12s\n", "depth", "iops", "MB/s");
+	for (i = 0; i < ARRAY_SIZE(depths); i++) {
+		depth = depths[i];
+		submitted = completed = 0;
+		for (num_free = 0; num_free < (size_t)depth; num_free++)
+			free_slots[num_free] = num_free;
+
+		start = now_sec();
+		while (completed < num_ios) {
+			/*
+			 * Keep the queue full. Requests complete in any
+			 * order, so a slot is only reused once its own
+			 * request has been reaped.
+			 */
+			while (submitted < num_ios && num_free > 0) {
+				size_t slot = free_slots[--num_free];
+
+				offsets[slot] = (rand_r(&seed) % blocks) * io_size;
+				if (fs_read_async(fd, bufs + slot * io_size,
+						  io_size, offsets[slot], slot))
+					die("Cannot submit read");
+				submitted++;
+			}
+
+			n = fs_aio_reap(done, ARRAY_SIZE(done), 1);
+			for (k = 0; k < n; k++) {
+				size_t slot = done[k].user_data;
+
+				if (done[k].result != (int)io_size)
+					die("Read failed");
+				if (memcmp(bufs + slot * io_size,
+					   data + offsets[slot], io_size))
+					die("Read back wrong data at %zu",
+					    offsets[slot]);
+				free_slots[num_free++] = slot;
+			}
+			completed += n;
+		}
+		elapsed = now_sec() - start;
+
+		printf("%8d %12.0f %12.1f\n", depth, num_ios / elapsed,
+		       num_ios * io_size / elapsed / 1e6);
+	}
+
+	/* Check the data with one large request */
+	memset(data, 0, size);
+	if (fs_read_async(fd, data, size, 0, 0) ||
+	    fs_aio_reap(done, 1, 1) != 1 || done[0].result != (int)size)
+		die("Cannot read file");
+	for (i = 0; i < size; i++)
+		if (data[i] != (char)('a' + (i * 7 + i / BLOCK_SIZE) % 26))
+			die("Read back wrong data at %zu", i);
+
+	fs_close(fd);
+
+	aio_check_delete(data, size);
+
+	fs_delete(BENCH_FILENAME);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	fs_set_cache_size(DEFAULT_CACHE_BLOCKS);
+
+	free(data);
+	free(bufs);
+}
+
+/*
+ * Scan: read a file from start to end in small sequential reads, on a freshly
+ * mounted (cold) cache, with and without readahead.
+ */
+void bench_scan(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const size_t read_sizes[] = { 512, 2048, 8192 };
+	static const size_t readaheads[] = { 0, FS_READAHEAD_DEFAULT };
+	const size_t size = 60000;
+	const int reps = 50;
+	struct fs_cache_stats stats;
+	double start, elapsed[ARRAY_SIZE(readaheads)];
+	unsigned long long misses[ARRAY_SIZE(readaheads)];
+	char *diskname, *data, *buf;
+	size_t i, j, off, len;
+	int fd, r;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(size);
+	buf = malloc(size);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	make_bench_file(data, size);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("%10s %14s %12s %14s %12s\n", "read_size", "no_ra_us", "no_ra_miss",
+	       "ra_us", "ra_miss");
+	for (i = 0; i < ARRAY_SIZE(read_sizes); i++) {
+		for (j = 0; j < ARRAY_SIZE(readaheads); j++) {
+			fs_set_readahead(readaheads[j]);
+			elapsed[j] = 0;
+			misses[j] = 0;
+
+			for (r = 0; r < reps; r++) {
+				if (fs_mount(diskname))
+					die("Cannot mount diskname");
+				fd = fs_open(BENCH_FILENAME);
+				if (fd < 0)
+					die("Cannot open file");
+
+				start = now_sec();
+				for (off = 0; off < size; off += len) {
+					len = read_sizes[i];
+					if (len > size - off)
+						len = size - off;
+					if (fs_read(fd, buf + off, len) != (int)len)
+						die("Short read");
+				}
+				elapsed[j] += now_sec() - start;
+
+				if (memcmp(data, buf, size))
+					die("Read back wrong data");
+
+				fs_cache_stats(&stats);
+				misses[j] += stats.misses;
+				fs_close(fd);
+				if (fs_umount())
+					die("Cannot unmount diskname");
+			}
+		}
+
+		printf("%10zu %14.1f %12.1f %14.1f %12.1f\n", read_sizes[i],
+		       elapsed[0] * 1e6 / reps, (double)misses[0] / reps,
+		       elapsed[1] * 1e6 / reps, (double)misses[1] / reps);
+	}
+
+	fs_set_readahead(FS_READAHEAD_DEFAULT);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	fs_delete(BENCH_FILENAME);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	free(data);
+	free(buf);
+}
+
+/*
+ * Create @diskname as an empty file system with @data_blocks data blocks.
+ * fs_make.x stops at 8192 data blocks (32 MiB), which is too small for the
+ * large-file benchmark, so it formats its own image.
+ */
+static void format_disk(const char *diskname, size_t data_blocks)
+{
+	uint8_t block[BLOCK_SIZE];
+	size_t fat_blocks, total_blocks, i;
+	int fd;
+
+	fat_blocks = (data_blocks * 2 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	total_blocks = 1 + fat_blocks + 1 + data_blocks;
+	if (total_blocks > UINT16_MAX)
+		die("Too many blocks (%zu)", total_blocks);
+
+	fd = open(diskname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die("Cannot create %s", diskname);
+
+	/* Superblock, with every field little endian */
+	memset(block, 0, BLOCK_SIZE);
+	memcpy(block, "ECS150FS", 8);
+	block[8] = total_blocks & 0xFF;
+	block[9] = total_blocks >> 8;
+	block[10] = (1 + fat_blocks) & 0xFF;
+	block[11] = (1 + fat_blocks) >> 8;
+	block[12] = (2 + fat_blocks) & 0xFF;
+	block[13] = (2 + fat_blocks) >> 8;
+	block[14] = data_blocks & 0xFF;
+	block[15] = data_blocks >> 8;
+	block[16] = fat_blocks;
+	if (write(fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+		die("Cannot write superblock");
+
+	/* The FAT is all free, except for entry 0 which is always FAT_EOC */
+	for (i = 0; i < fat_blocks; i++) {
+		memset(block, 0, BLOCK_SIZE);
+		if (i == 0)
+			block[0] = block[1] = 0xFF;
+		if (write(fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+			die("Cannot write FAT");
+	}
+
+	/* Empty root directory, and zeroed data blocks */
+	if (ftruncate(fd, total_blocks * BLOCK_SIZE))
+		die("Cannot size %s", diskname);
+
+	close(fd);
+}
+
+/*
+ * Large file: write a file of several hundred megabytes sequentially, read it
+ * back sequentially, then read random blocks all over it. The throughput
+ * should not drop as the file grows, and no offset may wrap around.
+ */
+void bench_largefile(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const size_t sizes_mb[] = { 16, 64, 128, 240 };
+	const size_t chunk = 1024 * 1024;
+	const int random_reads = 20000;
+	double start, write_s, read_s, random_s;
+	char *diskname, *data, *buf;
+	size_t i, off, size;
+	int fd, r;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(chunk);
+	buf = malloc(chunk);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, chunk);
+
+	printf("%8s %14s %14s %16s\n", "size_mb", "write_MBps", "read_MBps",
+	       "rand_4k_kiops");
+	for (i = 0; i < ARRAY_SIZE(sizes_mb); i++) {
+		size = sizes_mb[i] * 1024 * 1024;
+		format_disk(diskname, size / BLOCK_SIZE + 16);
+
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+		if (fs_create(BENCH_FILENAME))
+			die("Cannot create file");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+
+		start = now_sec();
+		for (off = 0; off < size; off += chunk)
+			if (fs_write(fd, data, chunk) != (int)chunk)
+				die("Short write at %zu", off);
+		write_s = now_sec() - start;
+
+		if ((size_t)fs_stat(fd) != size)
+			die("File is %d bytes instead of %zu", fs_stat(fd), size);
+
+		fs_lseek(fd, 0);
+		start = now_sec();
+		for (off = 0; off < size; off += chunk) {
+			if (fs_read(fd, buf, chunk) != (int)chunk)
+				die("Short read at %zu", off);
+			if (memcmp(data, buf, chunk))
+				die("Read back wrong data at %zu", off);
+		}
+		read_s = now_sec() - start;
+
+		if (fs_read(fd, buf, chunk) != 0)
+			die("Read past the end of the file");
+
+		/* Each block of the file holds the same bytes as that block of data */
+		srand(1);
+		start = now_sec();
+		for (r = 0; r < random_reads; r++) {
+			off = (size_t)rand() % (size / BLOCK_SIZE) * BLOCK_SIZE;
+			fs_lseek(fd, off);
+			if (fs_read(fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+				die("Short read at %zu", off);
+			if (memcmp(data + off % chunk, buf, BLOCK_SIZE))
+				die("Read back wrong data at %zu", off);
+		}
+		random_s = now_sec() - start;
+
+		fs_close(fd);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%8zu %14.1f %14.1f %16.1f\n", sizes_mb[i],
+		       size / write_s / 1e6, size / read_s / 1e6,
+		       random_reads / random_s / 1e3);
+	}
+
+	unlink(diskname);
+	free(data);
+	free(buf);
+}
+
+/*
+ * Directory: fill the root directory with tens of thousands of empty files,
+ * and report the time per fs_create(), fs_open() and fs_delete() as it grows.
+ * With a hash-indexed directory, none of them should depend on the number of
+ * files.
+ */
+void bench_dir(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const int counts[] = { 100, 1000, 10000, 40000 };
+	const int lookups = 20000;
+	char *diskname, name[FS_FILENAME_LEN];
+	double start, create_s, open_s, delete_s;
+	int i, n = 0, prev, fd, r;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+
+	/* 40000 entries need 313 directory blocks */
+	format_disk(diskname, 1024);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	printf("%8s %12s %12s %12s\n", "files", "create_us", "open_us",
+	       "recreate_us");
+	for (i = 0; i < (int)ARRAY_SIZE(counts); i++) {
+		prev = n;
+		start = now_sec();
+		for (; n < counts[i]; n++) {
+			snprintf(name, sizeof(name), "f%d", n);
+			if (fs_create(name))
+				die("Cannot create file %d", n);
+		}
+		create_s = now_sec() - start;
+
+		/* The directory must survive a remount once it has grown */
+		if (fs_umount() || fs_mount(diskname))
+			die("Cannot remount diskname");
+
+		srand(1);
+		start = now_sec();
+		for (r = 0; r < lookups; r++) {
+			snprintf(name, sizeof(name), "f%d", rand() % n);
+			fd = fs_open(name);
+			if (fd < 0)
+				die("Cannot open %s", name);
+			fs_close(fd);
+		}
+		open_s = now_sec() - start;
+
+		/* Delete and recreate the newest file, which reuses the same entry */
+		snprintf(name, sizeof(name), "f%d", n - 1);
+		start = now_sec();
+		for (r = 0; r < lookups; r++) {
+			if (fs_delete(name) || fs_create(name))
+				die("Cannot recreate %s", name);
+		}
+		delete_s = now_sec() - start;
+
+		printf("%8d %12.3f %12.3f %12.3f\n", n,
+		       create_s * 1e6 / (n - prev), open_s * 1e6 / lookups,
+		       delete_s * 1e6 / lookups);
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	unlink(diskname);
+}
+
+/*
+ * Unmount: on a large disk with a large directory, change a growing number of
+ * files and time fs_umount(), which should only cost as much as what changed.
+ * Also checks that fs_sync() makes changes visible to a second mount of the
+ * same disk, without unmounting.
+ */
+void bench_umount(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const int changes[] = { 0, 1, 10, 100, 1000 };
+	const int num_files = 2000;
+	char *diskname, name[FS_FILENAME_LEN], data[100];
+	double start, elapsed;
+	fs_ctx *other;
+	int i, j, fd;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+	fill_pattern(data, sizeof(data));
+
+	/* 32 FAT blocks and 16 directory blocks */
+	format_disk(diskname, 65000);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < num_files; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		if (fs_create(name))
+			die("Cannot create file %d", i);
+	}
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("%8s %12s\n", "changed", "umount_ms");
+	for (i = 0; i < (int)ARRAY_SIZE(changes); i++) {
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+
+		/* Spread the files over the whole directory */
+		for (j = 0; j < changes[i]; j++) {
+			snprintf(name, sizeof(name), "f%d",
+				 j * (num_files / changes[i]));
+			fd = fs_open(name);
+			if (fd < 0)
+				die("Cannot open %s", name);
+			if (fs_write(fd, data, sizeof(data)) != sizeof(data))
+				die("Short write");
+			fs_close(fd);
+		}
+
+		start = now_sec();
+		if (fs_umount())
+			die("Cannot unmount diskname");
+		elapsed = now_sec() - start;
+
+		printf("%8d %12.3f\n", changes[i], elapsed * 1e3);
+	}
+
+	/*
+	 * A second mount of the disk sees what was synced, without an unmount.
+	 * f1 was never written above, so it holds exactly one write.
+	 */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	fd = fs_open("f1");
+	if (fd < 0 || fs_write(fd, data, sizeof(data)) != sizeof(data))
+		die("Cannot write f1");
+	if (fs_fsync(fd))
+		die("Cannot fsync f1");
+
+	other = fs_mount_ctx(diskname);
+	if (!other)
+		die("Cannot mount diskname a second time");
+	j = fs_open_ctx(other, "f1");
+	if (j < 0 || fs_stat_ctx(other, j) != sizeof(data))
+		die("fs_fsync() did not reach the disk");
+	fs_close_ctx(other, j);
+	if (fs_umount_ctx(other))
+		die("Cannot unmount diskname");
+
+	fs_close(fd);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("fs_fsync() reached the disk\n");
+	unlink(diskname);
+}
+
+struct journal_worker {
+	fs_ctx *ctx;
+	int id;
+	int count;
+	int sync;
+};
+
+/* Create @count files, each made durable before the next one */
+static void *journal_worker_run(void *arg)
+{
+	struct journal_worker *w = arg;
+	char name[FS_FILENAME_LEN];
+	int i;
+
+	for (i = 0; i < w->count; i++) {
+		snprintf(name, sizeof(name), "t%d_%d", w->id, i);
+		if (fs_create_ctx(w->ctx, name))
+			die("Cannot create %s", name);
+		if (w->sync && fs_sync_ctx(w->ctx))
+			die("Cannot sync %s", name);
+	}
+
+	return NULL;
+}
+
+/*
+ * Run @num_threads threads creating durable files on a fresh disk, with a
+ * journal of @journal blocks (0 for none, in which case every create is
+ * followed by fs_sync()). Return the number of creates per second.
+ */
+static double run_journal_creates(const char *diskname, size_t journal,
+				  int num_threads, int count)
+{
+	struct journal_worker workers[8];
+	pthread_t threads[8];
+	double start, elapsed;
+	fs_ctx *ctx;
+	int i;
+
+	format_disk(diskname, 4096);
+	if (fs_set_journal(journal))
+		die("Cannot set the journal");
+	ctx = fs_mount_ctx(diskname);
+	if (!ctx)
+		die("Cannot mount diskname");
+
+	start = now_sec();
+	for (i = 0; i < num_threads; i++) {
+		workers[i].ctx = ctx;
+		workers[i].id = i;
+		workers[i].count = count / num_threads;
+		workers[i].sync = journal == 0;
+		pthread_create(&threads[i], NULL, journal_worker_run,
+			       &workers[i]);
+	}
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = now_sec() - start;
+
+	if (fs_umount_ctx(ctx))
+		die("Cannot unmount diskname");
+
+	return count / elapsed;
+}
+
+/*
+ * Journal: durable creates per second, with every create followed by
+ * fs_sync() against a journal that commits each create with one record,
+ * from one thread and from 8 threads whose commits are grouped. Then checks
+ * that a copy of the disk taken without unmounting, as after a crash, has
+ * every file once the journal is replayed.
+ */
+void bench_journal(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const int threads[] = { 1, 8 };
+	const int count = 2000, journal = 64, crash_count = 500;
+	char *diskname, copyname[256], cmd[600], name[FS_FILENAME_LEN];
+	double sync_rate, journal_rate;
+	fs_ctx *ctx;
+	int i, fd;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+
+	printf("%8s %14s %14s %8s\n", "threads", "sync_per_s", "journal_per_s",
+	       "speedup");
+	for (i = 0; i < (int)ARRAY_SIZE(threads); i++) {
+		sync_rate = run_journal_creates(diskname, 0, threads[i], count);
+		journal_rate = run_journal_creates(diskname, journal,
+						   threads[i], count);
+		printf("%8d %14.0f %14.0f %7.2fx\n", threads[i], sync_rate,
+		       journal_rate, journal_rate / sync_rate);
+	}
+
+	/* Crash: copy the disk while it is still mounted */
+	format_disk(diskname, 4096);
+	if (fs_set_journal(journal))
+		die("Cannot set the journal");
+	ctx = fs_mount_ctx(diskname);
+	if (!ctx)
+		die("Cannot mount diskname");
+	for (i = 0; i < crash_count; i++) {
+		snprintf(name, sizeof(name), "c%d", i);
+		if (fs_create_ctx(ctx, name))
+			die("Cannot create %s", name);
+	}
+
+	snprintf(copyname, sizeof(copyname), "%s.crash", diskname);
+	snprintf(cmd, sizeof(cmd), "cp '%s' '%s'", diskname, copyname);
+	if (system(cmd))
+		die("Cannot copy diskname");
+	if (fs_umount_ctx(ctx))
+		die("Cannot unmount diskname");
+
+	/* The copy mounts without a journal setting, as its superblock has one */
+	if (fs_set_journal(0))
+		die("Cannot set the journal");
+	ctx = fs_mount_ctx(copyname);
+	if (!ctx)
+		die("Cannot mount the copy");
+	for (i = 0; i < crash_count; i++) {
+		snprintf(name, sizeof(name), "c%d", i);
+		fd = fs_open_ctx(ctx, name);
+		if (fd < 0)
+			die("%s was lost in the crash", name);
+		fs_close_ctx(ctx, fd);
+	}
+	if (fs_umount_ctx(ctx))
+		die("Cannot unmount the copy");
+
+	printf("%d files survived the crash\n", crash_count);
+	unlink(copyname);
+	unlink(diskname);
+}
+
+/*
+ * Mount: time fs_mount() on disks of growing size, which should stay flat as
+ * the FAT is only read once it is used, and the first write after it, which
+ * only reads the first FAT block.
+ */
+void bench_mount(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const size_t sizes[] = { 1024, 8192, 32768, 65000 };
+	const int rounds = 100;
+	char *diskname, data[BLOCK_SIZE];
+	double start, mount_s, write_s;
+	int i, r, fd;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+	fill_pattern(data, sizeof(data));
+
+	printf("%12s %10s %12s %12s\n", "data_blocks", "fat_blocks", "mount_us",
+	       "write_us");
+	for (i = 0; i < (int)ARRAY_SIZE(sizes); i++) {
+		format_disk(diskname, sizes[i]);
+
+		mount_s = write_s = 0;
+		for (r = 0; r < rounds; r++) {
+			start = now_sec();
+			if (fs_mount(diskname))
+				die("Cannot mount diskname");
+			mount_s += now_sec() - start;
+
+			fs_delete(BENCH_FILENAME);
+			if (fs_create(BENCH_FILENAME))
+				die("Cannot create file");
+			fd = fs_open(BENCH_FILENAME);
+			if (fd < 0)
+				die("Cannot open file");
+			start = now_sec();
+			if (fs_write(fd, data, sizeof(data)) != sizeof(data))
+				die("Short write");
+			write_s += now_sec() - start;
+			fs_close(fd);
+
+			if (fs_umount())
+				die("Cannot unmount diskname");
+		}
+
+		printf("%12zu %10zu %12.3f %12.3f\n", sizes[i],
+		       (sizes[i] * 2 + BLOCK_SIZE - 1) / BLOCK_SIZE,
+		       mount_s * 1e6 / rounds, write_s * 1e6 / rounds);
+	}
+
+	unlink(diskname);
+}
+
+/*
+ * Count the heap allocations of the whole program. The Makefile defines
+ * COUNT_ALLOCS and links bench_fs.x with --wrap for each allocator entry
+ * point, so every call from the program and libfs lands here first. Other
+ * builds, such as those with a sanitizer, count nothing.
+ */
+static atomic_size_t num_allocs;
+
+#ifdef COUNT_ALLOCS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	num_allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	num_allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	num_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size)
+{
+	num_allocs++;
+	return __real_aligned_alloc(alignment, size);
+}
+#endif
+
+/*
+ * Open/close: time fs_open() followed by fs_close(), and fs_create() followed
+ * by fs_delete() while the directory has room, and check that neither pair
+ * touches the heap once the file system is mounted.
+ */
+void bench_openclose(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	const int num_files = 100, rounds = 200000;
+	char *diskname, name[FS_FILENAME_LEN];
+	double start, open_s, create_s;
+	size_t open_allocs, create_allocs;
+	int i, r, fd;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+
+	format_disk(diskname, 1024);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < num_files; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		if (fs_create(name))
+			die("Cannot create file %d", i);
+	}
+
+	open_allocs = num_allocs;
+	start = now_sec();
+	for (r = 0; r < rounds; r++) {
+		snprintf(name, sizeof(name), "f%d", r % num_files);
+		fd = fs_open(name);
+		if (fd < 0)
+			die("Cannot open %s", name);
+		if (fs_close(fd))
+			die("Cannot close %s", name);
+	}
+	open_s = now_sec() - start;
+	open_allocs = num_allocs - open_allocs;
+
+	create_allocs = num_allocs;
+	start = now_sec();
+	for (r = 0; r < rounds; r++) {
+		if (fs_create("scratch"))
+			die("Cannot create scratch");
+		if (fs_delete("scratch"))
+			die("Cannot delete scratch");
+	}
+	create_s = now_sec() - start;
+	create_allocs = num_allocs - create_allocs;
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("%16s %12s %8s\n", "op", "ns", "allocs");
+	printf("%16s %12.1f %8zu\n", "open+close", open_s * 1e9 / rounds,
+	       open_allocs);
+	printf("%16s %12.1f %8zu\n", "create+delete", create_s * 1e9 / rounds,
+	       create_allocs);
+	unlink(diskname);
+
+#ifdef COUNT_ALLOCS
+	if (open_allocs || create_allocs)
+		die("The heap was used after mounting");
+#endif
+}
+
+/*
+ * Descriptor storm: keep thousands of descriptors open, then close random ones
+ * and open them again. The cost per pair should not grow with the number
+ * open, and a closed descriptor must stay invalid once its slot is reused.
+ */
+void bench_fdstorm(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const int counts[] = { 32, 1024, 16384, FS_OPEN_MAX_LIMIT };
+	const int num_files = 16, rounds = 1000000;
+	char *diskname, name[FS_FILENAME_LEN];
+	double start, storm_s;
+	int i, n, r, slot, stale, *fds;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+
+	format_disk(diskname, 1024);
+	if (fs_set_open_max(FS_OPEN_MAX_LIMIT))
+		die("Cannot set the descriptor limit");
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < num_files; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		if (fs_create(name))
+			die("Cannot create file %d", i);
+	}
+
+	fds = malloc(FS_OPEN_MAX_LIMIT * sizeof(int));
+	if (!fds)
+		die("Cannot allocate descriptors");
+
+	printf("%8s %16s\n", "open", "open+close_ns");
+	n = 0;
+	for (i = 0; i < (int)ARRAY_SIZE(counts); i++) {
+		for (; n < counts[i]; n++) {
+			snprintf(name, sizeof(name), "f%d", n % num_files);
+			fds[n] = fs_open(name);
+			if (fds[n] < 0)
+				die("Cannot open descriptor %d", n);
+		}
+
+		srand(1);
+		start = now_sec();
+		for (r = 0; r < rounds; r++) {
+			slot = rand() % n;
+			if (fs_close(fds[slot]))
+				die("Cannot close descriptor %d", slot);
+			snprintf(name, sizeof(name), "f%d", slot % num_files);
+			stale = fds[slot];
+			fds[slot] = fs_open(name);
+			if (fds[slot] < 0)
+				die("Cannot reopen descriptor %d", slot);
+			if (fs_stat(stale) >= 0)
+				die("Closed descriptor %d still works", stale);
+		}
+		storm_s = now_sec() - start;
+
+		printf("%8d %16.1f\n", n, storm_s * 1e9 / rounds);
+	}
+
+	/* One past the limit is refused, and the table is usable again after */
+	if (fs_open("f0") >= 0)
+		die("Opened more than %d descriptors", FS_OPEN_MAX_LIMIT);
+	for (i = 0; i < n; i++)
+		if (fs_close(fds[i]))
+			die("Cannot close descriptor %d", i);
+	free(fds);
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	if (fs_set_open_max(FS_OPEN_MAX_COUNT))
+		die("Cannot reset the descriptor limit");
+	unlink(diskname);
+}
+
+/*
+ * Truncate: a rolling log that cuts the last few blocks off a file and writes
+ * them again. Truncating should cost the same whatever the size of the file,
+ * unlike deleting it and writing back what is kept.
+ */
+void bench_truncate(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const size_t sizes_mb[] = { 1, 16, 64, 200 };
+	const size_t chunk = 1024 * 1024, tail = 4 * BLOCK_SIZE;
+	const int rounds = 2000;
+	double start, trunc_s, rewrite_s;
+	char *diskname, *data, *buf;
+	size_t i, off, size;
+	int fd, fd2, r;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(chunk);
+	buf = malloc(chunk);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, chunk);
+
+	printf("%8s %14s %16s\n", "size_mb", "truncate_us", "delete+copy_us");
+	for (i = 0; i < ARRAY_SIZE(sizes_mb); i++) {
+		size = sizes_mb[i] * 1024 * 1024;
+		format_disk(diskname, size / BLOCK_SIZE + 16);
+
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+		if (fs_create(BENCH_FILENAME))
+			die("Cannot create file");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+		for (off = 0; off < size; off += chunk)
+			if (fs_write(fd, data, chunk) != (int)chunk)
+				die("Short write at %zu", off);
+
+		/* A second descriptor left at the end has to follow the cut */
+		fd2 = fs_open(BENCH_FILENAME);
+		if (fd2 < 0 || fs_lseek(fd2, size))
+			die("Cannot open a second descriptor");
+
+		trunc_s = 0;
+		for (r = 0; r < rounds; r++) {
+			start = now_sec();
+			if (fs_ftruncate(fd, size - tail))
+				die("Cannot truncate");
+			trunc_s += now_sec() - start;
+
+			if ((size_t)fs_stat(fd) != size - tail)
+				die("File is %d bytes after truncating", fs_stat(fd));
+			if (fs_read(fd2, buf, 1) != 0)
+				die("Read past the new end");
+
+			fs_lseek(fd, size - tail);
+			if (fs_write(fd, data + (size - tail) % chunk, tail) !=
+			    (int)tail)
+				die("Short rewrite");
+		}
+
+		fs_lseek(fd, size - chunk);
+		if (fs_read(fd, buf, chunk) != (int)chunk ||
+		    memcmp(data, buf, chunk))
+			die("Read back wrong data");
+		fs_close(fd);
+		fs_close(fd2);
+
+		/* Without truncate, the kept part has to be read and rewritten */
+		start = now_sec();
+		if (fs_delete(BENCH_FILENAME) || fs_create(BENCH_FILENAME))
+			die("Cannot recreate file");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+		for (off = 0; off < size - tail; off += chunk)
+			if (fs_write(fd, data, size - tail - off < chunk ?
+				     size - tail - off : chunk) <= 0)
+				die("Short write at %zu", off);
+		rewrite_s = now_sec() - start;
+		fs_close(fd);
+
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%8zu %14.3f %16.1f\n", sizes_mb[i],
+		       trunc_s * 1e6 / rounds, rewrite_s * 1e6);
+	}
+
+	free(data);
+	free(buf);
+	unlink(diskname);
+}
+
+/*
+ * Append: add 100-byte records to the end of logs of growing size, each
+ * through its own fs_write(). Only the last block of the file is touched, so
+ * the rate should not drop as the log grows.
+ */
+void bench_append(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const size_t sizes_mb[] = { 1, 10, 50, 200 };
+	const size_t chunk = 1024 * 1024, record = 100;
+	const int appends = 100000;
+	double start, append_s;
+	char *diskname, *data;
+	size_t i, off, size;
+	int fd, r;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(chunk);
+	if (!data)
+		die("Cannot malloc");
+	fill_pattern(data, chunk);
+
+	printf("%8s %14s %12s\n", "size_mb", "appends/s", "MBps");
+	for (i = 0; i < ARRAY_SIZE(sizes_mb); i++) {
+		size = sizes_mb[i] * 1024 * 1024;
+		format_disk(diskname, (size + appends * record) / BLOCK_SIZE + 16);
+
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+		if (fs_create(BENCH_FILENAME))
+			die("Cannot create file");
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+		for (off = 0; off < size; off += chunk)
+			if (fs_write(fd, data, chunk) != (int)chunk)
+				die("Short write at %zu", off);
+
+		start = now_sec();
+		for (r = 0; r < appends; r++)
+			if (fs_write(fd, data + r % BLOCK_SIZE, record) !=
+			    (int)record)
+				die("Short append %d", r);
+		append_s = now_sec() - start;
+
+		if ((size_t)fs_stat(fd) != size + appends * record)
+			die("File is %d bytes", fs_stat(fd));
+		fs_close(fd);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%8zu %14.0f %12.1f\n", sizes_mb[i], appends / append_s,
+		       appends * record / append_s / 1e6);
+	}
+
+	free(data);
+	unlink(diskname);
+}
+
+/* Number of runs of contiguous disk blocks that @filename is made of */
+static int count_extents(const char *filename, size_t size)
+{
+	static struct iovec iov[16384];
+	int fd, n;
+
+	/* On a mapped disk, contiguous blocks come back as one span */
+	fd = fs_open(filename);
+	if (fd < 0)
+		die("Cannot open %s", filename);
+	n = fs_read_view(fd, 0, size, iov, ARRAY_SIZE(iov));
+	if (n < 0)
+		die("Cannot view %s", filename);
+	fs_release_view(iov, n);
+	fs_close(fd);
+
+	return n;
+}
+
+/*
+ * Fallocate: write two files a block at a time each, alternating between
+ * them as two concurrent imports would, once growing them as they go and
+ * once reserving their final size first. Count the runs of contiguous blocks
+ * each file ends up in, and time reading one back with the cache off.
+ */
+void bench_fallocate(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const char *names[] = { "import_a", "import_b" };
+	const size_t size = 32 * 1024 * 1024;
+	double start, read_s;
+	char *diskname, *data, *buf;
+	int mode, fd[2], i;
+	size_t off;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists)");
+
+	diskname = b_arg->argv[0];
+
+	data = malloc(size);
+	buf = malloc(size);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	printf("%12s %10s %10s %12s\n", "mode", "extents_a", "extents_b",
+	       "read_MBps");
+	for (mode = 0; mode < 2; mode++) {
+		format_disk(diskname, 2 * size / BLOCK_SIZE + 16);
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+
+		for (i = 0; i < 2; i++) {
+			if (fs_create(names[i]))
+				die("Cannot create %s", names[i]);
+			fd[i] = fs_open(names[i]);
+			if (fd[i] < 0)
+				die("Cannot open %s", names[i]);
+			if (mode == 1 && fs_fallocate(fd[i], size))
+				die("Cannot preallocate %s", names[i]);
+			if (fs_stat(fd[i]) != 0)
+				die("Preallocating changed the size of %s",
+				    names[i]);
+		}
+
+		for (off = 0; off < size; off += BLOCK_SIZE)
+			for (i = 0; i < 2; i++)
+				if (fs_write(fd[i], data + off, BLOCK_SIZE) !=
+				    BLOCK_SIZE)
+					die("Short write at %zu", off);
+		for (i = 0; i < 2; i++)
+			fs_close(fd[i]);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+
+		/* Read straight from the disk, one transfer per run */
+		fs_set_cache_size(0);
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+		fd[0] = fs_open(names[0]);
+		start = now_sec();
+		if (fs_read(fd[0], buf, size) != (int)size)
+			die("Short read");
+		read_s = now_sec() - start;
+		if (memcmp(data, buf, size))
+			die("Read back wrong data");
+		fs_close(fd[0]);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+		fs_set_cache_size(DEFAULT_CACHE_BLOCKS);
+
+		fs_set_backend(FS_BACKEND_MMAP);
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+		printf("%12s %10d %10d %12.1f\n", mode ? "fallocate" : "grow",
+		       count_extents(names[0], size),
+		       count_extents(names[1], size), size / read_s / 1e6);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+		fs_set_backend(FS_BACKEND_PREAD);
+	}
+
+	free(data);
+	free(buf);
+	unlink(diskname);
+}
+
+/*
+ * Read every file of @names back with the cache off, checking it against
+ * @data, and return the throughput in MB/s.
+ */
+static double read_files_mbps(const char *diskname, const char **names,
+			      int n, const char *data, char *buf, size_t size)
+{
+	double start, elapsed = 0;
+	int i, fd;
+
+	fs_set_cache_size(0);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < n; i++) {
+		fd = fs_open(names[i]);
+		if (fd < 0)
+			die("Cannot open %s", names[i]);
+		start = now_sec();
+		if (fs_read(fd, buf, size) != (int)size)
+			die("Short read of %s", names[i]);
+		elapsed += now_sec() - start;
+		if (memcmp(data, buf, size))
+			die("Read back wrong data from %s", names[i]);
+		fs_close(fd);
+	}
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	fs_set_cache_size(DEFAULT_CACHE_BLOCKS);
+
+	return n * size / elapsed / 1e6;
+}
+
+/*
+ * Defrag: write four files a block at a time each, interleaved as concurrent
+ * imports would leave them, then defragment them while mounted, a budget of
+ * blocks per call. Report the fragmentation and the sequential read
+ * throughput with the cache off, before and after, and the longest call.
+ */
+void bench_defrag(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	static const char *names[] = { "frag_a", "frag_b", "frag_c", "frag_d" };
+	const int n = ARRAY_SIZE(names);
+	const size_t size = 8 * 1024 * 1024;
+	struct fs_frag_stats before, after;
+	double start, call_s, max_call_s = 0, before_mbps, after_mbps;
+	char *diskname, *data, *buf;
+	size_t budget = 4096, off, total = 0;
+	int fd[ARRAY_SIZE(names)], i, moved, passes = 0;
+
+	if (b_arg->argc < 1)
+		die("Usage: <diskname> (created, and overwritten if it exists) "
+		    "[<blocks per call>]");
+
+	diskname = b_arg->argv[0];
+	if (b_arg->argc > 1)
+		budget = strtoul(b_arg->argv[1], NULL, 0);
+
+	data = malloc(size);
+	buf = malloc(size);
+	if (!data || !buf)
+		die("Cannot malloc");
+	fill_pattern(data, size);
+
+	/* Room for every file twice, so each one has a free run to move to */
+	format_disk(diskname, 2 * n * size / BLOCK_SIZE + 16);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < n; i++) {
+		if (fs_create(names[i]))
+			die("Cannot create %s", names[i]);
+		fd[i] = fs_open(names[i]);
+		if (fd[i] < 0)
+			die("Cannot open %s", names[i]);
+	}
+	for (off = 0; off < size; off += BLOCK_SIZE)
+		for (i = 0; i < n; i++)
+			if (fs_write(fd[i], data + off, BLOCK_SIZE) != BLOCK_SIZE)
+				die("Short write at %zu", off);
+	for (i = 0; i < n; i++)
+		fs_close(fd[i]);
+	if (fs_frag_stats(&before))
+		die("Cannot get fragmentation");
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	before_mbps = read_files_mbps(diskname, names, n, data, buf, size);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (;;) {
+		start = now_sec();
+		moved = fs_defrag(budget);
+		call_s = now_sec() - start;
+		if (moved < 0)
+			die("Cannot defragment");
+		if (moved == 0)
+			break;
+		if (call_s > max_call_s)
+			max_call_s = call_s;
+		total += moved;
+		passes++;
+	}
+	if (fs_frag_stats(&after))
+		die("Cannot get fragmentation");
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	after_mbps = read_files_mbps(diskname, names, n, data, buf, size);
+
+	printf("%8s %10s %10s %12s\n", "state", "fragmented", "extents",
+	       "read_MBps");
+	printf("%8s %10zu %10zu %12.1f\n", "before", before.fragmented_files,
+	       before.extents, before_mbps);
+	printf("%8s %10zu %10zu %12.1f\n", "after", after.fragmented_files,
+	       after.extents, after_mbps);
+	printf("moved %zu blocks in %d calls of %zu blocks, longest %.1f ms, "
+	       "read speedup %.1fx\n", total, passes, budget,
+	       max_call_s * 1e3, after_mbps / before_mbps);
+
+	free(data);
+	free(buf);
+	unlink(diskname);
+}
+
+static struct {
+	const char *name;
+	void(*func)(void *);
+} commands[] = {
+	{ "seqread",	bench_seqread },
+	{ "smallio",	bench_smallio },
+	{ "seqio",		bench_seqio },
+	{ "diskmt",		bench_diskmt },
+	{ "multimount",	bench_multimount },
+	{ "fsmt",		bench_fsmt },
+	{ "backend",	bench_backend },
+	{ "view",		bench_view },
+	{ "aioqd",		bench_aioqd },
+	{ "scan",		bench_scan },
+	{ "largefile",	bench_largefile },
+	{ "dir",		bench_dir },
+	{ "umount",		bench_umount },
+	{ "journal",	bench_journal },
+	{ "mount",		bench_mount },
+	{ "openclose",	bench_openclose },
+	{ "fdstorm",	bench_fdstorm },
+	{ "truncate",	bench_truncate },
+	{ "append",		bench_append },
+	{ "fallocate",	bench_fallocate },
+	{ "defrag",	bench_defrag },
+};
+
+void usage(char *program)
+{
+	size_t i;
+	fprintf(stderr, "Usage: %s <command> [<arg>]\n", program);
+	fprintf(stderr, "Possible commands are:\n");
+	for (i = 0; i < ARRAY_SIZE(commands); i++)
+		fprintf(stderr, "\t%s\n", commands[i].name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	char *program;
+	char *cmd;
+	struct bench_arg arg;
+
+	program = argv[0];
+
+	if (argc == 1)
+		usage(program);
+
+	/* Skip argv[0] */
+	argc--;
+	argv++;
+
+	cmd = argv[0];
+	arg.argc = --argc;
+	arg.argv = &argv[1];
+
+	for (i = 0; i < ARRAY_SIZE(commands); i++) {
+		if (!strcmp(cmd, commands[i].name)) {
+			commands[i].func(&arg);
+			break;
+		}
+	}
+	if (i == ARRAY_SIZE(commands)) {
+		bench_error("invalid command '%s'", cmd);
+		usage(program);
+	}
+
+	return 0;
+}
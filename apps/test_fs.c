@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +14,9 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
+/* Events kept when tracing with FS_TRACE */
+#define TRACE_EVENTS (1 << 20)
+
 #define test_fs_error(fmt, ...) \
 	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
 
@@ -507,6 +511,200 @@ size_t get_argv(char *argv)
 	return (size_t)ret;
 }
 
+static void print_frag_stats(const char *when)
+{
+	struct fs_frag_stats stats;
+
+	if (fs_frag_stats(&stats)) {
+		fs_umount();
+		die("Cannot get fragmentation");
+	}
+
+	printf("%s: %zu files, %zu fragmented, %zu blocks in %zu extents\n",
+	       when, stats.files, stats.fragmented_files, stats.blocks,
+	       stats.extents);
+}
+
+void thread_fs_defrag(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	size_t max_blocks = SIZE_MAX;
+	int moved, passes = 0;
+	size_t total = 0;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<max blocks per pass>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		max_blocks = get_argv(t_arg->argv[1]);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	print_frag_stats("Before");
+
+	/* Each pass moves about max_blocks blocks, like a background defrag would */
+	while ((moved = fs_defrag(max_blocks)) > 0) {
+		passes++;
+		total += moved;
+		printf("Pass %d: moved %d blocks\n", passes, moved);
+	}
+	if (moved < 0) {
+		fs_umount();
+		die("Cannot defragment");
+	}
+
+	print_frag_stats("After");
+	printf("Moved %zu blocks in %d passes\n", total, passes);
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+void thread_fs_analyze(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	struct fs_layout layout;
+	struct fs_file_layout *files;
+	int n, i, bucket;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = t_arg->argv[0];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* Count the files first, to know how many to make room for */
+	n = fs_analyze(&layout, NULL, 0);
+	if (n < 0) {
+		fs_umount();
+		die("Cannot analyze");
+	}
+	files = malloc((n + 1) * sizeof(struct fs_file_layout));
+	if (!files) {
+		fs_umount();
+		die_perror("malloc");
+	}
+	n = fs_analyze(&layout, files, n + 1);
+	if (n < 0) {
+		free(files);
+		fs_umount();
+		die("Cannot analyze");
+	}
+
+	printf("%-16s %10s %8s %8s %10s %10s\n", "file", "size", "blocks",
+	       "extents", "avg_extent", "inversions");
+	for (i = 0; i < n; i++)
+		printf("%-16s %10zu %8zu %8zu %10.1f %10zu\n",
+		       files[i].filename, files[i].size, files[i].blocks,
+		       files[i].extents, files[i].extents ?
+		       (double)files[i].blocks / files[i].extents : 0,
+		       files[i].inversions);
+
+	printf("files=%zu fragmented=%zu blocks=%zu extents=%zu "
+	       "avg_extent=%.1f inversions=%zu\n", layout.files,
+	       layout.fragmented_files, layout.blocks, layout.extents,
+	       layout.extents ? (double)layout.blocks / layout.extents : 0,
+	       layout.inversions);
+	printf("free_blocks=%zu free_runs=%zu largest_free_run=%zu\n",
+	       layout.free_blocks, layout.free_runs, layout.largest_free_run);
+	for (bucket = 0; bucket < FS_FREE_RUN_BUCKETS; bucket++) {
+		if (!layout.free_run_hist[bucket])
+			continue;
+		if (bucket == 0)
+			printf("free runs of 1 block: %zu\n",
+			       layout.free_run_hist[0]);
+		else
+			printf("free runs of %zu-%zu blocks: %zu\n",
+			       (size_t)1 << bucket,
+			       ((size_t)1 << (bucket + 1)) - 1,
+			       layout.free_run_hist[bucket]);
+	}
+
+	free(files);
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+static void print_latency(const char *name, const struct fs_latency *lat)
+{
+	int bucket;
+
+	if (!lat->calls)
+		return;
+
+	printf("%s: %llu calls, avg %.1f us\n", name, lat->calls,
+	       lat->total_ns / 1e3 / lat->calls);
+	for (bucket = 0; bucket < FS_LATENCY_BUCKETS; bucket++)
+		if (lat->hist[bucket])
+			printf("\t>= %llu ns: %llu\n", 1ULL << bucket,
+			       lat->hist[bucket]);
+}
+
+void thread_fs_stats(void *arg)
+{
+	static const char *op_names[FS_OP_COUNT] = {
+		[FS_OP_MOUNT] = "fs_mount",
+		[FS_OP_OPEN] = "fs_open",
+		[FS_OP_READ] = "fs_read",
+		[FS_OP_WRITE] = "fs_write",
+		[FS_OP_DELETE] = "fs_delete",
+		[FS_OP_UMOUNT] = "fs_umount",
+	};
+	struct thread_arg *t_arg = arg;
+	struct fs_stats stats;
+	char *diskname, *filename = NULL;
+	char buf[4096];
+	int fs_fd, i;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname> [<filename>]");
+
+	diskname = t_arg->argv[0];
+	if (t_arg->argc > 1)
+		filename = t_arg->argv[1];
+
+	if (fs_get_stats(&stats))
+		die("libfs was built without counters (make STATS=0)");
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* Read the file a block at a time, so fs_read() has a histogram */
+	if (filename) {
+		fs_fd = fs_open(filename);
+		if (fs_fd < 0) {
+			fs_umount();
+			die("Cannot open file");
+		}
+		while (fs_read(fs_fd, buf, sizeof(buf)) > 0)
+			;
+		fs_close(fs_fd);
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	fs_get_stats(&stats);
+	printf("disk_reads=%llu blocks_read=%llu\n", stats.disk_reads,
+	       stats.blocks_read);
+	printf("disk_writes=%llu blocks_written=%llu\n", stats.disk_writes,
+	       stats.blocks_written);
+	printf("bytes_read=%llu bytes_written=%llu\n", stats.bytes_read,
+	       stats.bytes_written);
+	printf("fat_steps=%llu allocs=%llu alloc_scanned=%llu "
+	       "rmw_cycles=%llu\n", stats.fat_steps, stats.allocs,
+	       stats.alloc_scanned, stats.rmw_cycles);
+	for (i = 0; i < FS_OP_COUNT; i++)
+		print_latency(op_names[i], &stats.latency[i]);
+}
+
 static struct {
 	const char *name;
 	void(*func)(void *);
@@ -517,9 +715,22 @@ static struct {
 	{ "rm",		thread_fs_rm },
 	{ "cat",	thread_fs_cat },
 	{ "stat",	thread_fs_stat },
+	{ "defrag",	thread_fs_defrag },
+	{ "analyze",	thread_fs_analyze },
+	{ "stats",	thread_fs_stats },
 	{ "script",	thread_fs_script }
 };
 
+/* File named by FS_TRACE */
+static char *trace_file;
+
+static void dump_trace(void)
+{
+	fs_trace_stop();
+	if (fs_trace_dump(trace_file))
+		test_fs_error("Cannot write trace to %s", trace_file);
+}
+
 void usage(char *program)
 {
 	size_t i;
@@ -550,6 +761,15 @@ int main(int argc, char **argv)
 	arg.argc = --argc;
 	arg.argv = &argv[1];
 
+	/* FS_TRACE=<file> dumps a trace of the command, for chrome://tracing */
+	trace_file = getenv("FS_TRACE");
+	if (trace_file) {
+		if (fs_trace_start(TRACE_EVENTS))
+			die("Cannot start tracing");
+		/* Commands exit when they fail, which is when a trace helps most */
+		atexit(dump_trace);
+	}
+
 	for (i = 0; i < ARRAY_SIZE(commands); i++) {
 		if (!strcmp(cmd, commands[i].name)) {
 			commands[i].func(&arg);
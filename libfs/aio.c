@@ -0,0 +1,276 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "aio.h"
+#include "cache.h"
+#include "disk.h"
+
+struct aio_request;
+
+/* An operation waiting for, or being performed by, a worker */
+struct aio_job {
+	struct aio_request *req;
+	struct aio_op op;
+	/* Next job in the queue */
+	struct aio_job *next;
+};
+
+struct aio_request {
+	unsigned long long user_data;
+	int result;
+	bool is_write;
+	bool failed;
+	/* Jobs not performed yet */
+	size_t remaining;
+	/* Next request in the completion queue */
+	struct aio_request *next;
+	/* One job per operation, allocated with the request */
+	struct aio_job jobs[];
+};
+
+struct aio_engine {
+	struct block_cache *cache;
+
+	/* Guards everything below */
+	pthread_mutex_t lock;
+	/* Signalled when a job is queued or the engine stops */
+	pthread_cond_t work_cond;
+	/* Signalled when a request completes */
+	pthread_cond_t done_cond;
+
+	/* Jobs waiting for a worker, oldest first */
+	struct aio_job *job_head;
+	struct aio_job *job_tail;
+
+	/* Completed requests waiting to be reaped, oldest first */
+	struct aio_request *cq_head;
+	struct aio_request *cq_tail;
+	size_t cq_count;
+
+	/* Requests submitted but not completed */
+	size_t in_flight;
+
+	pthread_t threads[AIO_THREADS];
+	size_t num_threads;
+	bool stopping;
+};
+
+/* Must be called with the engine locked */
+static void complete(struct aio_engine *engine, struct aio_request *req)
+{
+	req->next = NULL;
+	if (engine->cq_tail)
+		engine->cq_tail->next = req;
+	else
+		engine->cq_head = req;
+	engine->cq_tail = req;
+	engine->cq_count++;
+
+	engine->in_flight--;
+	pthread_cond_broadcast(&engine->done_cond);
+}
+
+static int perform(struct aio_engine *engine, const struct aio_op *op,
+		   bool is_write)
+{
+	if (op->offset == 0 && op->len % BLOCK_SIZE == 0) {
+		if (is_write)
+			return cache_write_blocks(engine->cache, op->block,
+						  op->len / BLOCK_SIZE, op->buf);
+		return cache_read_blocks(engine->cache, op->block,
+					 op->len / BLOCK_SIZE, op->buf);
+	}
+
+	if (is_write)
+		return cache_write(engine->cache, op->block, op->offset,
+				   op->len, op->buf);
+	return cache_read(engine->cache, op->block, op->offset, op->len,
+			  op->buf);
+}
+
+static void *worker_run(void *arg)
+{
+	struct aio_engine *engine = arg;
+	struct aio_request *req;
+	struct aio_job *job;
+	int ret;
+
+	pthread_mutex_lock(&engine->lock);
+	for (;;) {
+		while (!engine->job_head && !engine->stopping)
+			pthread_cond_wait(&engine->work_cond, &engine->lock);
+		if (!engine->job_head)
+			break;
+
+		job = engine->job_head;
+		engine->job_head = job->next;
+		if (!engine->job_head)
+			engine->job_tail = NULL;
+
+		/* Perform the job without holding up the other workers */
+		pthread_mutex_unlock(&engine->lock);
+		req = job->req;
+		ret = perform(engine, &job->op, req->is_write);
+		pthread_mutex_lock(&engine->lock);
+
+		if (ret)
+			req->failed = true;
+		if (--req->remaining == 0)
+			complete(engine, req);
+	}
+	pthread_mutex_unlock(&engine->lock);
+
+	return NULL;
+}
+
+struct aio_engine *aio_create(struct block_cache *cache)
+{
+	struct aio_engine *engine;
+
+	engine = calloc(1, sizeof(struct aio_engine));
+	if (!engine)
+		return NULL;
+
+	engine->cache = cache;
+
+	if (pthread_mutex_init(&engine->lock, NULL)) {
+		free(engine);
+		return NULL;
+	}
+	if (pthread_cond_init(&engine->work_cond, NULL)) {
+		pthread_mutex_destroy(&engine->lock);
+		free(engine);
+		return NULL;
+	}
+	if (pthread_cond_init(&engine->done_cond, NULL)) {
+		pthread_cond_destroy(&engine->work_cond);
+		pthread_mutex_destroy(&engine->lock);
+		free(engine);
+		return NULL;
+	}
+
+	return engine;
+}
+
+void aio_destroy(struct aio_engine *engine)
+{
+	struct aio_request *req;
+	size_t i;
+
+	if (!engine)
+		return;
+
+	aio_drain(engine);
+
+	pthread_mutex_lock(&engine->lock);
+	engine->stopping = true;
+	pthread_cond_broadcast(&engine->work_cond);
+	pthread_mutex_unlock(&engine->lock);
+
+	for (i = 0; i < engine->num_threads; i++)
+		pthread_join(engine->threads[i], NULL);
+
+	while (engine->cq_head) {
+		req = engine->cq_head;
+		engine->cq_head = req->next;
+		free(req);
+	}
+
+	pthread_cond_destroy(&engine->done_cond);
+	pthread_cond_destroy(&engine->work_cond);
+	pthread_mutex_destroy(&engine->lock);
+	free(engine);
+}
+
+int aio_submit(struct aio_engine *engine, const struct aio_op *ops,
+	       size_t num_ops, bool is_write, int result,
+	       unsigned long long user_data)
+{
+	struct aio_request *req;
+	size_t i;
+
+	req = malloc(sizeof(struct aio_request) +
+		     num_ops * sizeof(struct aio_job));
+	if (!req)
+		return -1;
+
+	req->user_data = user_data;
+	req->result = result;
+	req->is_write = is_write;
+	req->failed = false;
+	req->remaining = num_ops;
+
+	for (i = 0; i < num_ops; i++) {
+		req->jobs[i].req = req;
+		req->jobs[i].op = ops[i];
+		req->jobs[i].next = i + 1 < num_ops ? &req->jobs[i + 1] : NULL;
+	}
+
+	pthread_mutex_lock(&engine->lock);
+
+	/* Start the workers on first use */
+	while (engine->num_threads < AIO_THREADS) {
+		if (pthread_create(&engine->threads[engine->num_threads], NULL,
+				   worker_run, engine))
+			break;
+		engine->num_threads++;
+	}
+	if (engine->num_threads == 0) {
+		pthread_mutex_unlock(&engine->lock);
+		free(req);
+		return -1;
+	}
+
+	engine->in_flight++;
+	if (num_ops == 0) {
+		complete(engine, req);
+	} else {
+		if (engine->job_tail)
+			engine->job_tail->next = &req->jobs[0];
+		else
+			engine->job_head = &req->jobs[0];
+		engine->job_tail = &req->jobs[num_ops - 1];
+		pthread_cond_broadcast(&engine->work_cond);
+	}
+
+	pthread_mutex_unlock(&engine->lock);
+	return 0;
+}
+
+int aio_reap(struct aio_engine *engine, struct aio_completion *completions,
+	     int max, int min)
+{
+	struct aio_request *req;
+	int n = 0;
+
+	pthread_mutex_lock(&engine->lock);
+
+	while (engine->cq_count < (size_t)(min > 0 ? min : 0) &&
+	       engine->in_flight > 0)
+		pthread_cond_wait(&engine->done_cond, &engine->lock);
+
+	while (n < max && engine->cq_head) {
+		req = engine->cq_head;
+		engine->cq_head = req->next;
+		if (!engine->cq_head)
+			engine->cq_tail = NULL;
+		engine->cq_count--;
+
+		completions[n].user_data = req->user_data;
+		completions[n].result = req->failed ? -1 : req->result;
+		n++;
+		free(req);
+	}
+
+	pthread_mutex_unlock(&engine->lock);
+	return n;
+}
+
+void aio_drain(struct aio_engine *engine)
+{
+	pthread_mutex_lock(&engine->lock);
+	while (engine->in_flight > 0)
+		pthread_cond_wait(&engine->done_cond, &engine->lock);
+	pthread_mutex_unlock(&engine->lock);
+}
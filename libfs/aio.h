@@ -0,0 +1,105 @@
+#ifndef _AIO_H
+#define _AIO_H
+
+#include <stdbool.h>
+#include <stddef.h> /* for size_t definition */
+
+#include "cache.h"
+
+/** Number of worker threads of an engine */
+#define AIO_THREADS 8
+
+/** Longest run of whole blocks moved by a single operation */
+#define AIO_MAX_OP_BLOCKS 64
+
+/**
+ * Asynchronous block I/O engine
+ *
+ * Requests are made of independent block operations, which a pool of worker
+ * threads performs through a block cache in any order and in parallel. Once
+ * every operation of a request is done, the request shows up in the engine's
+ * completion queue. The worker threads are only started on the first
+ * submission, so an engine that is never used costs nothing.
+ */
+struct aio_engine;
+
+/** One block operation of a request */
+struct aio_op {
+	/* Index of the first block */
+	size_t block;
+	/* Offset of the first byte within the block */
+	size_t offset;
+	/*
+	 * Number of bytes to move, either within the block, or a multiple of
+	 * %BLOCK_SIZE when @offset is 0
+	 */
+	size_t len;
+	/* Buffer to read into or write from */
+	void *buf;
+};
+
+/** A completed request */
+struct aio_completion {
+	/* Value given when the request was submitted */
+	unsigned long long user_data;
+	/* Result given when the request was submitted, or -1 if an operation failed */
+	int result;
+};
+
+/**
+ * aio_create - Create an engine
+ * @cache: Cache every operation goes through
+ *
+ * Return: NULL if memory could not be allocated, the new engine otherwise.
+ */
+struct aio_engine *aio_create(struct block_cache *cache);
+
+/**
+ * aio_destroy - Release an engine
+ * @engine: Engine to destroy
+ *
+ * Waits for every submitted request, and drops the completions that were not
+ * reaped.
+ */
+void aio_destroy(struct aio_engine *engine);
+
+/**
+ * aio_submit - Submit a request
+ * @engine: Engine
+ * @ops: Operations making up the request, copied by the engine
+ * @num_ops: Number of operations in @ops, which may be 0
+ * @is_write: Whether the operations write to the blocks
+ * @result: Result reported when every operation succeeds
+ * @user_data: Value reported with the completion
+ *
+ * Return: -1 if memory could not be allocated or if the worker threads could
+ * not be started. 0 otherwise.
+ */
+int aio_submit(struct aio_engine *engine, const struct aio_op *ops,
+	       size_t num_ops, bool is_write, int result,
+	       unsigned long long user_data);
+
+/**
+ * aio_reap - Take completions off the completion queue
+ * @engine: Engine
+ * @completions: Array to be filled with completions
+ * @max: Number of completions @completions can hold
+ * @min: Number of completions to wait for
+ *
+ * Waits until at least @min completions are available, or fewer if fewer
+ * requests are in flight, then takes up to @max of them in completion order.
+ *
+ * Return: the number of completions taken.
+ */
+int aio_reap(struct aio_engine *engine, struct aio_completion *completions,
+	     int max, int min);
+
+/**
+ * aio_drain - Wait for every submitted request to complete
+ * @engine: Engine
+ *
+ * The completions stay in the queue.
+ */
+void aio_drain(struct aio_engine *engine);
+
+#endif /* _AIO_H */
@@ -0,0 +1,205 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+
+#define BITS_PER_WORD 64
+
+#define WORD_OF(index) ((index) / BITS_PER_WORD)
+#define BIT_OF(index) ((uint64_t)1 << ((index) % BITS_PER_WORD))
+
+int bitmap_init(struct bitmap *bm, size_t num_bits)
+{
+	bm->num_bits = num_bits;
+	bm->num_words = (num_bits + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	bm->num_summary = (bm->num_words + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	bm->first_free_word = bm->num_words;
+	bm->num_free = 0;
+
+	/* calloc() makes every item start out used */
+	bm->words = calloc(bm->num_words ? bm->num_words : 1, sizeof(uint64_t));
+	bm->summary = calloc(bm->num_summary ? bm->num_summary : 1,
+			     sizeof(uint64_t));
+	if (!bm->words || !bm->summary) {
+		bitmap_destroy(bm);
+		return -1;
+	}
+
+	return 0;
+}
+
+void bitmap_destroy(struct bitmap *bm)
+{
+	free(bm->words);
+	free(bm->summary);
+	bm->words = NULL;
+	bm->summary = NULL;
+	bm->num_bits = 0;
+	bm->num_words = 0;
+	bm->num_summary = 0;
+	bm->num_free = 0;
+}
+
+int bitmap_grow(struct bitmap *bm, size_t num_bits)
+{
+	size_t num_words, num_summary;
+	uint64_t *words, *summary;
+
+	if (num_bits <= bm->num_bits)
+		return 0;
+
+	num_words = (num_bits + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	num_summary = (num_words + BITS_PER_WORD - 1) / BITS_PER_WORD;
+
+	/* The new words are zeroed, so every new item starts out used */
+	words = realloc(bm->words, num_words * sizeof(uint64_t));
+	if (!words)
+		return -1;
+	memset(words + bm->num_words, 0,
+	       (num_words - bm->num_words) * sizeof(uint64_t));
+	bm->words = words;
+
+	summary = realloc(bm->summary, num_summary * sizeof(uint64_t));
+	if (!summary)
+		return -1;
+	memset(summary + bm->num_summary, 0,
+	       (num_summary - bm->num_summary) * sizeof(uint64_t));
+	bm->summary = summary;
+
+	/* No free word existed before, so none exists before the new ones */
+	if (bm->first_free_word == bm->num_words)
+		bm->first_free_word = num_words;
+
+	bm->num_bits = num_bits;
+	bm->num_words = num_words;
+	bm->num_summary = num_summary;
+
+	return 0;
+}
+
+void bitmap_free(struct bitmap *bm, size_t index)
+{
+	size_t w = WORD_OF(index);
+
+	if (index >= bm->num_bits || (bm->words[w] & BIT_OF(index)))
+		return;
+
+	bm->words[w] |= BIT_OF(index);
+	bm->summary[WORD_OF(w)] |= BIT_OF(w);
+	bm->num_free++;
+
+	if (w < bm->first_free_word)
+		bm->first_free_word = w;
+}
+
+void bitmap_use(struct bitmap *bm, size_t index)
+{
+	size_t w = WORD_OF(index);
+
+	if (index >= bm->num_bits || !(bm->words[w] & BIT_OF(index)))
+		return;
+
+	bm->words[w] &= ~BIT_OF(index);
+	if (bm->words[w] == 0)
+		bm->summary[WORD_OF(w)] &= ~BIT_OF(w);
+	bm->num_free--;
+}
+
+bool bitmap_is_free(const struct bitmap *bm, size_t index)
+{
+	if (index >= bm->num_bits)
+		return false;
+
+	return (bm->words[WORD_OF(index)] & BIT_OF(index)) != 0;
+}
+
+/*
+ * Find the first word at or after @from that has a free bit, using the summary
+ * level to skip over 64 fully used words at a time. Return num_words if there
+ * is none.
+ */
+static size_t next_free_word(const struct bitmap *bm, size_t from)
+{
+	size_t s = WORD_OF(from);
+	uint64_t mask;
+
+	if (from >= bm->num_words)
+		return bm->num_words;
+
+	/* Ignore the words before @from in the first summary word */
+	mask = bm->summary[s] & (~(uint64_t)0 << (from % BITS_PER_WORD));
+	while (!mask) {
+		if (++s >= bm->num_summary)
+			return bm->num_words;
+		mask = bm->summary[s];
+	}
+
+	return s * BITS_PER_WORD + __builtin_ctzll(mask);
+}
+
+size_t bitmap_alloc(struct bitmap *bm, size_t max_count, size_t *start)
+{
+	size_t w, index, count = 0;
+
+	if (max_count == 0)
+		return 0;
+
+	w = next_free_word(bm, bm->first_free_word);
+	bm->first_free_word = w;
+	if (w == bm->num_words)
+		return 0;
+
+	index = w * BITS_PER_WORD + __builtin_ctzll(bm->words[w]);
+	*start = index;
+
+	/* Grow the run for as long as the following items are free */
+	while (count < max_count && bitmap_is_free(bm, index)) {
+		bitmap_use(bm, index);
+		index++;
+		count++;
+	}
+
+	return count;
+}
+
+int bitmap_alloc_run(struct bitmap *bm, size_t count, size_t *start)
+{
+	size_t w, prev_w, b, index, i;
+	size_t run_start = 0, run_len = 0;
+
+	if (count == 0 || count > bm->num_free)
+		return -1;
+
+	prev_w = bm->num_words;
+	for (w = next_free_word(bm, bm->first_free_word); w < bm->num_words;
+	     prev_w = w, w = next_free_word(bm, w + 1)) {
+		/* A fully used word was skipped, so the run is broken */
+		if (w != prev_w + 1)
+			run_len = 0;
+
+		for (b = 0; b < BITS_PER_WORD; b++) {
+			index = w * BITS_PER_WORD + b;
+			if (index >= bm->num_bits)
+				break;
+
+			if (!(bm->words[w] & BIT_OF(index))) {
+				run_len = 0;
+				continue;
+			}
+
+			if (run_len++ == 0)
+				run_start = index;
+
+			if (run_len == count) {
+				for (i = run_start; i < run_start + count; i++)
+					bitmap_use(bm, i);
+				*start = run_start;
+				return 0;
+			}
+		}
+	}
+
+	return -1;
+}
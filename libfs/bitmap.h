@@ -0,0 +1,111 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include <stdbool.h>
+#include <stddef.h> /* for size_t definition */
+#include <stdint.h>
+
+/**
+ * Two-level free-space bitmap
+ *
+ * Each bit of @words tracks one item (a data block), set when the item is
+ * free. Each bit of @summary tracks one word of @words, set when that word
+ * still has at least one free bit, so a search can skip 4096 used items by
+ * looking at a single summary bit.
+ */
+struct bitmap {
+	/* One bit per item, 1 = free */
+	uint64_t *words;
+	/* One bit per word of @words, 1 = word has a free bit */
+	uint64_t *summary;
+	/* Number of items tracked */
+	size_t num_bits;
+	/* Length of @words and @summary */
+	size_t num_words;
+	size_t num_summary;
+	/* No free bit exists in any word before this one */
+	size_t first_free_word;
+	/* Number of bits currently set */
+	size_t num_free;
+};
+
+/**
+ * bitmap_init - Initialize a bitmap
+ * @bm: Bitmap to initialize
+ * @num_bits: Number of items to track
+ *
+ * Every item starts out used; free items are added with bitmap_free().
+ *
+ * Return: -1 if memory could not be allocated. 0 otherwise.
+ */
+int bitmap_init(struct bitmap *bm, size_t num_bits);
+
+/**
+ * bitmap_destroy - Release the memory held by a bitmap
+ * @bm: Bitmap to destroy
+ */
+void bitmap_destroy(struct bitmap *bm);
+
+/**
+ * bitmap_grow - Track more items
+ * @bm: Bitmap
+ * @num_bits: New number of items, no smaller than the current one
+ *
+ * The items added start out used, like in bitmap_init().
+ *
+ * Return: -1 if memory could not be allocated, in which case @bm is left as
+ * it was. 0 otherwise.
+ */
+int bitmap_grow(struct bitmap *bm, size_t num_bits);
+
+/**
+ * bitmap_free - Mark an item as free
+ * @bm: Bitmap
+ * @index: Item to mark
+ */
+void bitmap_free(struct bitmap *bm, size_t index);
+
+/**
+ * bitmap_use - Mark an item as used
+ * @bm: Bitmap
+ * @index: Item to mark
+ */
+void bitmap_use(struct bitmap *bm, size_t index);
+
+/**
+ * bitmap_is_free - Check whether an item is free
+ * @bm: Bitmap
+ * @index: Item to check
+ *
+ * Return: true if @index is free.
+ */
+bool bitmap_is_free(const struct bitmap *bm, size_t index);
+
+/**
+ * bitmap_alloc - Allocate the lowest free items, as one contiguous run
+ * @bm: Bitmap
+ * @max_count: Largest number of items wanted
+ * @start: Filled with the first item of the run
+ *
+ * Find the lowest free item and grow a run of free items from it, up to
+ * @max_count items long. Every item of the run is marked used. Calling this
+ * repeatedly until enough items are gathered costs amortized O(1) per item,
+ * and hands out as few runs as first-fit placement allows.
+ *
+ * Return: the length of the run, or 0 if no item is free.
+ */
+size_t bitmap_alloc(struct bitmap *bm, size_t max_count, size_t *start);
+
+/**
+ * bitmap_alloc_run - Allocate an exact contiguous run of items
+ * @bm: Bitmap
+ * @count: Number of contiguous items wanted
+ * @start: Filled with the first item of the run
+ *
+ * Find the lowest run of @count free items in a row and mark them used.
+ *
+ * Return: -1 if there is no such run. 0 otherwise.
+ */
+int bitmap_alloc_run(struct bitmap *bm, size_t count, size_t *start);
+
+#endif /* _BITMAP_H */
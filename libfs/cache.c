@@ -0,0 +1,872 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "cache.h"
+#include "disk.h"
+#include "stats.h"
+
+/* Marks the end of a hash chain or of the LRU list */
+#define NIL SIZE_MAX
+
+/* One cached block */
+struct cache_entry {
+	/* Disk block held by this entry */
+	size_t block;
+	/* Next entry in the same hash bucket */
+	size_t hash_next;
+	/* Neighbours in the LRU list, most recently used first */
+	size_t lru_prev;
+	size_t lru_next;
+	/* Whether the entry holds a block at all */
+	bool valid;
+	/* Whether the block was modified since it was read from the disk */
+	bool dirty;
+	/*
+	 * Number of views of the block handed out by cache_pin(). A pinned
+	 * entry that is discarded leaves the hash and the LRU list, but only
+	 * goes back on the free list once the last view is released.
+	 */
+	size_t pins;
+};
+
+/*
+ * An independent part of the cache. Each block always goes to the same shard,
+ * so threads working on different blocks rarely wait on the same lock.
+ */
+struct cache_shard {
+	/* Guards everything below, and is held during write-backs */
+	pthread_mutex_t lock;
+
+	struct disk *disk;
+	size_t capacity;
+	struct cache_entry *entries;
+	/* Block data of entry i is at data + i * BLOCK_SIZE */
+	uint8_t *data;
+
+	/* Heads of the hash chains, num_buckets is a power of 2 */
+	size_t *buckets;
+	size_t num_buckets;
+
+	/* Entries in use, most recently used at the head */
+	size_t lru_head;
+	size_t lru_tail;
+	/* Entries not in use, chained through lru_next */
+	size_t free_head;
+
+	/*
+	 * Bumped whenever a block of the shard reaches the disk, by a
+	 * write-back or by a write that bypasses the cache, so that a block
+	 * read from the disk without the lock held can tell whether the disk
+	 * may have changed under it
+	 */
+	uint64_t generation;
+
+	struct cache_stats stats;
+};
+
+/* A dirty block waiting to be flushed */
+struct flush_item {
+	size_t block;
+	struct cache_shard *shard;
+};
+
+struct block_cache {
+	struct disk *disk;
+	size_t capacity;
+	struct cache_shard *shards;
+	size_t num_shards;
+
+	/* Guards @dirty, which has room for every block of the cache */
+	pthread_mutex_t flush_lock;
+	struct flush_item *dirty;
+};
+
+static struct cache_shard *shard_of(const struct block_cache *cache,
+				    size_t block)
+{
+	/* Consecutive blocks of a run land in different shards */
+	return &cache->shards[block % cache->num_shards];
+}
+
+static size_t bucket_of(const struct cache_shard *cache, size_t block)
+{
+	/* Fibonacci hashing spreads consecutive blocks over the table */
+	return (block * 11400714819323198485ull) >> 32 & (cache->num_buckets - 1);
+}
+
+static uint8_t *entry_data(const struct cache_shard *cache, size_t e)
+{
+	return cache->data + e * BLOCK_SIZE;
+}
+
+static void lru_unlink(struct cache_shard *cache, size_t e)
+{
+	struct cache_entry *entry = &cache->entries[e];
+
+	if (entry->lru_prev != NIL)
+		cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+	else
+		cache->lru_head = entry->lru_next;
+
+	if (entry->lru_next != NIL)
+		cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+	else
+		cache->lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(struct cache_shard *cache, size_t e)
+{
+	struct cache_entry *entry = &cache->entries[e];
+
+	entry->lru_prev = NIL;
+	entry->lru_next = cache->lru_head;
+	if (cache->lru_head != NIL)
+		cache->entries[cache->lru_head].lru_prev = e;
+	else
+		cache->lru_tail = e;
+	cache->lru_head = e;
+}
+
+static void hash_remove(struct cache_shard *cache, size_t e)
+{
+	size_t *link = &cache->buckets[bucket_of(cache, cache->entries[e].block)];
+
+	while (*link != e)
+		link = &cache->entries[*link].hash_next;
+	*link = cache->entries[e].hash_next;
+}
+
+static size_t lookup(const struct cache_shard *cache, size_t block)
+{
+	size_t e = cache->buckets[bucket_of(cache, block)];
+
+	while (e != NIL && cache->entries[e].block != block)
+		e = cache->entries[e].hash_next;
+
+	return e;
+}
+
+/* Write the dirty block of entry @e back to the disk */
+static int write_back(struct cache_shard *cache, size_t e)
+{
+	if (disk_write(cache->disk, cache->entries[e].block,
+		       entry_data(cache, e)))
+		return -1;
+
+	cache->entries[e].dirty = false;
+	cache->stats.writebacks++;
+	cache->generation++;
+	return 0;
+}
+
+/*
+ * Take an entry for a new block, evicting the least recently used block if
+ * the cache is full. The entry is returned unlinked from every list.
+ */
+static size_t take_entry(struct cache_shard *cache)
+{
+	struct cache_entry *entry;
+	size_t e;
+
+	if (cache->free_head != NIL) {
+		e = cache->free_head;
+		cache->free_head = cache->entries[e].lru_next;
+		return e;
+	}
+
+	/* Pinned blocks are being looked at in place, so they must stay */
+	e = cache->lru_tail;
+	while (e != NIL && cache->entries[e].pins > 0)
+		e = cache->entries[e].lru_prev;
+	if (e == NIL)
+		return NIL;
+
+	entry = &cache->entries[e];
+
+	if (entry->dirty && write_back(cache, e))
+		return NIL;
+
+	lru_unlink(cache, e);
+	hash_remove(cache, e);
+	entry->valid = false;
+	entry->dirty = false;
+	cache->stats.evictions++;
+
+	return e;
+}
+
+/* Make entry @e, taken with take_entry(), hold @block as a clean block */
+static void insert_entry(struct cache_shard *cache, size_t e, size_t block)
+{
+	size_t b = bucket_of(cache, block);
+
+	cache->entries[e].block = block;
+	cache->entries[e].valid = true;
+	cache->entries[e].dirty = false;
+
+	cache->entries[e].hash_next = cache->buckets[b];
+	cache->buckets[b] = e;
+	lru_push_front(cache, e);
+}
+
+/*
+ * Find the entry holding @block, or give it one. If @fill is set, a new entry
+ * is filled with the block's content from the disk.
+ */
+static size_t get_entry(struct cache_shard *cache, size_t block, bool fill)
+{
+	size_t e = lookup(cache, block);
+
+	if (e != NIL) {
+		cache->stats.hits++;
+		lru_unlink(cache, e);
+		lru_push_front(cache, e);
+		return e;
+	}
+
+	cache->stats.misses++;
+
+	e = take_entry(cache);
+	if (e == NIL)
+		return NIL;
+
+	if (fill && disk_read(cache->disk, block, entry_data(cache, e))) {
+		/* Give the entry back */
+		cache->entries[e].lru_next = cache->free_head;
+		cache->free_head = e;
+		return NIL;
+	}
+
+	insert_entry(cache, e, block);
+	return e;
+}
+
+static int shard_init(struct cache_shard *cache, struct disk *disk,
+		      size_t capacity)
+{
+	size_t i;
+
+	if (pthread_mutex_init(&cache->lock, NULL))
+		return -1;
+
+	cache->disk = disk;
+	cache->capacity = capacity;
+	cache->lru_head = NIL;
+	cache->lru_tail = NIL;
+	cache->free_head = NIL;
+
+	if (capacity == 0)
+		return 0;
+
+	cache->num_buckets = 1;
+	while (cache->num_buckets < capacity)
+		cache->num_buckets *= 2;
+
+	cache->entries = calloc(capacity, sizeof(struct cache_entry));
+	cache->data = malloc(capacity * BLOCK_SIZE);
+	cache->buckets = malloc(cache->num_buckets * sizeof(size_t));
+	if (!cache->entries || !cache->data || !cache->buckets) {
+		free(cache->entries);
+		free(cache->data);
+		free(cache->buckets);
+		pthread_mutex_destroy(&cache->lock);
+		return -1;
+	}
+
+	for (i = 0; i < cache->num_buckets; i++)
+		cache->buckets[i] = NIL;
+
+	/* Every entry starts out on the free list */
+	for (i = 0; i < capacity; i++)
+		cache->entries[i].lru_next = i + 1 < capacity ? i + 1 : NIL;
+	cache->free_head = 0;
+
+	return 0;
+}
+
+struct block_cache *cache_create(struct disk *disk, size_t capacity)
+{
+	struct block_cache *cache;
+	size_t i, shard_capacity;
+
+	cache = calloc(1, sizeof(struct block_cache));
+	if (!cache)
+		return NULL;
+
+	cache->disk = disk;
+	cache->capacity = capacity;
+
+	/* Every shard holds at least one block, unless nothing is cached */
+	cache->num_shards = CACHE_SHARDS;
+	if (capacity > 0 && capacity < CACHE_SHARDS)
+		cache->num_shards = capacity;
+
+	cache->shards = calloc(cache->num_shards, sizeof(struct cache_shard));
+	if (!cache->shards) {
+		free(cache);
+		return NULL;
+	}
+
+	/* Flushing sorts the dirty blocks here rather than on the heap */
+	cache->dirty = malloc((capacity ? capacity : 1) *
+			      sizeof(struct flush_item));
+	if (!cache->dirty || pthread_mutex_init(&cache->flush_lock, NULL)) {
+		free(cache->dirty);
+		free(cache->shards);
+		free(cache);
+		return NULL;
+	}
+
+	for (i = 0; i < cache->num_shards; i++) {
+		shard_capacity = capacity / cache->num_shards +
+				 (i < capacity % cache->num_shards);
+		if (shard_init(&cache->shards[i], disk, shard_capacity)) {
+			/* Only the shards before this one need releasing */
+			cache->num_shards = i;
+			cache_destroy(cache);
+			return NULL;
+		}
+	}
+
+	return cache;
+}
+
+void cache_destroy(struct block_cache *cache)
+{
+	struct cache_shard *shard;
+	size_t i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < cache->num_shards; i++) {
+		shard = &cache->shards[i];
+		free(shard->entries);
+		free(shard->data);
+		free(shard->buckets);
+		pthread_mutex_destroy(&shard->lock);
+	}
+
+	pthread_mutex_destroy(&cache->flush_lock);
+	free(cache->dirty);
+	free(cache->shards);
+	free(cache);
+}
+
+static int shard_read(struct cache_shard *cache, size_t block, size_t offset,
+		      size_t len, void *buf)
+{
+	uint8_t bounce_buffer[BLOCK_SIZE];
+	uint8_t *mapped;
+	size_t e;
+
+	if (cache->capacity == 0) {
+		cache->stats.misses++;
+
+		/* A mapped disk is read in place, without a bounce buffer */
+		mapped = disk_block_ptr(cache->disk, block);
+		if (mapped) {
+			memcpy(buf, mapped + offset, len);
+			return 0;
+		}
+
+		if (offset == 0 && len == BLOCK_SIZE)
+			return disk_read(cache->disk, block, buf);
+		if (disk_read(cache->disk, block, bounce_buffer))
+			return -1;
+		memcpy(buf, bounce_buffer + offset, len);
+		return 0;
+	}
+
+	e = get_entry(cache, block, true);
+	if (e == NIL)
+		return -1;
+
+	memcpy(buf, entry_data(cache, e) + offset, len);
+	return 0;
+}
+
+static int shard_write(struct cache_shard *cache, size_t block, size_t offset,
+		       size_t len, const void *buf)
+{
+	uint8_t bounce_buffer[BLOCK_SIZE];
+	bool whole_block = offset == 0 && len == BLOCK_SIZE;
+	uint64_t misses;
+	uint8_t *mapped;
+	size_t e;
+
+	if (cache->capacity == 0) {
+		cache->stats.misses++;
+
+		/* Nor does a partial write need a read-modify-write */
+		mapped = disk_block_ptr(cache->disk, block);
+		if (mapped) {
+			memcpy(mapped + offset, buf, len);
+			return 0;
+		}
+
+		if (whole_block)
+			return disk_write(cache->disk, block, buf);
+		STATS_ADD(rmw_cycles, 1);
+		if (disk_read(cache->disk, block, bounce_buffer))
+			return -1;
+		memcpy(bounce_buffer + offset, buf, len);
+		return disk_write(cache->disk, block, bounce_buffer);
+	}
+
+	/* Overwriting the whole block makes its old content irrelevant */
+	misses = cache->stats.misses;
+	e = get_entry(cache, block, !whole_block);
+	if (e == NIL)
+		return -1;
+	if (!whole_block && cache->stats.misses != misses)
+		STATS_ADD(rmw_cycles, 1);
+
+	memcpy(entry_data(cache, e) + offset, buf, len);
+	cache->entries[e].dirty = true;
+	return 0;
+}
+
+int cache_read(struct block_cache *cache, size_t block, size_t offset,
+	       size_t len, void *buf)
+{
+	struct cache_shard *shard = shard_of(cache, block);
+	int ret;
+
+	if (offset > BLOCK_SIZE || len > BLOCK_SIZE - offset)
+		return -1;
+
+	pthread_mutex_lock(&shard->lock);
+	ret = shard_read(shard, block, offset, len, buf);
+	pthread_mutex_unlock(&shard->lock);
+
+	return ret;
+}
+
+int cache_write(struct block_cache *cache, size_t block, size_t offset,
+		size_t len, const void *buf)
+{
+	struct cache_shard *shard = shard_of(cache, block);
+	int ret;
+
+	if (offset > BLOCK_SIZE || len > BLOCK_SIZE - offset)
+		return -1;
+
+	pthread_mutex_lock(&shard->lock);
+	ret = shard_write(shard, block, offset, len, buf);
+	pthread_mutex_unlock(&shard->lock);
+
+	return ret;
+}
+
+/* Return whether @block is cached */
+static bool cached(struct block_cache *cache, size_t block)
+{
+	struct cache_shard *shard = shard_of(cache, block);
+	size_t e;
+
+	pthread_mutex_lock(&shard->lock);
+	e = lookup(shard, block);
+	pthread_mutex_unlock(&shard->lock);
+
+	return e != NIL;
+}
+
+/*
+ * Copy @block out of the cache into @buf if it is cached. Return whether it
+ * was.
+ */
+static bool copy_if_cached(struct block_cache *cache, size_t block, void *buf)
+{
+	struct cache_shard *shard = shard_of(cache, block);
+	size_t e;
+
+	if (cache->capacity == 0)
+		return false;
+
+	pthread_mutex_lock(&shard->lock);
+	e = lookup(shard, block);
+	if (e != NIL) {
+		memcpy(buf, entry_data(shard, e), BLOCK_SIZE);
+		shard->stats.hits++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return e != NIL;
+}
+
+/*
+ * Replace the cached copy of @block, if any, with @buf and mark it clean.
+ * Called around a write of @block that bypasses the cache, which also counts
+ * as the disk changing for cache_prefetch().
+ */
+static void update_if_cached(struct block_cache *cache, size_t block,
+			     const void *buf)
+{
+	struct cache_shard *shard = shard_of(cache, block);
+	size_t e;
+
+	if (cache->capacity == 0)
+		return;
+
+	pthread_mutex_lock(&shard->lock);
+	e = lookup(shard, block);
+	if (e != NIL) {
+		memcpy(entry_data(shard, e), buf, BLOCK_SIZE);
+		shard->entries[e].dirty = false;
+	}
+	shard->generation++;
+	pthread_mutex_unlock(&shard->lock);
+}
+
+int cache_read_blocks(struct block_cache *cache, size_t block, size_t count,
+		      void *buf)
+{
+	uint8_t *dest = buf;
+	struct iovec iov;
+	size_t i, run_start;
+
+	if (cache->capacity > 0 && count < CACHE_BYPASS_BLOCKS) {
+		for (i = 0; i < count; i++)
+			if (cache_read(cache, block + i, 0, BLOCK_SIZE,
+				       dest + i * BLOCK_SIZE))
+				return -1;
+		return 0;
+	}
+
+	/*
+	 * Read every stretch of uncached blocks with one call, and copy the
+	 * cached blocks in between from the cache
+	 */
+	run_start = 0;
+	for (i = 0; i <= count; i++) {
+		if (i < count &&
+		    !copy_if_cached(cache, block + i, dest + i * BLOCK_SIZE))
+			continue;
+
+		if (i > run_start) {
+			iov.iov_base = dest + run_start * BLOCK_SIZE;
+			iov.iov_len = (i - run_start) * BLOCK_SIZE;
+			if (disk_readv(cache->disk, block + run_start, &iov, 1))
+				return -1;
+		}
+
+		run_start = i + 1;
+	}
+
+	return 0;
+}
+
+int cache_write_blocks(struct block_cache *cache, size_t block, size_t count,
+		       const void *buf)
+{
+	const uint8_t *src = buf;
+	struct iovec iov;
+	size_t i;
+
+	if (cache->capacity > 0 && count < CACHE_BYPASS_BLOCKS) {
+		for (i = 0; i < count; i++)
+			if (cache_write(cache, block + i, 0, BLOCK_SIZE,
+					src + i * BLOCK_SIZE))
+				return -1;
+		return 0;
+	}
+
+	/*
+	 * The disk is about to hold the newest data, so cached copies become
+	 * clean. This is done before the write: a stale dirty copy evicted by
+	 * another thread in the meantime would otherwise overwrite it.
+	 */
+	for (i = 0; i < count; i++)
+		update_if_cached(cache, block + i, src + i * BLOCK_SIZE);
+
+	iov.iov_base = (void *)src;
+	iov.iov_len = count * BLOCK_SIZE;
+	if (disk_writev(cache->disk, block, &iov, 1))
+		return -1;
+
+	/*
+	 * A prefetch may have read the old blocks while the write was in
+	 * flight, and cached them since; this replaces them, and the new
+	 * generation stops a prefetch still reading from caching them later
+	 */
+	for (i = 0; i < count; i++)
+		update_if_cached(cache, block + i, src + i * BLOCK_SIZE);
+
+	return 0;
+}
+
+/*
+ * Read the @count blocks from @block, none of which was cached when looked
+ * at, into @buf, and add them to the cache as clean blocks. The disk is read
+ * without any lock held, so a block is only added if no block of its shard
+ * reached the disk in the meantime, and if it was not cached meanwhile.
+ */
+static int prefetch_run(struct block_cache *cache, size_t block, size_t count,
+			uint8_t *buf)
+{
+	uint64_t generation[CACHE_SHARDS];
+	struct cache_shard *shard;
+	struct iovec iov;
+	size_t i, s, e;
+
+	for (s = 0; s < cache->num_shards; s++) {
+		shard = &cache->shards[s];
+		pthread_mutex_lock(&shard->lock);
+		generation[s] = shard->generation;
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	iov.iov_base = buf;
+	iov.iov_len = count * BLOCK_SIZE;
+	if (disk_readv(cache->disk, block, &iov, 1))
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		s = (block + i) % cache->num_shards;
+		shard = &cache->shards[s];
+		pthread_mutex_lock(&shard->lock);
+
+		if (shard->generation == generation[s] &&
+		    lookup(shard, block + i) == NIL) {
+			e = take_entry(shard);
+			if (e != NIL) {
+				memcpy(entry_data(shard, e), buf + i * BLOCK_SIZE,
+				       BLOCK_SIZE);
+				insert_entry(shard, e, block + i);
+				shard->stats.prefetches++;
+			}
+			/* Writing back the block evicted does not touch ours */
+			generation[s] = shard->generation;
+		}
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	return 0;
+}
+
+int cache_prefetch(struct block_cache *cache, size_t block, size_t count)
+{
+	size_t i, run_start;
+	uint8_t *buf;
+	int ret = 0;
+
+	if (cache->capacity == 0 || count == 0)
+		return 0;
+
+	/* Skip the blocks at either end that are cached already */
+	while (count > 0 && cached(cache, block)) {
+		block++;
+		count--;
+	}
+	while (count > 0 && cached(cache, block + count - 1))
+		count--;
+	if (count == 0)
+		return 0;
+
+	buf = malloc(count * BLOCK_SIZE);
+	if (!buf)
+		return -1;
+
+	/* Read each stretch of uncached blocks with one call, skipping the rest */
+	run_start = 0;
+	for (i = 0; i <= count && ret == 0; i++) {
+		if (i < count && !cached(cache, block + i))
+			continue;
+
+		if (i > run_start &&
+		    prefetch_run(cache, block + run_start, i - run_start,
+				 buf + run_start * BLOCK_SIZE))
+			ret = -1;
+
+		run_start = i + 1;
+	}
+
+	free(buf);
+	return ret;
+}
+
+int cache_pin(struct block_cache *cache, size_t block, const void **data)
+{
+	struct cache_shard *shard = shard_of(cache, block);
+	size_t e;
+
+	if (cache->capacity == 0) {
+		*data = disk_block_ptr(cache->disk, block);
+		return *data ? 0 : -1;
+	}
+
+	pthread_mutex_lock(&shard->lock);
+	e = get_entry(shard, block, true);
+	if (e != NIL) {
+		shard->entries[e].pins++;
+		*data = entry_data(shard, e);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return e == NIL ? -1 : 0;
+}
+
+void cache_unpin(struct block_cache *cache, const void *data)
+{
+	const uint8_t *ptr = data;
+	struct cache_shard *shard;
+	size_t i, e;
+
+	if (cache->capacity == 0)
+		return;
+
+	/* Find the slab the pointer is in; mapped blocks are in none */
+	for (i = 0; i < cache->num_shards; i++) {
+		shard = &cache->shards[i];
+		if (ptr < shard->data ||
+		    ptr >= shard->data + shard->capacity * BLOCK_SIZE)
+			continue;
+
+		e = (ptr - shard->data) / BLOCK_SIZE;
+		pthread_mutex_lock(&shard->lock);
+		if (shard->entries[e].pins > 0 && --shard->entries[e].pins == 0 &&
+		    !shard->entries[e].valid) {
+			/* The block was discarded while pinned */
+			shard->entries[e].lru_next = shard->free_head;
+			shard->free_head = e;
+		}
+		pthread_mutex_unlock(&shard->lock);
+		return;
+	}
+}
+
+static int compare_block(const void *a, const void *b)
+{
+	size_t block_a = ((const struct flush_item *)a)->block;
+	size_t block_b = ((const struct flush_item *)b)->block;
+
+	return (block_a > block_b) - (block_a < block_b);
+}
+
+int cache_flush(struct block_cache *cache)
+{
+	struct cache_shard *shard;
+	struct cache_entry *entry;
+	struct flush_item *dirty;
+	size_t num_dirty = 0;
+	int ret = 0;
+	size_t e, i;
+
+	if (cache->capacity == 0)
+		return 0;
+
+	pthread_mutex_lock(&cache->flush_lock);
+	dirty = cache->dirty;
+
+	for (i = 0; i < cache->num_shards; i++) {
+		shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		for (e = 0; e < shard->capacity; e++) {
+			entry = &shard->entries[e];
+			if (entry->valid && entry->dirty) {
+				dirty[num_dirty].block = entry->block;
+				dirty[num_dirty].shard = shard;
+				num_dirty++;
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	/* Write back in disk order so the writes are as sequential as possible */
+	qsort(dirty, num_dirty, sizeof(struct flush_item), compare_block);
+
+	for (i = 0; i < num_dirty; i++) {
+		shard = dirty[i].shard;
+		pthread_mutex_lock(&shard->lock);
+
+		/* The block may have been written back or evicted since */
+		e = lookup(shard, dirty[i].block);
+		if (e != NIL && shard->entries[e].dirty && write_back(shard, e))
+			ret = -1;
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	pthread_mutex_unlock(&cache->flush_lock);
+	return ret;
+}
+
+int cache_flush_blocks(struct block_cache *cache, size_t block, size_t count)
+{
+	struct cache_shard *shard;
+	int ret = 0;
+	size_t e, i;
+
+	if (cache->capacity == 0)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		shard = shard_of(cache, block + i);
+		pthread_mutex_lock(&shard->lock);
+
+		e = lookup(shard, block + i);
+		if (e != NIL && shard->entries[e].dirty && write_back(shard, e))
+			ret = -1;
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	return ret;
+}
+
+void cache_discard(struct block_cache *cache, size_t block, size_t count)
+{
+	struct cache_shard *shard;
+	size_t e, i;
+
+	if (cache->capacity == 0)
+		return;
+
+	for (i = 0; i < count; i++) {
+		shard = shard_of(cache, block + i);
+		pthread_mutex_lock(&shard->lock);
+
+		e = lookup(shard, block + i);
+		if (e != NIL) {
+			/*
+			 * The block may be handed to another file next, so it
+			 * must not be found again even while views still hold
+			 * the old copy; cache_unpin() frees the entry later
+			 */
+			lru_unlink(shard, e);
+			hash_remove(shard, e);
+			shard->entries[e].valid = false;
+			shard->entries[e].dirty = false;
+			if (shard->entries[e].pins == 0) {
+				shard->entries[e].lru_next = shard->free_head;
+				shard->free_head = e;
+			}
+		}
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+void cache_get_stats(struct block_cache *cache, struct cache_stats *stats)
+{
+	struct cache_shard *shard;
+	size_t i;
+
+	memset(stats, 0, sizeof(struct cache_stats));
+	for (i = 0; i < cache->num_shards; i++) {
+		shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		stats->hits += shard->stats.hits;
+		stats->misses += shard->stats.misses;
+		stats->evictions += shard->stats.evictions;
+		stats->writebacks += shard->stats.writebacks;
+		stats->prefetches += shard->stats.prefetches;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
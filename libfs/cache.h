@@ -0,0 +1,223 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h> /* for size_t definition */
+#include <stdint.h>
+
+#include "disk.h"
+
+/** Number of blocks cached when no size was configured (4 MiB) */
+#define CACHE_DEFAULT_BLOCKS 1024
+
+/** Runs of at least this many whole blocks go straight to the disk */
+#define CACHE_BYPASS_BLOCKS 4
+
+/** Number of independently locked parts the cache is split into */
+#define CACHE_SHARDS 16
+
+/**
+ * Write-back LRU cache of disk blocks
+ *
+ * Sits between the file system and one disk handle. Blocks that are written
+ * are only marked dirty, and reach the disk when they are evicted or when the
+ * cache is flushed.
+ *
+ * Every function may be called from several threads at once. The blocks are
+ * spread over %CACHE_SHARDS shards, each with its own lock and its own LRU
+ * list, so threads rarely wait on each other. Callers must still make sure
+ * that two threads do not write the same block at the same time, or read a
+ * block while another thread writes it.
+ */
+struct block_cache;
+
+/** Counters kept by a block cache */
+struct cache_stats {
+	/* Accesses served from the cache */
+	uint64_t hits;
+	/* Accesses that had to go to the disk */
+	uint64_t misses;
+	/* Blocks dropped to make room for others */
+	uint64_t evictions;
+	/* Dirty blocks written back to the disk */
+	uint64_t writebacks;
+	/* Blocks read ahead of demand by cache_prefetch() */
+	uint64_t prefetches;
+};
+
+/**
+ * cache_create - Create a block cache
+ * @disk: Disk whose blocks are cached
+ * @capacity: Maximum number of blocks held at once
+ *
+ * A @capacity of 0 creates a cache that holds nothing and passes every access
+ * straight through to the disk. On a disk opened with %DISK_BACKEND_MMAP, such
+ * accesses copy straight between the caller's buffer and the mapping. The
+ * capacity is split evenly between the shards, so eviction is least recently
+ * used within a shard.
+ *
+ * Return: NULL if memory could not be allocated, the new cache otherwise.
+ */
+struct block_cache *cache_create(struct disk *disk, size_t capacity);
+
+/**
+ * cache_destroy - Release a block cache
+ * @cache: Cache to destroy
+ *
+ * Dirty blocks are NOT written back; call cache_flush() first.
+ */
+void cache_destroy(struct block_cache *cache);
+
+/**
+ * cache_read - Read part of a block through the cache
+ * @cache: Cache
+ * @block: Index of the block to read from
+ * @offset: Offset of the first byte to read within the block
+ * @len: Number of bytes to read
+ * @buf: Buffer to be filled with @len bytes
+ *
+ * Return: -1 if @offset and @len do not fit in a block, or if the block could
+ * not be read from the disk. 0 otherwise.
+ */
+int cache_read(struct block_cache *cache, size_t block, size_t offset,
+	       size_t len, void *buf);
+
+/**
+ * cache_write - Write part of a block through the cache
+ * @cache: Cache
+ * @block: Index of the block to write to
+ * @offset: Offset of the first byte to write within the block
+ * @len: Number of bytes to write
+ * @buf: Buffer holding @len bytes
+ *
+ * The block is marked dirty instead of being written to disk. A partial write
+ * of a block that is not cached reads the rest of the block first; a write of
+ * the whole block does not.
+ *
+ * Return: -1 if @offset and @len do not fit in a block, or if a block could
+ * not be read or written back. 0 otherwise.
+ */
+int cache_write(struct block_cache *cache, size_t block, size_t offset,
+		size_t len, const void *buf);
+
+/**
+ * cache_read_blocks - Read a run of consecutive whole blocks
+ * @cache: Cache
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Buffer to be filled with @count * %BLOCK_SIZE bytes
+ *
+ * Runs shorter than %CACHE_BYPASS_BLOCKS are read through the cache. Longer
+ * runs are read from the disk with as few disk_readv() calls as the cached
+ * blocks allow, without filling the cache; blocks that are cached are still
+ * taken from the cache, since they may be newer than the disk.
+ *
+ * Return: -1 if a block could not be read. 0 otherwise.
+ */
+int cache_read_blocks(struct block_cache *cache, size_t block, size_t count,
+		      void *buf);
+
+/**
+ * cache_write_blocks - Write a run of consecutive whole blocks
+ * @cache: Cache
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Buffer holding @count * %BLOCK_SIZE bytes
+ *
+ * Runs shorter than %CACHE_BYPASS_BLOCKS are written through the cache. Longer
+ * runs are written to the disk with a single disk_writev() call, after the
+ * copies of those blocks that are cached are updated and marked clean.
+ *
+ * Return: -1 if a block could not be written. 0 otherwise.
+ */
+int cache_write_blocks(struct block_cache *cache, size_t block, size_t count,
+		       const void *buf);
+
+/**
+ * cache_prefetch - Bring a run of consecutive blocks into the cache
+ * @cache: Cache
+ * @block: Index of the first block
+ * @count: Number of blocks
+ *
+ * Each stretch of blocks that are not cached is read with a single
+ * disk_readv() call, and the blocks that are still not cached afterwards are
+ * added to the cache as clean blocks. A block is left out if another block of
+ * its shard was written back, or written past the cache, during the read, as
+ * the disk copy read may then be stale. Nothing happens on a pass-through
+ * cache.
+ *
+ * Return: -1 if memory could not be allocated or if the blocks could not be
+ * read. 0 otherwise.
+ */
+int cache_prefetch(struct block_cache *cache, size_t block, size_t count);
+
+/**
+ * cache_pin - Get direct access to a block and keep it in the cache
+ * @cache: Cache
+ * @block: Index of the block
+ * @data: Set to the %BLOCK_SIZE bytes of @block
+ *
+ * The block is read into the cache if needed, and is never evicted until
+ * cache_unpin() is called on it as many times as it was pinned. Writes to the
+ * block through the cache show through @data.
+ *
+ * On a pass-through cache of a disk opened with %DISK_BACKEND_MMAP, @data
+ * points into the mapping instead, and there is nothing to unpin.
+ *
+ * Return: -1 if the block could not be read, if every block of its shard is
+ * already pinned, or if the cache is a pass-through cache of a disk that is not
+ * mapped. 0 otherwise.
+ */
+int cache_pin(struct block_cache *cache, size_t block, const void **data);
+
+/**
+ * cache_unpin - Release a block pinned by cache_pin()
+ * @cache: Cache
+ * @data: Any pointer into the block's data, as given by cache_pin()
+ *
+ * Pointers into a disk mapping are ignored.
+ */
+void cache_unpin(struct block_cache *cache, const void *data);
+
+/**
+ * cache_flush - Write every dirty block back to the disk
+ * @cache: Cache
+ *
+ * Return: -1 if a block could not be written. 0 otherwise.
+ */
+int cache_flush(struct block_cache *cache);
+
+/**
+ * cache_flush_blocks - Write dirty blocks of a range back to the disk
+ * @cache: Cache
+ * @block: Index of the first block of the range
+ * @count: Number of blocks in the range
+ *
+ * Unlike cache_flush(), only the blocks of the range are looked at, so the
+ * cost depends on @count rather than on the size of the cache.
+ *
+ * Return: -1 if a block could not be written. 0 otherwise.
+ */
+int cache_flush_blocks(struct block_cache *cache, size_t block, size_t count);
+
+/**
+ * cache_discard - Drop the cached copies of a range of blocks
+ * @cache: Cache
+ * @block: Index of the first block of the range
+ * @count: Number of blocks in the range
+ *
+ * Changes to the blocks that were not written back are lost. Used when blocks
+ * stop holding file data, so that a stale copy is never written over what
+ * the blocks hold next, nor read in place of it. A pinned block is dropped
+ * all the same: its views keep the copy they had, which no longer changes,
+ * and its entry is only reused once the last of them is unpinned.
+ */
+void cache_discard(struct block_cache *cache, size_t block, size_t count);
+
+/**
+ * cache_get_stats - Get the counters of a cache
+ * @cache: Cache
+ * @stats: Filled with the current counters
+ */
+void cache_get_stats(struct block_cache *cache, struct cache_stats *stats);
+
+#endif /* _CACHE_H */
@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -6,17 +8,42 @@
 #include <stdbool.h>
 #include <math.h>
 
+#include "aio.h"
+#include "bitmap.h"
+#include "cache.h"
 #include "disk.h"
 #include "fs.h"
+#include "journal.h"
+#include "stats.h"
+#include "trace.h"
 
 #define SUPERBLOCK_SIG_LEN 8
-#define SUPERBLOCK_PAD_LEN 4079
+#define SUPERBLOCK_PAD_LEN 4071
 
 #define ROOT_PAD_LEN 10
 #define ROOT_ENTRY_LEN 32
 
 #define FAT_EOC 0xFFFF
 
+// number of FAT entries in a FAT block
+#define FAT_ENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(uint16_t))
+
+// clean FAT blocks are dropped once more than this many are in memory
+#define FAT_RESIDENT_BLOCKS 8
+
+// the root entries and descriptors are aligned to cache lines, so threads working on different files never share one
+#define CACHE_LINE_SIZE 64
+
+// a file descriptor is the slot it uses in the descriptor table, in the low FD_SLOT_BITS bits
+// and the generation of the slot, which counts how often it was closed, in the bits above
+// so a descriptor that was closed stops working, even once its slot is handed out again
+#define FD_SLOT_BITS 16
+#define FD_SLOT_MASK ((1 << FD_SLOT_BITS) - 1)
+#define FD_GENERATION_MASK 0x7FFF
+
+// the readahead window of a descriptor starts at this many blocks, and doubles on every sequential read that needs more
+#define READAHEAD_MIN_BLOCKS 4
+
 struct SuperBlock{
 	uint8_t signature[SUPERBLOCK_SIG_LEN];
 	uint16_t num_blocks;
@@ -24,29 +51,164 @@ struct SuperBlock{
 	uint16_t data_start_index;
 	uint16_t num_data_blocks;
 	uint8_t num_fat_blocks;
+	// these two are carved out of the padding, so older images (where they are 0) still mount
+	// the first block of the root directory is always root_index, and the rest are a FAT chain in the data area
+	// FAT index of the second directory block, 0 if the directory is a single block
+	uint16_t dir_first_index;
+	// total number of directory blocks, 0 in older images, which means 1
+	uint16_t dir_num_blocks;
+	// the journal is a run of contiguous data blocks, chained in the FAT like a file so nothing else allocates them
+	// FAT index of its first block, and its number of blocks, both 0 if the disk has no journal
+	uint16_t journal_first_index;
+	uint16_t journal_num_blocks;
 	uint8_t padding[SUPERBLOCK_PAD_LEN];
 };
 
+// in-memory map of a file's FAT chain, so that the nth block of a file can be
+// found without walking the chain from first_index every time
+// blocks[n] is the FAT index of the nth data block of the file
+struct BlockMap{
+	uint16_t* blocks;
+	uint16_t num_blocks;
+	uint16_t capacity;
+	bool is_built;
+};
+
 struct File{
 	uint8_t filename[FS_FILENAME_LEN];
 	uint32_t file_size;
 	uint16_t first_index;
 	uint8_t padding[ROOT_PAD_LEN];
-};
+
+	// not stored on disk
+	// shared by every descriptor of the file, so they all see the same chain
+	struct BlockMap map;
+
+	// index of the file's entry in the root directory, so a change to the entry can mark its directory block dirty
+	size_t entry;
+
+	// number of descriptors of the file, so fs_delete() can tell if it is open without looking through them
+	uint32_t num_open;
+
+	// guards file_size, first_index and map
+	// readers of the file share it, a writer holds it alone
+	pthread_rwlock_t lock;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 struct FileDescriptor{
+	// NULL while the slot is free
 	struct File* file;
-	uint16_t offset;
-};
+	// bumped every time the slot is closed, and part of every descriptor handed out for it
+	uint16_t generation;
+	// next free slot, -1 for the last one, while the slot is free
+	int next_free;
+	// as wide as file_size, so files past 64 KiB can be walked all the way through
+	uint32_t offset;
+
+	// readahead state
+	// a read is sequential if it starts where the previous one ended
+	uint32_t ra_next_offset;
+	// number of blocks read ahead last time, 0 after a random read
+	uint16_t ra_window;
+	// first block of the file that has not been read ahead yet
+	int ra_end;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 /* TODO: Phase 1 */
 
-struct SuperBlock* sb;
-uint16_t* fat;
-struct File* root[FS_FILE_MAX_COUNT];
-struct FileDescriptor* open_files[FS_OPEN_MAX_COUNT];
-uint8_t num_open_files = 0;
-bool is_disk_mounted = false;
+// everything about one mounted disk
+// every function works on one of these, so several disks can be mounted at once
+//
+// locks are always taken in this order, and each one is optional:
+//   table_lock -> File lock -> alloc_lock -> (the cache's own locks)
+// so two threads can never wait on each other in a circle
+struct fs_ctx{
+	struct disk* disk;
+	struct SuperBlock sb;
+	// the FAT is paged in a block at a time, the first time one of its entries is used, so mounting reads none of it
+	// fat_pages[i] is FAT block i, or NULL while it is not in memory
+	// fat_last_use[i] is the value of fat_clock when it was last used, so the least recently used one is dropped first
+	uint16_t** fat_pages;
+	uint64_t* fat_last_use;
+	uint64_t fat_clock;
+	size_t num_fat_pages;
+	// tracks which FAT entries are free, so allocation does not have to scan the FAT
+	// only the entries of the FAT blocks before fat_scanned are known, as allocation scans the FAT blocks in order
+	// when it runs out, so it still hands out the lowest free block
+	struct bitmap free_blocks;
+	size_t fat_scanned;
+	// data blocks are read and written through this cache, which is flushed on fs_sync() and fs_umount()
+	struct block_cache* cache;
+	// performs the block operations of fs_read_async() and fs_write_async()
+	struct aio_engine* aio;
+	// largest readahead window of a descriptor, in blocks, 0 if readahead is off
+	size_t readahead_max;
+	// the root directory, FS_FILE_MAX_COUNT entries per directory block
+	// the entries of each directory block sit together in one array, file_blocks[b] for directory block b
+	// so mounting does one allocation per directory block, and creating a file none unless the directory grows
+	struct File** root;
+	struct File** file_blocks;
+	size_t num_root_entries;
+	// disk block of each directory block, in order
+	uint16_t* dir_blocks;
+	// tracks which root entries are empty, so fs_create() does not have to scan for one
+	struct bitmap free_entries;
+	// hash index of the names in root, so finding a file does not have to scan for it either
+	// name_buckets[h] is the first entry whose name hashes to h, name_next[i] is the entry after i, and -1 ends a chain
+	int* name_buckets;
+	int* name_next;
+	size_t num_name_buckets;
+	// the descriptor table, with room for fd_capacity descriptors, which doubles when it is full, up to fd_max
+	// the free slots are chained from fd_free_head, so opening and closing a file take the same time however many are open
+	struct FileDescriptor* fd_table;
+	size_t fd_capacity;
+	size_t fd_max;
+	int fd_free_head;
+	size_t num_open_files;
+
+	// guards the directory, the descriptor table and num_open_files
+	// read and write take it shared, so they only wait for open, close, create and delete
+	pthread_rwlock_t table_lock;
+	// guards the FAT pages and free_blocks, which every file allocates from, and the dirty flags below
+	pthread_mutex_t alloc_lock;
+
+	// which FAT blocks and directory blocks changed since they were last written, and whether the superblock did
+	// only those are written back, so a sync or unmount costs as much as what changed, not as much as the disk
+	// a dirty FAT block stays in memory until it is written back
+	bool* fat_dirty;
+	bool* dir_dirty;
+	bool sb_dirty;
+
+	// the write-ahead journal of FAT and root entry changes, NULL if the disk has none
+	// with a journal, fs_create(), fs_delete() and fs_fsync() only write a record to it, and the dirty blocks
+	// above are written home by a checkpoint, either in the background once the journal is half full or on fs_sync()
+	struct journal* journal;
+	// the background checkpoint thread sleeps on checkpoint_cond until it is requested or told to stop
+	pthread_t checkpoint_thread;
+	bool checkpoint_started;
+	pthread_mutex_t checkpoint_lock;
+	pthread_cond_t checkpoint_cond;
+	bool checkpoint_requested;
+	bool checkpoint_stopping;
+};
+
+// the disk mounted through the original fs_*() functions, NULL when none is
+fs_ctx* default_ctx = NULL;
+
+// size of the block cache given to every new mount
+size_t cache_size = CACHE_DEFAULT_BLOCKS;
+
+// how every new mount accesses its disk, FS_BACKEND_PREAD or FS_BACKEND_MMAP
+int disk_backend = FS_BACKEND_PREAD;
+
+// largest readahead window given to every new mount
+size_t readahead_blocks = FS_READAHEAD_DEFAULT;
+
+// size of the journal reserved on every new mount of a disk that has none, 0 to not reserve one
+size_t journal_blocks = 0;
+
+// largest number of descriptors every new mount can have open at once
+size_t open_max = FS_OPEN_MAX_COUNT;
 
 // debug tool
 // prints every byte in a block, defined as BLOCK_SIZE lengthed byte array
@@ -115,104 +277,122 @@ bool is_filename_invalid(const char* filename){
 	return filename == NULL || *filename == '\0' || strlen(filename)+1 > FS_FILENAME_LEN;
 }
 
-// helper function for fs_mount()
+// helper function for fs_mount_ctx()
 // attempt to open the disk
 // returns 0 on success and -1 on failure
-// flags is_disk_mounted, which is used in many functions as an error check
-int load_disk(const char* diskname){
-	if (is_disk_mounted){
-		// fprintf(stderr, "Error in fs_mount(): disk already mounted\n");
-		return -1;
-	}
-	int open_disk_success = block_disk_open(diskname);
-	// printf("disk success = %d\n", open_disk_success);
-	if (open_disk_success != 0){
-		// fprintf(stderr, "Error in fs_mount(): could not read superblock\n");
+int load_disk(fs_ctx* ctx, const char* diskname){
+	ctx->disk = disk_open_backend(diskname, disk_backend == FS_BACKEND_MMAP ? DISK_BACKEND_MMAP : DISK_BACKEND_PREAD);
+	// printf("disk success = %p\n", ctx->disk);
+	if (ctx->disk == NULL){
+		// fprintf(stderr, "Error in fs_mount(): could not open disk\n");
 		return -1;
 	}
 
-	is_disk_mounted = true;
 	return 0;
 }
 
 // helper function for fs_mount()
 // loads in the superblock info
-int load_superblock(uint8_t* superblock_ptr){
+int load_superblock(fs_ctx* ctx, uint8_t* superblock_ptr){
 	if (superblock_ptr == NULL){
 		// fprintf(stderr, "Error in fs_mount(): pointer to superblock is null\n");
 		return -1;
 	}
 
-	sb = malloc(sizeof(struct SuperBlock));
-	if (sb == NULL){
-		// fprintf(stderr, "Error in fs_mount(): unable to allocate super block\n");
-		return -1;
-	}
-
 	// printblock(superblock_ptr);
 
 	// load each byte of the signature in one at a time
 	for (unsigned i = 0; i < SUPERBLOCK_SIG_LEN; i++){
-		sb->signature[i] = *(superblock_ptr++);
+		ctx->sb.signature[i] = *(superblock_ptr++);
 	}
 
 	// this should concatenate the next two bytes of the buffer
 	// printf("%d %d\n", *superblock_ptr, *(superblock_ptr+1));
-	sb->num_blocks = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
+	ctx->sb.num_blocks = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
 	superblock_ptr += 2;
 
-	if (sb->num_blocks != block_disk_count()){
+	if (ctx->sb.num_blocks != disk_count(ctx->disk)){
 		// fprintf(stderr, "Error in fs_mount(): num_blocks read from superblock does not match number on disk\n");
 		return -1;
 	}
 
 	// printf("%d %d\n", *superblock_ptr, *(superblock_ptr+1));
-	sb->root_index = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
+	ctx->sb.root_index = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
 	superblock_ptr += 2;
 
-	if (sb->root_index <= 0){
+	if (ctx->sb.root_index <= 0){
 		// fprintf(stderr, "Error in fs_mount(): root index is where superblock should be\n");
 		return -1;
 	}
 
 	// printf("%d %d\n", *superblock_ptr, *(superblock_ptr+1));
-	sb->data_start_index = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
+	ctx->sb.data_start_index = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
 	superblock_ptr += 2;
 
-	if (sb->data_start_index == 0){
+	if (ctx->sb.data_start_index == 0){
 		// fprintf(stderr, "Error in fs_mount(): data start index is where superblock should be\n");
 		return -1;
 	}
 
-	if (sb->data_start_index == sb->root_index){
+	if (ctx->sb.data_start_index == ctx->sb.root_index){
 		// fprintf(stderr, "Error in fs_mount(): root and data start have the same index\n");
 		return -1;
 	}
 
 	// printf("%d %d\n", *superblock_ptr, *(superblock_ptr+1));
-	sb->num_data_blocks = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
+	ctx->sb.num_data_blocks = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
 	superblock_ptr += 2;
 
-	if (sb->num_data_blocks >= sb->num_blocks){
+	if (ctx->sb.num_data_blocks >= ctx->sb.num_blocks){
 		// fprintf(stderr, "Error in fs_mount(): more data blocks than total blocks\n");
 		return -1;
 	}
 
 	// printf("%d\n", *superblock_ptr);
-	sb->num_fat_blocks = *(superblock_ptr);
+	ctx->sb.num_fat_blocks = *(superblock_ptr);
 	superblock_ptr++;
 
-	if (sb->num_fat_blocks >= sb->num_blocks){
+	if (ctx->sb.num_fat_blocks >= ctx->sb.num_blocks){
 		// fprintf(stderr, "Error in fs_mount(): more FAT blocks than total blocks\n");
 		return -1;
 	}
 
+	ctx->sb.dir_first_index = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
+	superblock_ptr += 2;
+
+	ctx->sb.dir_num_blocks = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
+	superblock_ptr += 2;
+
+	// images from before the directory could grow leave both fields at 0
+	if (ctx->sb.dir_num_blocks == 0){
+		ctx->sb.dir_num_blocks = 1;
+	}
+
+	if ((ctx->sb.dir_num_blocks == 1) != (ctx->sb.dir_first_index == 0) || ctx->sb.dir_first_index >= ctx->sb.num_data_blocks){
+		// fprintf(stderr, "Error in fs_mount(): directory blocks do not match the first directory block\n");
+		return -1;
+	}
+
+	ctx->sb.journal_first_index = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
+	superblock_ptr += 2;
+
+	ctx->sb.journal_num_blocks = concatenate_two_bytes(*superblock_ptr, *(superblock_ptr+1));
+	superblock_ptr += 2;
+
+	// both are 0 without a journal, and older images have none
+	if ((ctx->sb.journal_first_index == 0) != (ctx->sb.journal_num_blocks == 0) ||
+	    (ctx->sb.journal_num_blocks != 0 && ctx->sb.journal_num_blocks < JOURNAL_MIN_BLOCKS) ||
+	    (size_t)ctx->sb.journal_first_index + ctx->sb.journal_num_blocks > ctx->sb.num_data_blocks){
+		// fprintf(stderr, "Error in fs_mount(): journal does not fit in the data blocks\n");
+		return -1;
+	}
+
 	for (unsigned i = 0; i < SUPERBLOCK_PAD_LEN; i++){
-		sb->padding[i] = *(superblock_ptr++);
+		ctx->sb.padding[i] = *(superblock_ptr++);
 
-		if (sb->padding[i] != '\0'){
+		if (ctx->sb.padding[i] != '\0'){
 			// fprintf(stderr, "Error in fs_mount(): incorrect superblock padding formatting\n");
-			// fprintf(stderr, "sb->padding[%d] = %d\n", i, sb->padding[i]);
+			// fprintf(stderr, "ctx->sb.padding[%d] = %d\n", i, ctx->sb.padding[i]);
 			return -1;
 		}
 	}
@@ -220,18 +400,18 @@ int load_superblock(uint8_t* superblock_ptr){
 	// debug: print superblock
 	// printf("Sig: ");
 	// for (uint8_t i = 0; i < SUPERBLOCK_SIG_LEN; i++){
-	// 	printf("%c", sb->signature[i]);
+	// 	printf("%c", ctx->sb.signature[i]);
 	// }
 
-	// printf("\nnum blocks: %d\n", sb->num_blocks);
-	// printf("root index: %d\n", sb->root_index);
-	// printf("num fat blocks: %d\n", sb->num_fat_blocks);
-	// printf("num data blocks: %d\n", sb->num_data_blocks);
-	// printf("first data index: %d\n", sb->data_start_index);
+	// printf("\nnum blocks: %d\n", ctx->sb.num_blocks);
+	// printf("root index: %d\n", ctx->sb.root_index);
+	// printf("num fat blocks: %d\n", ctx->sb.num_fat_blocks);
+	// printf("num data blocks: %d\n", ctx->sb.num_data_blocks);
+	// printf("first data index: %d\n", ctx->sb.data_start_index);
 
 	// printf("Padding: ");
 	// for (unsigned i = 0; i < SUPERBLOCK_PAD_LEN; i++){
-	// 	printf("%d", sb->padding[i]);
+	// 	printf("%d", ctx->sb.padding[i]);
 	// }
 	// printf("\n");
 
@@ -239,797 +419,2650 @@ int load_superblock(uint8_t* superblock_ptr){
 	return 0;
 }
 
-// helper function for fs_mount()
-// loads the FAT data
-int load_fat(){
-	fat = malloc(sb->num_data_blocks * sizeof(uint16_t));
-	if (fat == NULL){
-		// fprintf(stderr, "Error in load_fat(): could not allocate fat block\n");
-		return -1;
-	}
-
-	// buf_size is the length of the buffer used to load in the FAT data
-	// since the length of the FAT is equal to the number of data blocks times the size of 2-bytes
-	// since each entry in the FAT is 2 bytes
-	// buf_size should normally be that long
-	// but if there are not many entries for the FAT, the buffer should at least be one block long
-	// so block_read will work
-	uint16_t buf_size;
-	if (sb->num_data_blocks*sizeof(uint16_t) > BLOCK_SIZE){
-		buf_size = sb->num_data_blocks * sizeof(uint16_t);
-	} else {
-		buf_size = BLOCK_SIZE;
+// helper function for store_root_directory() and mark_entry_dirty()
+// converts one root entry into its ROOT_ENTRY_LEN bytes on disk
+void store_root_entry(const struct File* file, uint8_t* entry_ptr){
+	// load each byte of the file's name in
+	for (unsigned j = 0; j < FS_FILENAME_LEN; j++){
+		entry_ptr[j] = file->filename[j];
 	}
 
-	// printf("buf size = %d\n", buf_size);
-	// printf("num fat blocks = %d\n", sb->num_fat_blocks);
+	entry_ptr += FS_FILENAME_LEN;
 
-	// read in the FAT blocks into the buffer
-	uint16_t buffer[buf_size];
-	int read_success;
-	for (unsigned i = 0; i < sb->num_fat_blocks; i++){
-		// printf("i+1=%d\n", i+1);
-		// printf("BLOCK_SIZE * %d = %d\n", i, BLOCK_SIZE*i);
-		read_success = block_read(i+1, &buffer[BLOCK_SIZE*i]);
-		if (read_success == -1){
-			// fprintf(stderr, "Error in load_fat: failed to read block at index %d\n", i+1);
-			return -1;
-		}
+	// file size is 4 bytes
+	// this operation lets us isolate each byte of the num
+	// we store them in reverse order because of little endianness
+	entry_ptr[3] = (file->file_size >> 24) & 0xFF;
+	entry_ptr[2] = (file->file_size >> 16) & 0xFF;
+	entry_ptr[1] = (file->file_size >> 8) & 0xFF;
+	entry_ptr[0] = (file->file_size >> 0) & 0xFF;
+
+	entry_ptr += 4;
+
+	// we do the same for the first index, but only for 2 bytes
+	entry_ptr[1] = (file->first_index >> 8) & 0xFF;
+	entry_ptr[0] = (file->first_index >> 0) & 0xFF;
+
+	entry_ptr += 2;
+
+	// store each byte of the padding
+	for (unsigned j = 0; j < ROOT_PAD_LEN; j++){
+		entry_ptr[j] = file->padding[j];
 	}
+}
 
-	// load each entry from the FAT blocks into the FAT
-	for (uint16_t i = 0; i < sb->num_data_blocks; i++){
-		*(fat+i) = buffer[i];
-		// printf("%d\n", *(fat+i));
+// journal deltas, each a type byte followed by little endian fields
+// they hold the new value rather than the change, so replaying one twice does no harm
+//   'F' FAT index (2 bytes), new value (2 bytes)
+//   'S' dir_first_index (2 bytes), dir_num_blocks (2 bytes)
+//   'R' root entry number (4 bytes), the entry as stored on disk (ROOT_ENTRY_LEN bytes)
+#define DELTA_FAT 'F'
+#define DELTA_FAT_LEN 5
+#define DELTA_SUPERBLOCK 'S'
+#define DELTA_SUPERBLOCK_LEN 5
+#define DELTA_ROOT 'R'
+#define DELTA_ROOT_LEN (5 + ROOT_ENTRY_LEN)
+
+// used everywhere the FAT is read or changed
+// returns the FAT block holding entry index, reading it from the disk if it is not in memory
+// returns NULL if it could not be read
+// must be called with alloc_lock held
+uint16_t* fat_page(fs_ctx* ctx, const uint16_t index){
+	size_t b = index / FAT_ENTRIES_PER_BLOCK;
+	if (ctx->fat_pages[b] == NULL){
+		uint16_t* page = malloc(BLOCK_SIZE);
+		if (page == NULL || disk_read(ctx->disk, b+1, page) != 0){
+			// fprintf(stderr, "Error in fat_page(ctx): failed to read FAT block %zu\n", b);
+			free(page);
+			return NULL;
+		}
+		ctx->fat_pages[b] = page;
+		ctx->num_fat_pages++;
 	}
 
-	if (*fat != FAT_EOC){
-		// fprintf(stderr, "Error in load_fat(): first element of FAT is supposed to be FAT_EOC\n");
+	ctx->fat_last_use[b] = ++ctx->fat_clock;
+	return ctx->fat_pages[b];
+}
+
+// used to walk FAT chains
+// returns -1 if the entry's FAT block could not be read
+// must be called with alloc_lock held
+int get_fat_entry(fs_ctx* ctx, const uint16_t index, uint16_t* value){
+	uint16_t* page = fat_page(ctx, index);
+	if (page == NULL){
 		return -1;
 	}
 
+	STATS_ADD(fat_steps, 1);
+	*value = page[index % FAT_ENTRIES_PER_BLOCK];
 	return 0;
 }
 
-// helper function for fs_mount()
-// loads in the root info
-int load_root_directory(uint8_t* root_ptr){
-	// printf("root dir\n");
+// used everywhere the FAT is changed
+// sets a FAT entry, and remembers that its FAT block has to be written back
+// the FAT block must be in memory already, from get_fat_entry() or fat_page() earlier in the same operation
+// that way a change never fails halfway through
+// must be called with alloc_lock held
+void set_fat_entry(fs_ctx* ctx, const uint16_t index, const uint16_t value){
+	uint16_t* page = ctx->fat_pages[index / FAT_ENTRIES_PER_BLOCK];
+	assert(page != NULL);
 
-	// root is an array of file pointers
-	for (unsigned f = 0; f < FS_FILE_MAX_COUNT; f++){
-		struct File* file = malloc(sizeof(struct File));
-		if (file == NULL){
-			// fprintf(stderr, "Error in load_root_directory(): failed to allocate file %d\n", f);
-			return -1;
-		}
+	page[index % FAT_ENTRIES_PER_BLOCK] = value;
+	ctx->fat_dirty[index / FAT_ENTRIES_PER_BLOCK] = true;
 
-		// load in each byte of the name individually
-		// each char is one byte
-		for (unsigned i = 0; i < FS_FILENAME_LEN; i++){
-			file->filename[i] = *(root_ptr++);
-		}
+	if (ctx->journal != NULL){
+		uint8_t delta[DELTA_FAT_LEN] = {DELTA_FAT, index & 0xFF, index >> 8, value & 0xFF, value >> 8};
+		journal_log(ctx->journal, delta, DELTA_FAT_LEN);
+	}
+}
 
-		// load in the file size (4 bytes)
-		file->file_size = concatenate_four_bytes(*root_ptr, *(root_ptr+1), *(root_ptr+2), *(root_ptr+3));
-		root_ptr += 4;
+// used everywhere a root entry is changed, after the change
+// remembers that the entry's directory block has to be written back
+// must be called with alloc_lock held
+void mark_entry_dirty(fs_ctx* ctx, const struct File* file){
+	ctx->dir_dirty[file->entry / FS_FILE_MAX_COUNT] = true;
+
+	if (ctx->journal != NULL){
+		uint8_t delta[DELTA_ROOT_LEN] = {DELTA_ROOT, file->entry & 0xFF, (file->entry >> 8) & 0xFF, (file->entry >> 16) & 0xFF, (file->entry >> 24) & 0xFF};
+		store_root_entry(file, delta + 5);
+		// an appending writer changes the size of the same entry on every write, and only the last size matters
+		journal_log_update(ctx->journal, delta, DELTA_ROOT_LEN, 5);
+	}
+}
 
-		// load in the first index (2 bytes)
-		file->first_index = concatenate_two_bytes(*root_ptr, *(root_ptr+1));
-		root_ptr += 2;
+// used by grow_directory() whenever the directory's place in the superblock changes
+// must be called with alloc_lock held
+void mark_superblock_dirty(fs_ctx* ctx){
+	ctx->sb_dirty = true;
 
-		// load in the padding (10 bytes)
-		for (unsigned i = 0; i < ROOT_PAD_LEN; i++){
-			file->padding[i] = (*root_ptr++);
+	if (ctx->journal != NULL){
+		uint8_t delta[DELTA_SUPERBLOCK_LEN] = {DELTA_SUPERBLOCK, ctx->sb.dir_first_index & 0xFF, ctx->sb.dir_first_index >> 8, ctx->sb.dir_num_blocks & 0xFF, ctx->sb.dir_num_blocks >> 8};
+		journal_log(ctx->journal, delta, DELTA_SUPERBLOCK_LEN);
+	}
+}
 
-			if (file->padding[i] != '\0'){
-				// fprintf(stderr, "Error in fs_mount(): incorrect padding formatting for file %d\n", f);
-				// fprintf(stderr, "file->padding[%d] = %d\n", i, sb->padding[i]);
-				return -1;
+// used at the end of every operation that reads or changes the FAT
+// drops the least recently used clean FAT blocks until at most FAT_RESIDENT_BLOCKS are in memory
+// pages are never dropped in the middle of an operation, so an entry read early on can still be set later
+// must be called with alloc_lock held
+void trim_fat_pages(fs_ctx* ctx){
+	while (ctx->num_fat_pages > FAT_RESIDENT_BLOCKS){
+		size_t victim = ctx->sb.num_fat_blocks;
+		for (size_t b = 0; b < ctx->sb.num_fat_blocks; b++){
+			if (ctx->fat_pages[b] != NULL && !ctx->fat_dirty[b] && (victim == ctx->sb.num_fat_blocks || ctx->fat_last_use[b] < ctx->fat_last_use[victim])){
+				victim = b;
 			}
 		}
 
-		root[f] = file;
-		// printf("in load_root_directory: %d\n", root->files[f]->first_index);
-	}
+		// every page left is dirty, and waits for write_metadata()
+		if (victim == ctx->sb.num_fat_blocks){
+			return;
+		}
 
-	return 0;
+		free(ctx->fat_pages[victim]);
+		ctx->fat_pages[victim] = NULL;
+		ctx->num_fat_pages--;
+	}
 }
 
-// helper function for fs_create()
-// finds the first empty entry in the root directory and returns its index
-// returns -1 if unable to find empty entry
-int find_empty_root_entry(void){
-	for (unsigned i = 0; i < FS_FILE_MAX_COUNT; i++){
-		if (root[i]->filename[0] == 0){
-			return i;
-		}
+// helper function for fs_mount()
+// sets up the FAT, of which only the first block is read, to check it
+int load_fat(fs_ctx* ctx){
+	// every entry that can be used has to be in a FAT block
+	if (ctx->sb.num_fat_blocks * FAT_ENTRIES_PER_BLOCK < ctx->sb.num_data_blocks){
+		// fprintf(stderr, "Error in load_fat(ctx): too few FAT blocks for the data blocks\n");
+		return -1;
 	}
 
-	return -1;
-}
+	ctx->fat_pages = calloc(ctx->sb.num_fat_blocks, sizeof(uint16_t*));
+	ctx->fat_last_use = calloc(ctx->sb.num_fat_blocks, sizeof(uint64_t));
+	ctx->fat_dirty = calloc(ctx->sb.num_fat_blocks, sizeof(bool));
+	if (ctx->fat_pages == NULL || ctx->fat_last_use == NULL || ctx->fat_dirty == NULL){
+		// fprintf(stderr, "Error in load_fat(ctx): could not allocate fat block\n");
+		return -1;
+	}
 
+	uint16_t first_entry;
+	if (get_fat_entry(ctx, 0, &first_entry) != 0){
+		return -1;
+	}
 
-// helper function for various functions
-// returns -1 if there is no matching filename in the root directory
-// returns the file index if there is a matching filename
-// no error checking here because that is done before it is called
-int find_matching_filename(const char* filename){
-	for (unsigned i = 0; i < FS_FILE_MAX_COUNT; i++){
-		if (strcmp(filename, (char*)(root[i]->filename)) == 0){
-			return i;
-		}
+	if (first_entry != FAT_EOC){
+		// fprintf(stderr, "Error in load_fat(ctx): first element of FAT is supposed to be FAT_EOC\n");
+		return -1;
 	}
 
-	return -1;
+	return 0;
 }
 
-// helper function for fs_open()
-// allocates memory for a FileDescriptor and adds it to the FD array
-// the index of the file in the array is its FD num, the one used in many func params
-int add_file_to_fd_array(struct File* file){
-	if (num_open_files > FS_OPEN_MAX_COUNT){
-		// fprintf(stderr, "Error in add_file_to_fd_array(): max number of files already open\n");
+// helper function for fs_mount()
+// sets up the free-space bitmap, with no free block known yet
+// from then on, the bitmap is kept in sync by allocate_blocks_in_fat(ctx, ) and fs_delete()
+int load_free_blocks(fs_ctx* ctx){
+	if (bitmap_init(&ctx->free_blocks, ctx->sb.num_data_blocks) != 0){
+		// fprintf(stderr, "Error in load_free_blocks(ctx): could not allocate bitmap\n");
 		return -1;
 	}
-	
-	// initialize FD
-	struct FileDescriptor* fd = malloc(sizeof(struct FileDescriptor));
-	if (fd == NULL){
-		// fprintf(stderr, "Error in add_file_to_fd_array(): unable to alloacte file descriptor\n");
+
+	ctx->fat_scanned = 0;
+	return 0;
+}
+
+// helper function for alloc_free_blocks() and scan_whole_fat()
+// adds the free entries of the next FAT block that was not scanned yet to the free-space bitmap
+// returns -1 if it could not be read, or if every FAT block was scanned already
+// must be called with alloc_lock held
+int scan_fat_block(fs_ctx* ctx){
+	if (ctx->fat_scanned >= ctx->sb.num_fat_blocks){
 		return -1;
 	}
 
-	fd->file = file;
-	fd->offset = 0;
-	
-	// find empty entry in the FD array and add the file there
-	int fd_index = -1;
-	for (unsigned i = 0; i < FS_OPEN_MAX_COUNT; i++){
-		if (open_files[i] == NULL){
-			open_files[i] = fd;
-			fd_index = i;
-			num_open_files++;
-			break;
+	size_t first = ctx->fat_scanned * FAT_ENTRIES_PER_BLOCK;
+	uint16_t* page = fat_page(ctx, first);
+	if (page == NULL){
+		return -1;
+	}
+
+	// fat[0] is always invalid, so it is never marked free
+	size_t i;
+	for (i = first == 0 ? 1 : first; i < first + FAT_ENTRIES_PER_BLOCK && i < ctx->sb.num_data_blocks; i++){
+		if (page[i - first] == 0){
+			bitmap_free(&ctx->free_blocks, i);
 		}
 	}
+	STATS_ADD(alloc_scanned, i - first);
 
-	return fd_index;
+	ctx->fat_scanned++;
+	return 0;
 }
 
-// helper function for fs_write() and fs_read()
-// finds the number of blocks required to access for the write/read
-int find_num_target_blocks(const uint16_t offset, const size_t count){
-	int num_target_blocks = 0;
-	size_t data = offset + count;
-	num_target_blocks += data / BLOCK_SIZE;
-	if (data % BLOCK_SIZE != 0){
-		num_target_blocks++;
+// used by fs_info() and to reserve a journal, which need to know about every free block
+// must be called with alloc_lock held
+int scan_whole_fat(fs_ctx* ctx){
+	while (ctx->fat_scanned < ctx->sb.num_fat_blocks){
+		if (scan_fat_block(ctx) != 0){
+			return -1;
+		}
 	}
 
-	return num_target_blocks;
+	trim_fat_pages(ctx);
+	return 0;
 }
 
-// helper function for fs_write()
-int allocate_blocks_in_fat(const int fd, const int num_target_blocks){
-	// printf("running allocate_blocks_in_fat\n");
-
-	if (num_target_blocks <= 0){
-		return 0;
+// used wherever blocks are allocated
+// takes a run of at most max_count free blocks like bitmap_alloc(), scanning more of the FAT while none is known
+// returns the length of the run, 0 if there is no free block
+// must be called with alloc_lock held
+size_t alloc_free_blocks(fs_ctx* ctx, const size_t max_count, size_t* start){
+	size_t count;
+	STATS_ADD(allocs, 1);
+	while ((count = bitmap_alloc(&ctx->free_blocks, max_count, start)) == 0){
+		if (scan_fat_block(ctx) != 0){
+			return 0;
+		}
 	}
 
-	uint16_t block_index = open_files[fd]->file->first_index;
-
-	// if our first index is FAT_EOC, then the file has no data blocks allocated
-	// so we iterate through the FAT until we find an empty entry, then make that the file's first block
-	if (block_index == FAT_EOC){
-		for (int i = 1; i < sb->num_data_blocks; i++){
-			if (*(fat+i) == 0){
-				*(fat+i) = FAT_EOC;
-				block_index = i;
-				open_files[fd]->file->first_index = block_index;
-				break;
-			}
-		}
+	return count;
+}
 
-		if (block_index == FAT_EOC){
-			// fprintf(stderr, "Error in allocate_blocks_in_fat(): unable to find empty FAT entry for block 0\n");
+// used by fs_fallocate()
+// takes a run of exactly count contiguous free blocks, the lowest there is, scanning more of the FAT while none is known
+// returns -1 if there is no such run
+// must be called with alloc_lock held
+int alloc_free_run(fs_ctx* ctx, const size_t count, size_t* start){
+	STATS_ADD(allocs, 1);
+	while (bitmap_alloc_run(&ctx->free_blocks, count, start) != 0){
+		if (scan_fat_block(ctx) != 0){
 			return -1;
 		}
 	}
-	int num_data_blocks = 1;
 
-	// we then follow the chain of data blocks for the file until we reach the end
-	// the loop exits when fat[block_index] == FAT_EOC. this will leave us with the last valid index
-	for (block_index = open_files[fd]->file->first_index; *(fat+block_index) != FAT_EOC; num_data_blocks++){
-		block_index = *(fat+block_index);
+	return 0;
+}
+
+// used wherever blocks are freed
+// blocks in FAT blocks that were not scanned yet are left for the scan, so the lowest free block is still handed out first
+// must be called with alloc_lock held
+void release_block(fs_ctx* ctx, const uint16_t index){
+	if (index / FAT_ENTRIES_PER_BLOCK < ctx->fat_scanned){
+		bitmap_free(&ctx->free_blocks, index);
 	}
+}
 
-	// printf("num data blocks at start is %d\n", num_data_blocks);
+// helper function for fs_delete() and fs_umount()
+// releases the memory used by the block map
+// the next fs_open() of the file will rebuild it from the FAT
+void free_block_map(struct File* file){
+	free(file->map.blocks);
+	file->map.blocks = NULL;
+	file->map.num_blocks = 0;
+	file->map.capacity = 0;
+	file->map.is_built = false;
+}
 
-	// now we extend the chain out to our desired length
-	while (num_data_blocks < num_target_blocks){
-		int found_new_index = 0;
-		// we start at 1 because fat[0] is always invalid
-		for (int i = 1; i < sb->num_data_blocks; i++){
-			// 0 signifies an empty entry available to incorporate into our file's linked list
-			if (*(fat+i) == 0){
-				// printf("block index = %d\n", block_index);
-				*(fat+block_index) = i;
-				*(fat+i) = FAT_EOC;
-				num_data_blocks++;
-				block_index = i;
-				found_new_index = 1;
-				break;
-			}
-		}
+// helper function for load_root_directory() and grow_directory()
+// allocates the empty root entries of directory block b, all in one array, and points root at them
+// returns -1 if they could not be allocated
+int alloc_file_block(fs_ctx* ctx, const size_t b){
+	struct File* files = aligned_alloc(CACHE_LINE_SIZE, FS_FILE_MAX_COUNT * sizeof(struct File));
+	if (files == NULL){
+		return -1;
+	}
+	memset(files, 0, FS_FILE_MAX_COUNT * sizeof(struct File));
 
-		if (!found_new_index){
-			// fprintf(stderr, "Error in allocate_blocks_in_fat(): unable to find empty FAT entry for block %d\n", num_data_blocks);
+	for (size_t f = 0; f < FS_FILE_MAX_COUNT; f++){
+		if (pthread_rwlock_init(&files[f].lock, NULL) != 0){
+			while (f-- > 0){
+				pthread_rwlock_destroy(&files[f].lock);
+			}
+			free(files);
 			return -1;
 		}
+
+		// the block map is built lazily, by the first read or write of the file
+		files[f].entry = b * FS_FILE_MAX_COUNT + f;
+		files[f].map.is_built = false;
+		ctx->root[files[f].entry] = &files[f];
 	}
 
-	// printf("end of allocate_blocks_in_fat\nResults:\nblock index = %d\nnum data blocks = %d\nnum target blocks = %d\n", block_index, num_data_blocks, num_target_blocks);
+	ctx->file_blocks[b] = files;
 	return 0;
 }
 
-// helper function for fs_read() and fs_write()
-// find the index in the FAT of the nth block in the file
-// returns FAT_EOC if the request was out of bounds
-uint16_t find_data_block(const int fd, const int block_num){
-	uint16_t first_index = open_files[fd]->file->first_index;
-	// printf("first index = %d\n", first_index);
-	if (block_num == 0){
-		return first_index;
+// helper function for grow_directory() and destroy_ctx()
+// releases the root entries of directory block b
+void free_file_block(fs_ctx* ctx, const size_t b){
+	struct File* files = ctx->file_blocks[b];
+	if (files == NULL){
+		return;
 	}
 
-	uint16_t block_index = first_index;
-	for (int i = 0; i < block_num; i++){
-		if (block_index == FAT_EOC){
-			// fprintf(stderr, "Error in find_data_block(): request is out of bounds for the file\n");
-			return FAT_EOC;
-		}
-		block_index = *(fat+block_index);
-		// printf("find data block: block#%d in the file is at index %d\n", i, block_index);
+	for (size_t f = 0; f < FS_FILE_MAX_COUNT; f++){
+		free_block_map(&files[f]);
+		pthread_rwlock_destroy(&files[f].lock);
+		ctx->root[files[f].entry] = NULL;
 	}
 
-	return block_index;
+	free(files);
+	ctx->file_blocks[b] = NULL;
 }
 
-int fs_mount(const char *diskname)
-{
-	/* TODO: Phase 1 */
-	// printf("starting fs_mount\n");
-
-	// open the disk
-	if (load_disk(diskname) != 0){
-		// fprintf(stderr, "Error in fs_mount(): could not open disk\n");
-		return -1;
+// helper function for load_root_directory() and replay_deltas()
+// loads one root entry from its ROOT_ENTRY_LEN bytes on disk
+int load_root_entry(struct File* file, const uint8_t* root_ptr){
+	// load in each byte of the name individually
+	// each char is one byte
+	for (unsigned i = 0; i < FS_FILENAME_LEN; i++){
+		file->filename[i] = *(root_ptr++);
 	}
 
-	// load the buffer containing the superblock data
-	uint8_t buffer[BLOCK_SIZE];
-	void* buf_ptr = &buffer;
+	// load in the file size (4 bytes)
+	file->file_size = concatenate_four_bytes(*root_ptr, *(root_ptr+1), *(root_ptr+2), *(root_ptr+3));
+	root_ptr += 4;
 
-	int read_success = block_read(0, buf_ptr);
-	// printf("read superblock %d\n", read_success);
-	if (read_success != 0){
-		return -1;
+	// load in the first index (2 bytes)
+	file->first_index = concatenate_two_bytes(*root_ptr, *(root_ptr+1));
+	root_ptr += 2;
+
+	// load in the padding (10 bytes)
+	for (unsigned i = 0; i < ROOT_PAD_LEN; i++){
+		file->padding[i] = (*root_ptr++);
+
+		if (file->padding[i] != '\0'){
+			// fprintf(stderr, "Error in fs_mount(): incorrect padding formatting for file %zu\n", file->entry);
+			return -1;
+		}
 	}
 
+	return 0;
+}
 
-	uint8_t* superblock_ptr = (uint8_t*)buf_ptr;
+// helper function for fs_mount()
+// loads in the root info of one directory block, into the entries starting at first_entry
+int load_root_directory(fs_ctx* ctx, uint8_t* root_ptr, const size_t first_entry){
+	// printf("root dir\n");
 
-	if (load_superblock(superblock_ptr) != 0){
-		return -1;
-	}
-	
-	if (load_fat() != 0){
+	// root is an array of file pointers, into the block's array of files
+	// the array is handed over right away, so destroy_ctx() cleans it up if an entry fails
+	if (alloc_file_block(ctx, first_entry / FS_FILE_MAX_COUNT) != 0){
+		// fprintf(stderr, "Error in load_root_directory(ctx, ): failed to allocate the files of block %zu\n", first_entry / FS_FILE_MAX_COUNT);
 		return -1;
 	}
 
-	read_success = block_read(sb->num_fat_blocks+1, buf_ptr);
-	uint8_t* root_ptr = (uint8_t*)buf_ptr;
-	if (load_root_directory(root_ptr) != 0){
-		return -1;
-	}
+	for (unsigned f = 0; f < FS_FILE_MAX_COUNT; f++){
+		struct File* file = ctx->root[first_entry+f];
+
+		if (load_root_entry(file, root_ptr + ROOT_ENTRY_LEN*f) != 0){
+			return -1;
+		}
 
-	for (unsigned i = 0; i < FS_OPEN_MAX_COUNT; i++){
-		open_files[i] = NULL;
+		// printf("in load_root_directory: %d\n", root->files[f]->first_index);
 	}
 
 	return 0;
 }
 
-int fs_umount(void)
-{
-	/* TODO: Phase 1 */
-	// printf("running unmount\n");
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_unmount(): no disk is mounted\n");
-		return -1;
+// used to pick the hash index bucket of a filename
+// FNV-1a, which is short and spreads names this short well enough
+uint32_t hash_filename(const uint8_t* filename){
+	uint32_t hash = 2166136261u;
+	for (; *filename != '\0'; filename++){
+		hash ^= *filename;
+		hash *= 16777619u;
 	}
 
-	if (num_open_files > 0){
-		// fprintf(stderr, "Error in fs_unmount(): cannot unmount until all files are closed\n");
-	}
+	return hash;
+}
 
-	// printf("first index as read by unmount: %d\n", root[0]->first_index);
-	// uint8_t buffer[BLOCK_SIZE];
-	// block_read(root[0]->first_index, buffer);
-	// printblock(buffer);
+// helper function for fs_create() and index_directory()
+// adds a root entry to the hash index under its name
+void name_index_add(fs_ctx* ctx, const int entry){
+	size_t bucket = hash_filename(ctx->root[entry]->filename) & (ctx->num_name_buckets-1);
+	ctx->name_next[entry] = ctx->name_buckets[bucket];
+	ctx->name_buckets[bucket] = entry;
+}
 
-	// write to the FAT blocks and root block to save changes
-	for (uint16_t i = 0; i < sb->num_fat_blocks; i++){
-		block_write(i+1, fat+BLOCK_SIZE*i);
+// helper function for fs_delete()
+// takes a root entry out of the hash index, before its name is cleared
+void name_index_remove(fs_ctx* ctx, const int entry){
+	size_t bucket = hash_filename(ctx->root[entry]->filename) & (ctx->num_name_buckets-1);
+	int* link = &ctx->name_buckets[bucket];
+	while (*link != -1 && *link != entry){
+		link = &ctx->name_next[*link];
 	}
 
-	// to write to the root block, we need to convert the root into a flat byte array
-	uint8_t root_array[BLOCK_SIZE];
-	for (unsigned i = 0; i < FS_FILE_MAX_COUNT; i++){
-
-		// this offset lets us work with the current root entry
-		int offset = ROOT_ENTRY_LEN*i;
-		struct File* file = root[i];
-
-		// load each byte of the file's name in
-		for (unsigned j = 0; j < FS_FILENAME_LEN; j++){
-			root_array[offset+j] = file->filename[j];
-		}
+	if (*link == entry){
+		*link = ctx->name_next[entry];
+	}
+}
 
-		offset += FS_FILENAME_LEN;
+// helper function for load_directory() and grow_directory()
+// makes room in the hash index for every root entry
+// the buckets are only rebuilt once there are more entries than buckets, so growing the directory stays cheap on average
+int index_directory(fs_ctx* ctx){
+	int* new_next = realloc(ctx->name_next, ctx->num_root_entries * sizeof(int));
+	if (new_next == NULL){
+		return -1;
+	}
+	ctx->name_next = new_next;
 
-		// file size is 4 bytes
-		// this operation lets us isolate each byte of the num
-		// we store them in reverse order because of little endianness
-		root_array[offset+3] = (file->file_size >> 24) & 0xFF;
-		root_array[offset+2] = (file->file_size >> 16) & 0xFF;
-		root_array[offset+1] = (file->file_size >> 8) & 0xFF;
-		root_array[offset+0] = (file->file_size >> 0) & 0xFF;
+	if (ctx->num_root_entries <= ctx->num_name_buckets){
+		return 0;
+	}
 
-		offset += 4;
+	// keep the number of buckets a power of 2, so a hash is turned into a bucket with a mask
+	size_t num_buckets = ctx->num_name_buckets == 0 ? FS_FILE_MAX_COUNT : ctx->num_name_buckets;
+	while (num_buckets < ctx->num_root_entries){
+		num_buckets *= 2;
+	}
 
-		// we do the same for the first index, but only for 2 bytes
-		root_array[offset+1] = (file->first_index >> 8) & 0xFF;
-		root_array[offset+0] = (file->first_index >> 0) & 0xFF;
+	int* new_buckets = realloc(ctx->name_buckets, num_buckets * sizeof(int));
+	if (new_buckets == NULL){
+		return -1;
+	}
+	ctx->name_buckets = new_buckets;
+	ctx->num_name_buckets = num_buckets;
 
-		offset += 2;
+	for (size_t i = 0; i < num_buckets; i++){
+		ctx->name_buckets[i] = -1;
+	}
 
-		// store each byte of the padding
-		for (unsigned j = 0; j < ROOT_PAD_LEN; j++){
-			root_array[offset+j] = file->padding[j];
+	for (size_t i = 0; i < ctx->num_root_entries; i++){
+		if (ctx->root[i]->filename[0] != '\0'){
+			name_index_add(ctx, i);
 		}
 	}
 
-	// now that we have a flat array, we can easily write it to the root block
-	block_write(sb->root_index, root_array);
+	return 0;
+}
 
-	// free the memory we allocated in fs_mount()
-	for (unsigned i = 0; i < FS_FILE_MAX_COUNT; i++){
-		free(root[i]);
+// helper function for fs_mount()
+// loads every block of the root directory
+int load_directory(fs_ctx* ctx){
+	size_t num_dir_blocks = ctx->sb.dir_num_blocks;
+
+	// entries start out NULL, so destroy_ctx() only frees the ones that were loaded
+	ctx->root = calloc(num_dir_blocks * FS_FILE_MAX_COUNT, sizeof(struct File*));
+	ctx->dir_blocks = malloc(num_dir_blocks * sizeof(uint16_t));
+	ctx->dir_dirty = calloc(num_dir_blocks, sizeof(bool));
+	ctx->file_blocks = calloc(num_dir_blocks, sizeof(struct File*));
+	if (ctx->root == NULL || ctx->dir_blocks == NULL || ctx->dir_dirty == NULL || ctx->file_blocks == NULL){
+		// fprintf(stderr, "Error in load_directory(ctx): could not allocate directory\n");
+		return -1;
 	}
+	ctx->num_root_entries = num_dir_blocks * FS_FILE_MAX_COUNT;
 
-	free(fat);
-	free(sb);
-
-	// close the disk
-	block_disk_close();
+	// the first block is where it always was, and the rest follow the FAT chain
+	ctx->dir_blocks[0] = ctx->sb.root_index;
+	uint16_t block_index = ctx->sb.dir_first_index;
+	for (size_t i = 1; i < num_dir_blocks; i++){
+		if (block_index == 0 || block_index >= ctx->sb.num_data_blocks){
+			// fprintf(stderr, "Error in load_directory(ctx): directory chain is too short\n");
+			return -1;
+		}
 
-	is_disk_mounted = false;
-	return 0;
-}
+		ctx->dir_blocks[i] = block_index + ctx->sb.data_start_index;
+		if (get_fat_entry(ctx, block_index, &block_index) != 0){
+			return -1;
+		}
+	}
+	trim_fat_pages(ctx);
 
-int fs_info(void)
-{
-	/* TODO: Phase 1 */
-	// printf("running info\n");
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_info(): no disk is mounted\n");
+	if (num_dir_blocks > 1 && block_index != FAT_EOC){
+		// fprintf(stderr, "Error in load_directory(ctx): directory chain is too long\n");
 		return -1;
 	}
 
-	printf("FS Info:\n");
-	printf("total_blk_count=%d\n", block_disk_count());
-	printf("fat_blk_count=%d\n", sb->num_fat_blocks);
-	printf("rdir_blk=%d\n", sb->root_index);
-	printf("data_blk=%d\n", sb->data_start_index);
-	printf("data_blk_count=%d\n", sb->num_data_blocks);
-
-	// free fat entries means the number of entries in the FAT that equal 0
-	// in other words, how many data blocks do not belong to a file
-	int free_fat_entries = 0;
-	for (uint16_t i = 0; i < sb->num_data_blocks; i++){
-		if (*(fat+i) == 0){
-			free_fat_entries++;
+	uint8_t buffer[BLOCK_SIZE];
+	for (size_t i = 0; i < num_dir_blocks; i++){
+		if (disk_read(ctx->disk, ctx->dir_blocks[i], buffer) != 0 || load_root_directory(ctx, buffer, i * FS_FILE_MAX_COUNT) != 0){
+			return -1;
 		}
 	}
 
-	printf("fat_free_ratio=%d/%d\n", free_fat_entries, sb->num_data_blocks);
+	return 0;
+}
 
-	// free root entries means the number of possible files that have not been created
-	int free_root_entries = 0;
-	for (unsigned i = 0; i < FS_FILE_MAX_COUNT; i++){
-		if (root[i]->filename[0] == '\0'){
-			free_root_entries++;
-		} else {
+// helper function for fs_mount()
+// indexes the empty entries and the names of the root directory, once every entry is loaded
+int index_root_entries(fs_ctx* ctx){
+	if (bitmap_init(&ctx->free_entries, ctx->num_root_entries) != 0){
+		return -1;
+	}
 
-			// uint8_t buffer[BLOCK_SIZE];
-			// block_read(root[i]->first_index, buffer);
-			// for (int i = 0; i < BLOCK_SIZE; i++){
-			// 	printf("%c", buffer[i]);
-			// }
+	for (size_t i = 0; i < ctx->num_root_entries; i++){
+		if (ctx->root[i]->filename[0] == '\0'){
+			bitmap_free(&ctx->free_entries, i);
 		}
 	}
 
-	printf("rdir_free_ratio=%d/%d\n", free_root_entries, FS_FILE_MAX_COUNT);
-	
-	return 0;
+	return index_directory(ctx);
 }
 
-int fs_create(const char *filename)
-{
-	/* TODO: Phase 2 */
-	// printf("running create\n");
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_create(): no disk is mounted\n");
+// helper function for find_empty_root_entry()
+// adds one block of empty entries to the root directory
+// the block is taken from the data area and linked to the end of the directory's FAT chain
+// returns -1 if there is no free block, or no memory for the new entries
+int grow_directory(fs_ctx* ctx){
+	size_t num_dir_blocks = ctx->sb.dir_num_blocks;
+	size_t num_entries = ctx->num_root_entries + FS_FILE_MAX_COUNT;
+
+	// get every allocation out of the way first, so a failure leaves the directory as it was
+	struct File** new_root = realloc(ctx->root, num_entries * sizeof(struct File*));
+	if (new_root == NULL){
 		return -1;
 	}
-	if (is_filename_invalid(filename)){
-		// fprintf(stderr, "Error in fs_create(): invalid file name\n");
+	ctx->root = new_root;
+
+	uint16_t* new_dir_blocks = realloc(ctx->dir_blocks, (num_dir_blocks+1) * sizeof(uint16_t));
+	if (new_dir_blocks == NULL){
 		return -1;
 	}
+	ctx->dir_blocks = new_dir_blocks;
 
-	if (find_matching_filename(filename) != -1){
-		// fprintf(stderr, "Error in fs_create(): file named %s already exists\n", filename);
+	bool* new_dir_dirty = realloc(ctx->dir_dirty, (num_dir_blocks+1) * sizeof(bool));
+	if (new_dir_dirty == NULL){
 		return -1;
 	}
+	ctx->dir_dirty = new_dir_dirty;
 
-	// find new entry
-	int empty_index = find_empty_root_entry();
-	if (empty_index == -1){
-		// fprintf(stderr, "Error in fs_create(): unable to find empty index\n");
+	struct File** new_file_blocks = realloc(ctx->file_blocks, (num_dir_blocks+1) * sizeof(struct File*));
+	if (new_file_blocks == NULL){
 		return -1;
 	}
-	struct File* new_file = root[empty_index];
+	ctx->file_blocks = new_file_blocks;
+	ctx->file_blocks[num_dir_blocks] = NULL;
 
-	// since new_file->filename is an array of uint8_t,
-	// and filename is a char*,
-	// we must fill up the array byte-by-byte instead of all at once
-	for (unsigned i = 0; i < strlen(filename); i++){
-		new_file->filename[i] = filename[i];
+	int* new_next = realloc(ctx->name_next, num_entries * sizeof(int));
+	if (new_next == NULL){
+		return -1;
 	}
+	ctx->name_next = new_next;
 
-	new_file->filename[strlen(filename)] = '\0';
+	if (num_dir_blocks+1 > UINT16_MAX || bitmap_grow(&ctx->free_entries, num_entries) != 0){
+		return -1;
+	}
 
-	// reset the other members of the struct
-	new_file->file_size = 0;
-	new_file->first_index = FAT_EOC;
-	// printf("in fs_create: %d\n", root[empty_index]->first_index);
+	if (alloc_file_block(ctx, num_dir_blocks) != 0){
+		return -1;
+	}
 
-	// printf("%s\n", filename);
-	return 0;
-}
+	pthread_mutex_lock(&ctx->alloc_lock);
 
-int fs_delete(const char *filename)
-{
-	/* TODO: Phase 2 */
-	// printf("runnin delete\n");
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_delete(): no disk is mounted\n");
-		return -1;
+	// the block may still be cached from a deleted file, and that copy must never overwrite the directory
+	// with a journal, the block is only written home at the next checkpoint, but a replay after a crash loads it
+	// so it is emptied on disk now, before any record that adds it to the directory is written
+	size_t block_index;
+	uint8_t empty[BLOCK_SIZE] = {0};
+	size_t alloc_count = alloc_free_blocks(ctx, 1, &block_index);
+	if (alloc_count != 0){
+		cache_discard(ctx->cache, block_index + ctx->sb.data_start_index, 1);
 	}
 
-	if (is_filename_invalid(filename)){
-		// fprintf(stderr, "Error in fs_delete(): invalid file name\n");
-		return -1;
+	// both FAT entries about to be set have their FAT blocks paged in first
+	uint16_t last_dir_index = ctx->dir_blocks[num_dir_blocks-1]-ctx->sb.data_start_index;
+	if (alloc_count != 0 && (fat_page(ctx, block_index) == NULL || (num_dir_blocks > 1 && fat_page(ctx, last_dir_index) == NULL) ||
+	    (ctx->journal != NULL && disk_write(ctx->disk, block_index + ctx->sb.data_start_index, empty) != 0))){
+		bitmap_free(&ctx->free_blocks, block_index);
+		alloc_count = 0;
 	}
 
-	int matching_file_index = find_matching_filename(filename);
-	if (matching_file_index == -1){
-		// fprintf(stderr, "Error in fs_create(): file named %s does not exist\n", filename);
+	if (alloc_count == 0){
+		trim_fat_pages(ctx);
+		pthread_mutex_unlock(&ctx->alloc_lock);
+		free_file_block(ctx, num_dir_blocks);
 		return -1;
 	}
 
-	// check if the requested file is opened, and reject it if it is
-	for (unsigned i = 0; i < FS_OPEN_MAX_COUNT; i++){
-		if (open_files[i] != NULL && streq(open_files[i]->file->filename, (uint8_t*)filename) == 0){
-			// fprintf(stderr, "Error in fs_delete(): open files cannot be deleted\n");
-			return -1;
-		}
+	set_fat_entry(ctx, block_index, FAT_EOC);
+	if (num_dir_blocks == 1){
+		ctx->sb.dir_first_index = block_index;
+	} else {
+		set_fat_entry(ctx, last_dir_index, block_index);
 	}
 
-	struct File* old_file = root[matching_file_index];
+	ctx->dir_blocks[num_dir_blocks] = block_index + ctx->sb.data_start_index;
+	ctx->sb.dir_num_blocks++;
 
-	// free all of the data blocks in the FAT the file was using
-	uint16_t block_index = old_file->first_index;
-	if (block_index != FAT_EOC){
-		while (*(fat+block_index) != FAT_EOC){
-			uint16_t old_block_index = block_index;
-			*(fat+old_block_index) = 0;
-			block_index = *(fat+block_index);
-		}
+	// the new block is written out with empty entries, and the superblock records it
+	ctx->dir_dirty[num_dir_blocks] = true;
+	mark_superblock_dirty(ctx);
 
-		*(fat+block_index) = 0;
+	trim_fat_pages(ctx);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+
+	for (size_t i = ctx->num_root_entries; i < num_entries; i++){
+		bitmap_free(&ctx->free_entries, i);
 	}
+	ctx->num_root_entries = num_entries;
 
-	// initialize the members of the file to be an empty entry
-	old_file->filename[0] = '\0';
-	old_file->file_size = 0;
-	old_file->first_index = FAT_EOC;
+	// the new entries are all empty and name_next already has room for them, so nothing is lost if the buckets cannot grow yet
+	// the next growth tries again, and until then the buckets are just more crowded
+	if (index_directory(ctx) != 0){
+		// fprintf(stderr, "Error in grow_directory(ctx): could not grow the hash index\n");
+	}
 
 	return 0;
 }
 
-int fs_ls(void)
-{
-	/* TODO: Phase 2 */
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_ls(): no disk is mounted\n");
+// helper function for fs_create()
+// takes the first empty entry in the root directory and returns its index
+// the directory grows by a block if every entry is taken
+// returns -1 if unable to find empty entry
+int find_empty_root_entry(fs_ctx* ctx){
+	size_t entry;
+	if (bitmap_alloc(&ctx->free_entries, 1, &entry) == 0){
+		if (grow_directory(ctx) != 0 || bitmap_alloc(&ctx->free_entries, 1, &entry) == 0){
+			return -1;
+		}
 	}
 
-	printf("FS Ls:\n");
-	for (unsigned i = 0; i < FS_FILE_MAX_COUNT; i++){
-		struct File* file = root[i];
-		if (file->filename[0] != 0){
-			// printf("File #%d\n", i);
-			// printf("Name: %s\n", root[i]->filename);
-			// printf("Size: %d\n", root[i]->file_size);
-			// printf("First index: %d\n", root[i]->first_index);
-			printf("file: %s, size: %d, data_blk: %d\n", file->filename, file->file_size, file->first_index);
+	return entry;
+}
+
+
+// helper function for various functions
+// returns -1 if there is no matching filename in the root directory
+// returns the file index if there is a matching filename
+// no error checking here because that is done before it is called
+// only the entries whose names hash to the same bucket are compared
+int find_matching_filename(fs_ctx* ctx, const char* filename){
+	size_t bucket = hash_filename((const uint8_t*)filename) & (ctx->num_name_buckets-1);
+	for (int i = ctx->name_buckets[bucket]; i != -1; i = ctx->name_next[i]){
+		if (strcmp(filename, (char*)(ctx->root[i]->filename)) == 0){
+			return i;
 		}
 	}
-	return 0;
+
+	return -1;
 }
 
-// this function is very simple, since most of the heavy lifting is done in helper functions
-int fs_open(const char *filename)
-{
-	/* TODO: Phase 3 */
-	// printf("running open\n");
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_open(): no disk is mounted\n");
+// helper function for fs_mount() and add_file_to_fd_array()
+// gives the descriptor table room for capacity descriptors, and chains the new slots in front of the free ones
+// the table only grows while open and close are locked out, so nobody holds a descriptor that moves
+// returns -1 if the table could not be allocated
+int grow_fd_table(fs_ctx* ctx, const size_t capacity){
+	struct FileDescriptor* table = aligned_alloc(CACHE_LINE_SIZE, capacity * sizeof(struct FileDescriptor));
+	if (table == NULL){
 		return -1;
 	}
+	memset(table, 0, capacity * sizeof(struct FileDescriptor));
+	if (ctx->fd_table != NULL){
+		memcpy(table, ctx->fd_table, ctx->fd_capacity * sizeof(struct FileDescriptor));
+		free(ctx->fd_table);
+	}
 
-	if (is_filename_invalid(filename)){
-		// fprintf(stderr, "Error in fs_create(): invalid file name\n");
-		return -1;
+	// the lowest new slot comes first, so slots are handed out in order until the first close
+	for (size_t i = capacity; i-- > ctx->fd_capacity;){
+		table[i].next_free = ctx->fd_free_head;
+		ctx->fd_free_head = i;
 	}
 
-	int file_index = find_matching_filename(filename);
-	if (file_index == -1){
-		// fprintf(stderr, "Error in fs_open(): file %s not found\n", filename);
-		return -1;
+	ctx->fd_table = table;
+	ctx->fd_capacity = capacity;
+	return 0;
+}
+
+// used everywhere a descriptor comes in from the user, with the table locked
+// finds the open descriptor fd stands for, in constant time
+// returns NULL if fd is out of bounds, not open, or was closed since it was handed out
+struct FileDescriptor* get_descriptor(fs_ctx* ctx, const int fd){
+	if (fd < 0 || (size_t)(fd & FD_SLOT_MASK) >= ctx->fd_capacity){
+		return NULL;
 	}
 
-	int fd = add_file_to_fd_array(root[file_index]);
-	if (fd == -1){
-		// fprintf(stderr, "Error in fs_open(): max number of files already open\n");
-		return -1;
+	struct FileDescriptor* desc = &ctx->fd_table[fd & FD_SLOT_MASK];
+	if (desc->file == NULL || desc->generation != fd >> FD_SLOT_BITS){
+		return NULL;
 	}
 
-	return fd;
+	return desc;
 }
 
-int fs_close(int fd)
-{
-	/* TODO: Phase 3 */
-	// printf("running close\n");
-	// printf("first index as read by fs close: %d\n", open_files[fd]->file->first_index);
-	// uint8_t buffer[BLOCK_SIZE];
-	// block_read(open_files[fd]->file->first_index, buffer);
-	// printblock(buffer);
-
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_close(): no disk is mounted\n");
-		return -1;
+// helper function for fs_open()
+// sets up a FileDescriptor in a free slot of the FD table, growing the table if it is full
+// returns the FD num, the one used in many func params, made of the slot and its generation
+int add_file_to_fd_array(fs_ctx* ctx, struct File* file){
+	if (ctx->fd_free_head == -1){
+		size_t capacity = ctx->fd_capacity * 2;
+		if (capacity > ctx->fd_max){
+			capacity = ctx->fd_max;
+		}
+		if (capacity <= ctx->fd_capacity || grow_fd_table(ctx, capacity) != 0){
+			// fprintf(stderr, "Error in add_file_to_fd_array(ctx, ): max number of files already open\n");
+			return -1;
+		}
 	}
 
-	if (fd < 0 || fd >= FS_FILE_MAX_COUNT){
-		// fprintf(stderr, "Error in fs_close(): file descriptor %d out of bounds\n", fd);
-		return -1;
-	}
+	// take the first free slot and initialize the FD there
+	int slot = ctx->fd_free_head;
+	struct FileDescriptor* fd = &ctx->fd_table[slot];
+	ctx->fd_free_head = fd->next_free;
 
-	if (open_files[fd] == NULL){
-		// fprintf(stderr, "Error in fs_close(): file with descriptor %d not open\n", fd);
-		return -1;
-	}
+	fd->file = file;
+	fd->offset = 0;
+	fd->ra_next_offset = 0;
+	fd->ra_window = 0;
+	fd->ra_end = 0;
 
-	// free the memory we allocated in fs_create()
-	free(open_files[fd]);
-	open_files[fd] = NULL;
-	num_open_files--;
-	return 0;
+	file->num_open++;
+	ctx->num_open_files++;
+	return fd->generation << FD_SLOT_BITS | slot;
 }
 
-int fs_stat(int fd)
-{
-	/* TODO: Phase 3 */
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_stat(): no disk is mounted\n");
-		return -1;
+// helper function for fs_write() and fs_read()
+// finds the number of blocks required to access for the write/read
+// fs_write() and fs_read() keep offset+count within a uint32_t, so the sum cannot overflow
+int find_num_target_blocks(const uint32_t offset, const size_t count){
+	int num_target_blocks = 0;
+	size_t data = (size_t)offset + count;
+	num_target_blocks += data / BLOCK_SIZE;
+	if (data % BLOCK_SIZE != 0){
+		num_target_blocks++;
 	}
 
-	if (fd < 0 || fd >= FS_FILE_MAX_COUNT){
-		// fprintf(stderr, "Error in fs_stat(): file descriptor %d out of bounds\n", fd);
-		return -1;
-	}
+	return num_target_blocks;
+}
 
-	if (open_files[fd] == NULL){
-		// fprintf(stderr, "Error in fs_stat(): file with descriptor %d not open\n", fd);
-		return -1;
+// helper function for allocate_blocks_in_fat(ctx, ) and build_block_map(ctx, )
+// adds a FAT index to the end of the file's block map, growing it if needed
+// returns -1 if the map could not be grown
+int block_map_append(struct BlockMap* map, const uint16_t block_index){
+	if (map->num_blocks == map->capacity){
+		// double the capacity so appending a whole file is linear overall
+		uint16_t new_capacity = map->capacity == 0 ? 16 : map->capacity*2;
+		if (new_capacity < map->capacity){
+			new_capacity = UINT16_MAX;
+		}
+
+		uint16_t* new_blocks = realloc(map->blocks, new_capacity * sizeof(uint16_t));
+		if (new_blocks == NULL){
+			// fprintf(stderr, "Error in block_map_append(): unable to grow block map\n");
+			return -1;
+		}
+
+		map->blocks = new_blocks;
+		map->capacity = new_capacity;
 	}
 
-	return open_files[fd]->file->file_size;
+	map->blocks[map->num_blocks++] = block_index;
+	return 0;
 }
 
-int fs_lseek(int fd, size_t offset)
-{
-	/* TODO: Phase 3 */
-	// printf("running lseek\n");
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_lseek(): no disk is mounted\n");
-		return -1;
+// helper function for lock_file_shared() and the write paths, called with the file's lock held exclusively
+// walks the file's FAT chain once and records every block in the file's block map
+// does nothing if the map was already built by an earlier read or write
+// building it there rather than in fs_open() keeps opening a file free of allocations
+int build_block_map(fs_ctx* ctx, struct File* file){
+	if (file->map.is_built){
+		return 0;
 	}
 
-	if (fd < 0 || fd >= FS_FILE_MAX_COUNT){
-		// fprintf(stderr, "Error in fs_lseek(): file descriptor %d out of bounds\n", fd);
-		return -1;
+	// other files may be growing at the same time, which changes the FAT
+	pthread_mutex_lock(&ctx->alloc_lock);
+
+	int ret = 0;
+	file->map.num_blocks = 0;
+	uint16_t block_index = file->first_index;
+	while (block_index != FAT_EOC){
+		// a chain longer than the FAT means it loops back on itself
+		if (block_index >= ctx->sb.num_data_blocks || file->map.num_blocks >= ctx->sb.num_data_blocks){
+			// fprintf(stderr, "Error in build_block_map(ctx, ): corrupted FAT chain\n");
+			ret = -1;
+			break;
+		}
+
+		if (block_map_append(&file->map, block_index) != 0 || get_fat_entry(ctx, block_index, &block_index) != 0){
+			ret = -1;
+			break;
+		}
 	}
 
-	if (open_files[fd] == NULL){
-		// fprintf(stderr, "Error in fs_lseek(): file with descriptor %d not open\n", fd);
-		return -1;
+	trim_fat_pages(ctx);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+
+	file->map.is_built = ret == 0;
+	return ret;
+}
+
+// used by the read paths instead of taking the file's lock shared directly
+// builds the file's block map first, with the lock held exclusively, if no read or write has needed it yet
+// the map cannot be dropped while a descriptor of the file is open, so once it is built it stays built
+// returns -1, without the lock, if the map could not be built
+int lock_file_shared(fs_ctx* ctx, struct File* file){
+	pthread_rwlock_rdlock(&file->lock);
+	if (file->map.is_built){
+		return 0;
 	}
+	pthread_rwlock_unlock(&file->lock);
 
-	if (offset > open_files[fd]->file->file_size){
-		// fprintf(stderr, "Error in fs_lseek(): specified offset too large (%ld vs %d)\n", offset, open_files[fd]->file->file_size);
+	pthread_rwlock_wrlock(&file->lock);
+	int ret = build_block_map(ctx, file);
+	pthread_rwlock_unlock(&file->lock);
+	if (ret != 0){
 		return -1;
 	}
 
-	open_files[fd]->offset = offset;
+	pthread_rwlock_rdlock(&file->lock);
 	return 0;
 }
 
-int fs_write(int fd, void *buf, size_t count)
-{
-	/* TODO: Phase 4 */
-	// printf("running fs_write\n");
+// helper function for allocate_blocks_in_fat() and preallocate_blocks()
+// links a run of blocks just taken from the bitmap after the last block of the file
+// the file's block map is built before any allocation, so the end of the chain is always the last entry in it
+// returns -1 if the run could not be linked whole, in which case the rest of it goes back to the bitmap
+// must be called with alloc_lock held
+int link_blocks(fs_ctx* ctx, struct File* file, const size_t run_start, const size_t run_len){
+	struct BlockMap* map = &file->map;
+
+	for (size_t i = 0; i < run_len; i++){
+		uint16_t new_index = run_start + i;
+
+		// make sure the map has room and both FAT blocks are paged in before the FAT is changed, so the two never disagree
+		if (fat_page(ctx, new_index) == NULL || (map->num_blocks > 0 && fat_page(ctx, map->blocks[map->num_blocks-1]) == NULL) ||
+		    block_map_append(map, new_index) != 0){
+			for (size_t j = i; j < run_len; j++){
+				bitmap_free(&ctx->free_blocks, run_start + j);
+			}
+			return -1;
+		}
 
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_write(): no disk is mounted\n");
-		return -1;
+		// if the file has no data blocks yet, the new block becomes its first block
+		// otherwise it is linked after the current last block
+		set_fat_entry(ctx, new_index, FAT_EOC);
+		if (map->num_blocks == 1){
+			file->first_index = new_index;
+			mark_entry_dirty(ctx, file);
+		} else {
+			set_fat_entry(ctx, map->blocks[map->num_blocks-2], new_index);
+		}
 	}
 
-	if (fd < 0 || fd >= FS_FILE_MAX_COUNT){
-		// fprintf(stderr, "Error in fs_write(): file descriptor %d out of bounds\n", fd);
-		return -1;
-	}
+	return 0;
+}
 
-	if (open_files[fd] == NULL){
-		// fprintf(stderr, "Error in fs_write(): file with descriptor %d not open\n", fd);
-		return -1;
-	}
+// helper function for fs_write()
+// the file's block map is built before any write, so the end of the chain is always the last entry in it
+int allocate_blocks_in_fat(fs_ctx* ctx, const int fd, const int num_target_blocks){
+	// printf("running allocate_blocks_in_fat\n");
 
-	if (buf == NULL){
-		// fprintf(stderr, "Error in fs_write(): buf is null\n");
-		return -1;
-	}
+	struct File* file = get_descriptor(ctx, fd)->file;
+	struct BlockMap* map = &file->map;
 
-	// if there is nothing to write, dont bother with anything
-	if (count == 0){
+	// nothing to do, so dont hold up other writers
+	if (map->num_blocks >= num_target_blocks){
 		return 0;
 	}
 
-	uint16_t offset = open_files[fd]->offset;
-
-	// used for more readable error checking
-	int op_success = 0;
+	pthread_mutex_lock(&ctx->alloc_lock);
 
-	int bytes_written = 0;
+	int ret = 0;
 
-	// the index of the first block we will write fully to
-	uint16_t full_block_start_index = offset / BLOCK_SIZE;
+	// extend the chain out to our desired length
+	// the bitmap hands out runs of contiguous free blocks, so this usually loops only once
+	while (map->num_blocks < num_target_blocks){
+		size_t run_start;
+		size_t run_len = alloc_free_blocks(ctx, num_target_blocks - map->num_blocks, &run_start);
+		if (run_len == 0){
+			// fprintf(stderr, "Error in allocate_blocks_in_fat(ctx, ): no free FAT entry for block %d\n", map->num_blocks);
+			ret = -1;
+			break;
+		}
 
-	// the number of blocks we will be writing to
-	// this includes blocks skipped by the offset
-	int num_target_blocks = find_num_target_blocks(offset, count);
-	// printf("write\noffset = %d\ncount = %ld\nnum target blocks = %d\n", offset, count, num_target_blocks);
-	
-	// if the file does not have enough blocks registered, allocate more of them
-	op_success = allocate_blocks_in_fat(fd, num_target_blocks);
-	if (op_success == -1){
-		// if this fails, then there are not enough blocks to complete the write
-		// however, the function will continue and write as much as it can
-		// fprintf(stderr, "Error in fs_write(): block allocation failed\n");
+		if (link_blocks(ctx, file, run_start, run_len) != 0){
+			ret = -1;
+			break;
+		}
 	}
 
-	// partial first block (if applicable)
-	if (offset % BLOCK_SIZE != 0){
-		/*
-		scenarios:
-			if offset < BLOCK_SIZE, then offset / BLOCK_SIZE = 0
-			find data block will return the index of the first block of the file (block 0)
-			this is what we want
+	trim_fat_pages(ctx);
+	pthread_mutex_unlock(&ctx->alloc_lock);
 
-			if offset >= BLOCK_SIZE, then offset / BLOCK_SIZE > 0 = n
-			find data block will return the index of the nth block of the file
-			eg if offset / BLOCK SIZE == 1, FDB will return the index of block 1
-			this is what we want
-			
-			offset % BLOCK SIZE does not matter for this part
-		*/
+	// printf("end of allocate_blocks_in_fat\nResults:\nnum data blocks = %d\nnum target blocks = %d\n", map->num_blocks, num_target_blocks);
+	return ret;
+}
 
-		uint16_t first_index = find_data_block(fd, offset / BLOCK_SIZE);
+// helper function for fs_read() and fs_write()
+// find the index in the FAT of the nth block in the file
+// returns FAT_EOC if the request was out of bounds
+uint16_t find_data_block(fs_ctx* ctx, const int fd, const int block_num){
+	struct BlockMap* map = &get_descriptor(ctx, fd)->file->map;
+	if (block_num < 0 || block_num >= map->num_blocks){
+		// fprintf(stderr, "Error in find_data_block(ctx, ): request is out of bounds for the file\n");
+		return FAT_EOC;
+	}
 
-		// first_index will be FAT_EOC if offset / BLOCK SIZE is out of bounds
-		// since we do not have room to write anything, we must end the write here
-		if (first_index == FAT_EOC){
-			return bytes_written;
-		}
+	return map->blocks[block_num];
+}
 
-		first_index += sb->data_start_index;
-		// printf("first index = %d\n", first_index);
-		uint8_t bounce_buffer[BLOCK_SIZE];
+// helper function for fs_read() and fs_write()
+// counts how many blocks of the file, starting from the nth, sit one after the other on disk
+// those blocks can be transferred together, with a single disk access
+// never counts more than max_blocks, or past the end of the file
+int find_run_length(fs_ctx* ctx, const int fd, const int block_num, const int max_blocks){
+	struct BlockMap* map = &get_descriptor(ctx, fd)->file->map;
+	int run_length = 1;
 
-		// bounce buffer contains the first block
-		op_success = block_read(first_index, bounce_buffer);
-		if (op_success == -1){
-			// fprintf(stderr, "Error in fs_write(): failed to read first block, at index %d\n", first_index);
-			return -1;
-		}
+	while (run_length < max_blocks && block_num+run_length < map->num_blocks &&
+		map->blocks[block_num+run_length] == map->blocks[block_num]+run_length){
+		run_length++;
+	}
 
-		// printf("whole block\n");
-		// printblock(bounce_buffer);
+	return run_length;
+}
 
-		// write_amount is the amount we are writing to this one block
-		// the old implementation was under the assumption offset is less than one block
-		// it was BLOCK_SIZE - offset, or the amount we are writing to the first block (partial block)
-		// this should be fixed by changing offset to offset % BLOCK_SIZE
-		uint16_t write_amount = 0;
-		if ((offset % BLOCK_SIZE) + count < BLOCK_SIZE){
-			write_amount = count;
-		} else {
-			write_amount = BLOCK_SIZE - (offset % BLOCK_SIZE);
-		}
+// helper function for fs_umount()
+// converts the root entries starting at first_entry into the flat byte array of a directory block
+void store_root_directory(fs_ctx* ctx, uint8_t* root_array, const size_t first_entry){
+	for (unsigned i = 0; i < FS_FILE_MAX_COUNT; i++){
+		store_root_entry(ctx->root[first_entry+i], root_array + ROOT_ENTRY_LEN*i);
+	}
+}
 
-		// printf("write amount = %d\n", write_amount);
-		// copy from the buffer starting from the offset
-		// copy enough to fill the block, or the entire buffer if it is smaller
-		memcpy(&bounce_buffer[offset % BLOCK_SIZE], buf, write_amount);
-		// printf("write: partial first block\nindex %d\nbounce buffer after memcpy\n", first_index);
-		// printblock(bounce_buffer);
-		op_success = block_write(first_index, bounce_buffer);
-		// uint8_t buffer[BLOCK_SIZE];
-		// block_read(first_index, buffer);
-		// printf("write result\n");
-		// printblock(buffer);
-		if (op_success == -1){
-			// fprintf(stderr, "Error in fs_write(): failed to write first block, at index %d\n", first_index);
-			return -1;
-		}
+// helper function for fs_umount()
+// converts the superblock back into a flat byte array, little endian like load_superblock() expects
+void store_superblock(fs_ctx* ctx, uint8_t* block){
+	memset(block, 0, BLOCK_SIZE);
+	memcpy(block, ctx->sb.signature, SUPERBLOCK_SIG_LEN);
+
+	uint16_t fields[] = {ctx->sb.num_blocks, ctx->sb.root_index, ctx->sb.data_start_index, ctx->sb.num_data_blocks};
+	uint8_t* ptr = block + SUPERBLOCK_SIG_LEN;
+	for (unsigned i = 0; i < sizeof(fields)/sizeof(fields[0]); i++){
+		*(ptr++) = fields[i] & 0xFF;
+		*(ptr++) = fields[i] >> 8;
+	}
+
+	*(ptr++) = ctx->sb.num_fat_blocks;
+
+	*(ptr++) = ctx->sb.dir_first_index & 0xFF;
+	*(ptr++) = ctx->sb.dir_first_index >> 8;
+	*(ptr++) = ctx->sb.dir_num_blocks & 0xFF;
+	*(ptr++) = ctx->sb.dir_num_blocks >> 8;
+	*(ptr++) = ctx->sb.journal_first_index & 0xFF;
+	*(ptr++) = ctx->sb.journal_first_index >> 8;
+	*(ptr++) = ctx->sb.journal_num_blocks & 0xFF;
+	*(ptr++) = ctx->sb.journal_num_blocks >> 8;
+}
 
-		bytes_written += write_amount;
-		full_block_start_index++;
+// helper function for fs_umount(), fs_sync() and fs_fsync()
+// writes back the FAT blocks, directory blocks and superblock that changed since they were last written
+// the caller keeps every other thread out of the context, so no entry changes while its block is written
+// returns -1 if a block could not be written, in which case it stays dirty for the next try
+int write_metadata(fs_ctx* ctx){
+	int ret = 0;
+
+	pthread_mutex_lock(&ctx->alloc_lock);
+
+	for (uint16_t i = 0; i < ctx->sb.num_fat_blocks; i++){
+		if (ctx->fat_dirty[i]){
+			if (disk_write(ctx->disk, i+1, ctx->fat_pages[i]) == 0){
+				ctx->fat_dirty[i] = false;
+			} else {
+				ret = -1;
+			}
+		}
 	}
-	
-	// full blocks (if applicable)
 
-	// num_full_blocks is the number of blocks we write to entirely
-	int num_full_blocks = num_target_blocks - (offset / BLOCK_SIZE) - (bytes_written != 0);
-	num_full_blocks -= (count - bytes_written) % BLOCK_SIZE != 0;
-	for (int i = full_block_start_index; i < num_full_blocks + full_block_start_index; i++){
-		uint16_t block_index = find_data_block(fd, i);
+	// to write to the root blocks, we need to convert each one into a flat byte array
+	uint8_t root_array[BLOCK_SIZE];
+	for (size_t b = 0; b < ctx->sb.dir_num_blocks; b++){
+		if (ctx->dir_dirty[b]){
+			store_root_directory(ctx, root_array, b * FS_FILE_MAX_COUNT);
+			if (disk_write(ctx->disk, ctx->dir_blocks[b], root_array) == 0){
+				ctx->dir_dirty[b] = false;
+			} else {
+				ret = -1;
+			}
+		}
+	}
 
-		// like for the partial block, if block_index == FAT_EOC, that means the request is out of bounds
-		// this either means the loop ran for too long, or we were not able to allocate enough data blocks for the whole write
-		// the first is an implementation error. lets hope it doesnt happen
-		if (block_index == FAT_EOC){
-			return bytes_written;
+	// the superblock only changes once the directory has grown or a journal is reserved
+	// otherwise it is left alone, so older tools can still mount the disk
+	if (ctx->sb_dirty){
+		store_superblock(ctx, root_array);
+		if (disk_write(ctx->disk, 0, root_array) == 0){
+			ctx->sb_dirty = false;
+		} else {
+			ret = -1;
 		}
+	}
 
-		block_index += sb->data_start_index;
+	// the FAT blocks written back are clean again, so they can be dropped
+	trim_fat_pages(ctx);
+
+	pthread_mutex_unlock(&ctx->alloc_lock);
+	return ret;
+}
+
+// helper function for recover_metadata()
+// applies the deltas recovered from the journal, in the order they were logged
+// the FAT and superblock deltas go in first, before anything is built from them, and the root entry deltas
+// once the entries are loaded, so each pass only applies one kind
+// nothing is logged again, the caller checkpoints once the disk is mounted
+// returns -1 if a delta is malformed
+int replay_deltas(fs_ctx* ctx, const uint8_t* deltas, const size_t len, const bool entries){
+	size_t i = 0;
+	while (i < len){
+		if (deltas[i] == DELTA_FAT && i + DELTA_FAT_LEN <= len){
+			uint16_t index = concatenate_two_bytes(deltas[i+1], deltas[i+2]);
+			if (index == 0 || index >= ctx->sb.num_data_blocks){
+				return -1;
+			}
+
+			if (!entries){
+				uint16_t* page = fat_page(ctx, index);
+				if (page == NULL){
+					return -1;
+				}
+				page[index % FAT_ENTRIES_PER_BLOCK] = concatenate_two_bytes(deltas[i+3], deltas[i+4]);
+				ctx->fat_dirty[index / FAT_ENTRIES_PER_BLOCK] = true;
+			}
+			i += DELTA_FAT_LEN;
+		} else if (deltas[i] == DELTA_SUPERBLOCK && i + DELTA_SUPERBLOCK_LEN <= len){
+			uint16_t dir_first_index = concatenate_two_bytes(deltas[i+1], deltas[i+2]);
+			uint16_t dir_num_blocks = concatenate_two_bytes(deltas[i+3], deltas[i+4]);
+			if (dir_num_blocks == 0 || (dir_num_blocks == 1) != (dir_first_index == 0) || dir_first_index >= ctx->sb.num_data_blocks){
+				return -1;
+			}
+
+			if (!entries){
+				ctx->sb.dir_first_index = dir_first_index;
+				ctx->sb.dir_num_blocks = dir_num_blocks;
+				ctx->sb_dirty = true;
+			}
+			i += DELTA_SUPERBLOCK_LEN;
+		} else if (deltas[i] == DELTA_ROOT && i + DELTA_ROOT_LEN <= len){
+			size_t entry = concatenate_four_bytes(deltas[i+1], deltas[i+2], deltas[i+3], deltas[i+4]);
+			if (entries){
+				if (entry >= ctx->num_root_entries || load_root_entry(ctx->root[entry], deltas+i+5) != 0){
+					return -1;
+				}
+				ctx->dir_dirty[entry / FS_FILE_MAX_COUNT] = true;
+			}
+			i += DELTA_ROOT_LEN;
+		} else {
+			// fprintf(stderr, "Error in replay_deltas(ctx): unknown delta %d\n", deltas[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// helper function for fs_mount()
+// opens the disk's journal if it has one, then loads the free blocks and the directory with the journal's changes on top
+// sets *recovered if the journal held any change, which only a checkpoint writes home
+int recover_metadata(fs_ctx* ctx, bool* recovered){
+	uint8_t* deltas = NULL;
+	size_t len = 0;
+
+	if (ctx->sb.journal_num_blocks != 0){
+		ctx->journal = journal_open(ctx->disk, ctx->sb.journal_first_index + ctx->sb.data_start_index, ctx->sb.journal_num_blocks, false);
+		if (ctx->journal == NULL || journal_recover(ctx->journal, &deltas, &len) != 0){
+			// fprintf(stderr, "Error in fs_mount(): could not read the journal\n");
+			return -1;
+		}
+	}
+
+	int ret = 0;
+	if (replay_deltas(ctx, deltas, len, false) != 0 || load_free_blocks(ctx) != 0 || load_directory(ctx) != 0 ||
+	    replay_deltas(ctx, deltas, len, true) != 0 || index_root_entries(ctx) != 0){
+		ret = -1;
+	}
+
+	free(deltas);
+	*recovered = len > 0;
+	return ret;
+}
+
+// helper function for fs_mount()
+// reserves a journal of num_blocks contiguous data blocks on a disk that has none
+// the blocks are chained in the FAT like a file, so the FAT alone accounts for every taken block
+int reserve_journal(fs_ctx* ctx, const size_t num_blocks){
+	// the whole FAT is scanned, so that any run of free blocks can be found
+	size_t first_index;
+	if (scan_whole_fat(ctx) != 0 || bitmap_alloc_run(&ctx->free_blocks, num_blocks, &first_index) != 0){
+		// fprintf(stderr, "Error in fs_mount(): no room for a journal of %zu blocks\n", num_blocks);
+		return -1;
+	}
+
+	for (size_t i = first_index; i < first_index + num_blocks; i++){
+		if (fat_page(ctx, i) == NULL){
+			return -1;
+		}
+		set_fat_entry(ctx, i, i+1 < first_index + num_blocks ? i+1 : FAT_EOC);
+	}
+	cache_discard(ctx->cache, first_index + ctx->sb.data_start_index, num_blocks);
+
+	// the journal is formatted before the superblock names it, so a crash in between leaves a disk without one
+	ctx->journal = journal_open(ctx->disk, first_index + ctx->sb.data_start_index, num_blocks, true);
+	if (ctx->journal == NULL){
+		return -1;
+	}
+
+	ctx->sb.journal_first_index = first_index;
+	ctx->sb.journal_num_blocks = num_blocks;
+	ctx->sb_dirty = true;
+
+	if (write_metadata(ctx) != 0 || disk_sync(ctx->disk) != 0){
+		return -1;
+	}
+
+	return 0;
+}
+
+// helper function for fs_delete(), fs_truncate() and fs_defrag()
+// waits for every async request in flight, before blocks of a file are freed or moved
+// requests only hold the disk block numbers they were given, so one still in flight would otherwise
+// move data to or from blocks that may already belong to another file, like a write queued before fs_close()
+void drain_async(fs_ctx* ctx){
+	aio_drain(ctx->aio);
+}
+
+// helper function for fs_sync(), fs_umount(), commit_journal() and the checkpoint thread
+// writes every change home, then empties the journal
+// the caller keeps every other thread out of the context
+int checkpoint(fs_ctx* ctx){
+	// async writes still in flight have to land first
+	aio_drain(ctx->aio);
+
+	// data blocks go out before the metadata that points to them
+	int ret = 0;
+	if (cache_flush(ctx->cache) != 0){
+		ret = -1;
+	}
+
+	// changes not in the journal yet go in first, so a crash before the reset replays exactly what was written home
+	// if they do not fit, that crash would replay older records over some of them
+	// commits start a checkpoint at half full, so this takes a burst of changes as big as half the journal
+	if (ctx->journal != NULL && journal_commit(ctx->journal, journal_pending(ctx->journal)) != 0){
+		// fprintf(stderr, "Error in checkpoint(ctx): could not commit the pending changes\n");
+	}
+
+	if (write_metadata(ctx) != 0 || disk_sync(ctx->disk) != 0){
+		ret = -1;
+	}
+
+	// the records are only dropped once what they hold is home
+	if (ret == 0 && ctx->journal != NULL && journal_reset(ctx->journal) != 0){
+		ret = -1;
+	}
+
+	return ret;
+}
+
+// runs in the background for as long as a disk with a journal is mounted
+// checkpoints whenever commit_journal() finds the journal half full, so commits rarely have to
+void* checkpoint_thread_run(void* arg){
+	fs_ctx* ctx = arg;
+
+	pthread_mutex_lock(&ctx->checkpoint_lock);
+	while (!ctx->checkpoint_stopping){
+		if (!ctx->checkpoint_requested){
+			pthread_cond_wait(&ctx->checkpoint_cond, &ctx->checkpoint_lock);
+			continue;
+		}
+		ctx->checkpoint_requested = false;
+		pthread_mutex_unlock(&ctx->checkpoint_lock);
+
+		pthread_rwlock_wrlock(&ctx->table_lock);
+		checkpoint(ctx);
+		pthread_rwlock_unlock(&ctx->table_lock);
+
+		pthread_mutex_lock(&ctx->checkpoint_lock);
+	}
+	pthread_mutex_unlock(&ctx->checkpoint_lock);
+
+	return NULL;
+}
+
+// helper function for fs_mount()
+int start_checkpoint_thread(fs_ctx* ctx){
+	if (pthread_mutex_init(&ctx->checkpoint_lock, NULL) != 0){
+		return -1;
+	}
+
+	if (pthread_cond_init(&ctx->checkpoint_cond, NULL) != 0){
+		pthread_mutex_destroy(&ctx->checkpoint_lock);
+		return -1;
+	}
+
+	if (pthread_create(&ctx->checkpoint_thread, NULL, checkpoint_thread_run, ctx) != 0){
+		pthread_cond_destroy(&ctx->checkpoint_cond);
+		pthread_mutex_destroy(&ctx->checkpoint_lock);
+		return -1;
+	}
+
+	ctx->checkpoint_started = true;
+	return 0;
+}
+
+// helper function for fs_umount() and destroy_ctx()
+// waits for a checkpoint in progress, then ends the thread
+void stop_checkpoint_thread(fs_ctx* ctx){
+	if (!ctx->checkpoint_started){
+		return;
+	}
+
+	pthread_mutex_lock(&ctx->checkpoint_lock);
+	ctx->checkpoint_stopping = true;
+	pthread_cond_signal(&ctx->checkpoint_cond);
+	pthread_mutex_unlock(&ctx->checkpoint_lock);
+
+	pthread_join(ctx->checkpoint_thread, NULL);
+	pthread_cond_destroy(&ctx->checkpoint_cond);
+	pthread_mutex_destroy(&ctx->checkpoint_lock);
+	ctx->checkpoint_started = false;
+}
+
+// helper function for fs_create(), fs_delete() and fs_fsync() on a disk with a journal
+// makes every change logged so far durable, in one record shared with every thread committing at the same time
+// must be called without table_lock, so that other threads can log their changes and join the commit
+int commit_journal(fs_ctx* ctx){
+	int ret = journal_commit(ctx->journal, journal_pending(ctx->journal));
+
+	// the changes did not fit, or the record could not be written, so they are written home instead
+	if (ret != 0){
+		pthread_rwlock_wrlock(&ctx->table_lock);
+		ret = checkpoint(ctx);
+		pthread_rwlock_unlock(&ctx->table_lock);
+	}
+
+	if (journal_needs_reset(ctx->journal)){
+		pthread_mutex_lock(&ctx->checkpoint_lock);
+		ctx->checkpoint_requested = true;
+		pthread_cond_signal(&ctx->checkpoint_cond);
+		pthread_mutex_unlock(&ctx->checkpoint_lock);
+	}
+
+	return ret;
+}
+
+// helper function for fs_mount_ctx() and fs_umount_ctx()
+// frees everything in the context that was allocated, and closes the disk if it was opened
+// nothing is written back, so a failed mount leaves the disk untouched
+void destroy_ctx(fs_ctx* ctx){
+	// the thread uses everything below, so it goes first
+	stop_checkpoint_thread(ctx);
+
+	for (size_t b = 0; b < ctx->num_root_entries / FS_FILE_MAX_COUNT; b++){
+		free_file_block(ctx, b);
+	}
+	free(ctx->fd_table);
+	free(ctx->file_blocks);
+	free(ctx->root);
+	free(ctx->dir_blocks);
+	free(ctx->name_buckets);
+	free(ctx->name_next);
+	bitmap_destroy(&ctx->free_entries);
+
+	// the engine waits for its requests, which still use the cache
+	aio_destroy(ctx->aio);
+	cache_destroy(ctx->cache);
+	journal_close(ctx->journal);
+	bitmap_destroy(&ctx->free_blocks);
+	for (size_t i = 0; ctx->fat_pages != NULL && i < ctx->sb.num_fat_blocks; i++){
+		free(ctx->fat_pages[i]);
+	}
+	free(ctx->fat_pages);
+	free(ctx->fat_last_use);
+	free(ctx->fat_dirty);
+	free(ctx->dir_dirty);
+
+	if (ctx->disk != NULL){
+		disk_close(ctx->disk);
+	}
+
+	pthread_rwlock_destroy(&ctx->table_lock);
+	pthread_mutex_destroy(&ctx->alloc_lock);
+	free(ctx);
+}
+
+// helper function for fs_mount_ctx()
+// opens the disk and loads the superblock, the directory and the journal into a new context
+// returns NULL if the disk cannot be mounted, and leaves it untouched
+fs_ctx* mount_disk(const char *diskname)
+{
+	// everything in the context starts out NULL, so destroy_ctx() knows what to free
+	fs_ctx* ctx = calloc(1, sizeof(fs_ctx));
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_mount(): unable to allocate context\n");
+		return NULL;
+	}
+
+	if (pthread_rwlock_init(&ctx->table_lock, NULL) != 0){
+		free(ctx);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&ctx->alloc_lock, NULL) != 0){
+		pthread_rwlock_destroy(&ctx->table_lock);
+		free(ctx);
+		return NULL;
+	}
+
+	// open the disk
+	if (load_disk(ctx, diskname) != 0){
+		// fprintf(stderr, "Error in fs_mount(): could not open disk\n");
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	// load the buffer containing the superblock data
+	uint8_t buffer[BLOCK_SIZE];
+	void* buf_ptr = &buffer;
+
+	int read_success = disk_read(ctx->disk, 0, buf_ptr);
+	if (read_success != 0){
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+
+	uint8_t* superblock_ptr = (uint8_t*)buf_ptr;
+
+	if (load_superblock(ctx, superblock_ptr) != 0){
+		destroy_ctx(ctx);
+		return NULL;
+	}
+	
+	if (load_fat(ctx) != 0){
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	// a journal left behind by a crash holds changes that never made it home
+	bool recovered = false;
+	if (recover_metadata(ctx, &recovered) != 0){
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	// the table starts out big enough for the usual FS_OPEN_MAX_COUNT files, and only grows past that if allowed to
+	ctx->fd_free_head = -1;
+	ctx->fd_max = open_max;
+	if (grow_fd_table(ctx, open_max < FS_OPEN_MAX_COUNT ? open_max : FS_OPEN_MAX_COUNT) != 0){
+		// fprintf(stderr, "Error in fs_mount(): unable to allocate the descriptor table\n");
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	// every context gets its own cache, so mounted disks do not evict each other's blocks
+	// a mapped disk already sits in memory, so caching it would only copy every block twice
+	size_t num_cache_blocks = cache_size;
+	if (disk_backend == FS_BACKEND_MMAP){
+		num_cache_blocks = 0;
+	}
+
+	ctx->cache = cache_create(ctx->disk, num_cache_blocks);
+	ctx->readahead_max = readahead_blocks;
+	if (ctx->cache == NULL){
+		// fprintf(stderr, "Error in fs_mount(): unable to allocate block cache\n");
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	ctx->aio = aio_create(ctx->cache);
+	if (ctx->aio == NULL){
+		// fprintf(stderr, "Error in fs_mount(): unable to allocate async engine\n");
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	if (ctx->journal == NULL && journal_blocks > 0 && reserve_journal(ctx, journal_blocks) != 0){
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	// the recovered changes are written home right away, so the journal starts out empty
+	if (recovered && checkpoint(ctx) != 0){
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	if (ctx->journal != NULL && start_checkpoint_thread(ctx) != 0){
+		destroy_ctx(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+fs_ctx* fs_mount_ctx(const char *diskname)
+{
+	TRACE_API(TRACE_ENTER, "fs_mount");
+	STATS_START(start);
+	fs_ctx* ctx = mount_disk(diskname);
+	STATS_END(FS_OP_MOUNT, start);
+	TRACE_API(TRACE_EXIT, "fs_mount");
+	return ctx;
+}
+
+// helper function for fs_umount_ctx()
+// writes every change back to the disk, then frees the context and closes the disk
+// returns -1 and leaves the disk mounted if files are still open or the changes cannot be written
+int unmount_disk(fs_ctx* ctx)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_unmount(): no disk is mounted\n");
+		return -1;
+	}
+
+	// nothing is torn down until the changes are home, so a failed fs_umount() leaves the disk mounted as it was
+	// the checkpoint thread waits for table_lock too, so nothing changes while the changes are written
+	pthread_rwlock_wrlock(&ctx->table_lock);
+	if (ctx->num_open_files > 0){
+		// fprintf(stderr, "Error in fs_unmount(): cannot unmount until all files are closed\n");
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	// write the data blocks, then the FAT blocks and root blocks that changed to save changes
+	int ret = checkpoint(ctx);
+	pthread_rwlock_unlock(&ctx->table_lock);
+	if (ret != 0){
+		// fprintf(stderr, "Error in fs_unmount(): could not write the changes to the disk\n");
+		return -1;
+	}
+
+	// free the memory we allocated in fs_mount() and close the disk
+	destroy_ctx(ctx);
+	return 0;
+}
+
+int fs_umount_ctx(fs_ctx* ctx)
+{
+	TRACE_API(TRACE_ENTER, "fs_umount");
+	STATS_START(start);
+	int ret = unmount_disk(ctx);
+	STATS_END(FS_OP_UMOUNT, start);
+	TRACE_API(TRACE_EXIT, "fs_umount");
+	return ret;
+}
+
+int fs_sync_ctx(fs_ctx* ctx)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_sync(): no disk is mounted\n");
+		return -1;
+	}
+
+	// holding the table exclusively waits out every read and write, and keeps new ones from starting
+	pthread_rwlock_wrlock(&ctx->table_lock);
+
+	int ret = checkpoint(ctx);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return ret;
+}
+
+int fs_fsync_ctx(fs_ctx* ctx, int fd)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_fsync(): no disk is mounted\n");
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_fsync(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	aio_drain(ctx->aio);
+
+	// only the file's own data blocks are written back, a run of contiguous blocks at a time
+	// the metadata is small and shared with other files, so all of it that changed goes out
+	// that way the FAT and the directory on disk always agree with each other
+	int ret = 0;
+	struct BlockMap* map = &desc->file->map;
+	for (int i = 0; i < map->num_blocks;){
+		int run_length = find_run_length(ctx, fd, i, map->num_blocks - i);
+		if (cache_flush_blocks(ctx->cache, map->blocks[i] + ctx->sb.data_start_index, run_length) != 0){
+			ret = -1;
+		}
+		i += run_length;
+	}
+
+	// with a journal, the metadata only needs a record, once the data it points to is on disk
+	if (ctx->journal != NULL){
+		if (disk_sync(ctx->disk) != 0){
+			ret = -1;
+		}
+		pthread_rwlock_unlock(&ctx->table_lock);
+
+		if (commit_journal(ctx) != 0){
+			ret = -1;
+		}
+		return ret;
+	}
+
+	if (write_metadata(ctx) != 0 || disk_sync(ctx->disk) != 0){
+		ret = -1;
+	}
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return ret;
+}
+
+int fs_set_cache_size(size_t num_blocks)
+{
+	if (default_ctx != NULL){
+		// fprintf(stderr, "Error in fs_set_cache_size(): cannot resize the cache of a mounted disk\n");
+		return -1;
+	}
+
+	cache_size = num_blocks;
+	return 0;
+}
+
+int fs_set_readahead(size_t max_blocks)
+{
+	if (default_ctx != NULL){
+		// fprintf(stderr, "Error in fs_set_readahead(): cannot change the readahead of a mounted disk\n");
+		return -1;
+	}
+
+	readahead_blocks = max_blocks;
+	return 0;
+}
+
+int fs_set_journal(size_t num_blocks)
+{
+	if (default_ctx != NULL){
+		// fprintf(stderr, "Error in fs_set_journal(): cannot change the journal of a mounted disk\n");
+		return -1;
+	}
+
+	if (num_blocks != 0 && (num_blocks < JOURNAL_MIN_BLOCKS || num_blocks > UINT16_MAX)){
+		// fprintf(stderr, "Error in fs_set_journal(): bad journal size %zu\n", num_blocks);
+		return -1;
+	}
+
+	journal_blocks = num_blocks;
+	return 0;
+}
+
+int fs_set_open_max(size_t max_open)
+{
+	if (default_ctx != NULL){
+		// fprintf(stderr, "Error in fs_set_open_max(): cannot resize the descriptor table of a mounted disk\n");
+		return -1;
+	}
+
+	// every slot has to fit in the low bits of a descriptor
+	if (max_open == 0 || max_open > FS_OPEN_MAX_LIMIT){
+		// fprintf(stderr, "Error in fs_set_open_max(): bad number of descriptors %zu\n", max_open);
+		return -1;
+	}
+
+	open_max = max_open;
+	return 0;
+}
+
+int fs_set_backend(int backend)
+{
+	if (default_ctx != NULL){
+		// fprintf(stderr, "Error in fs_set_backend(): cannot change the backend of a mounted disk\n");
+		return -1;
+	}
+
+	if (backend != FS_BACKEND_PREAD && backend != FS_BACKEND_MMAP){
+		// fprintf(stderr, "Error in fs_set_backend(): unknown backend %d\n", backend);
+		return -1;
+	}
+
+	disk_backend = backend;
+	return 0;
+}
+
+int fs_cache_stats_ctx(fs_ctx* ctx, struct fs_cache_stats* stats)
+{
+	if (ctx == NULL || stats == NULL){
+		// fprintf(stderr, "Error in fs_cache_stats(): no disk is mounted\n");
+		return -1;
+	}
+
+	struct cache_stats counters;
+	cache_get_stats(ctx->cache, &counters);
+	stats->hits = counters.hits;
+	stats->misses = counters.misses;
+	stats->evictions = counters.evictions;
+	stats->writebacks = counters.writebacks;
+	stats->prefetches = counters.prefetches;
+	return 0;
+}
+
+int fs_info_ctx(fs_ctx* ctx)
+{
+	/* TODO: Phase 1 */
+	// printf("running info\n");
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_info(): no disk is mounted\n");
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	printf("FS Info:\n");
+	printf("total_blk_count=%d\n", disk_count(ctx->disk));
+	printf("fat_blk_count=%d\n", ctx->sb.num_fat_blocks);
+	printf("rdir_blk=%d\n", ctx->sb.root_index);
+	printf("data_blk=%d\n", ctx->sb.data_start_index);
+	printf("data_blk_count=%d\n", ctx->sb.num_data_blocks);
+
+	// free fat entries means the number of entries in the FAT that equal 0
+	// in other words, how many data blocks do not belong to a file
+	// the free-space bitmap already keeps count of them, once the whole FAT has been scanned
+	pthread_mutex_lock(&ctx->alloc_lock);
+	if (scan_whole_fat(ctx) != 0){
+		pthread_mutex_unlock(&ctx->alloc_lock);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+	int free_fat_entries = ctx->free_blocks.num_free;
+	pthread_mutex_unlock(&ctx->alloc_lock);
+
+	printf("fat_free_ratio=%d/%d\n", free_fat_entries, ctx->sb.num_data_blocks);
+
+	// free root entries means the number of possible files that have not been created
+	// like the FAT, the empty entries are already counted by a bitmap
+	// the directory grows when it fills up, so this is only how many fit without growing it
+	int free_root_entries = ctx->free_entries.num_free;
+
+	printf("rdir_free_ratio=%d/%zu\n", free_root_entries, ctx->num_root_entries);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return 0;
+}
+
+// helper function for fs_create_ctx()
+// puts the new empty file in the lowest empty root entry, growing the directory if there is none
+int create_file(fs_ctx* ctx, const char *filename)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_create(): no disk is mounted\n");
+		return -1;
+	}
+	if (is_filename_invalid(filename)){
+		// fprintf(stderr, "Error in fs_create(): invalid file name\n");
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&ctx->table_lock);
+
+	if (find_matching_filename(ctx, filename) != -1){
+		// fprintf(stderr, "Error in fs_create(): file named %s already exists\n", filename);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	// find new entry
+	int empty_index = find_empty_root_entry(ctx);
+	if (empty_index == -1){
+		// fprintf(stderr, "Error in fs_create(): unable to find empty index\n");
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+	struct File* new_file = ctx->root[empty_index];
+
+	// since new_file->filename is an array of uint8_t,
+	// and filename is a char*,
+	// we must fill up the array byte-by-byte instead of all at once
+	for (unsigned i = 0; i < strlen(filename); i++){
+		new_file->filename[i] = filename[i];
+	}
+
+	new_file->filename[strlen(filename)] = '\0';
+	name_index_add(ctx, empty_index);
+
+	// reset the other members of the struct
+	new_file->file_size = 0;
+	new_file->first_index = FAT_EOC;
+
+	pthread_mutex_lock(&ctx->alloc_lock);
+	mark_entry_dirty(ctx, new_file);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+
+	// with a journal, the file is durable once fs_create() returns
+	if (ctx->journal != NULL){
+		return commit_journal(ctx);
+	}
+	return 0;
+}
+
+int fs_create_ctx(fs_ctx* ctx, const char *filename)
+{
+	TRACE_API(TRACE_ENTER, "fs_create");
+	int ret = create_file(ctx, filename);
+	TRACE_API(TRACE_EXIT, "fs_create");
+	return ret;
+}
+
+// helper function for fs_delete_ctx()
+// frees the file's data blocks once no async request can still use them, and empties its root entry
+int delete_file(fs_ctx* ctx, const char *filename)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_delete(): no disk is mounted\n");
+		return -1;
+	}
+
+	if (is_filename_invalid(filename)){
+		// fprintf(stderr, "Error in fs_delete(): invalid file name\n");
+		return -1;
+	}
+
+	// no descriptor can be opened or used while the table is locked, so the file is ours alone
+	pthread_rwlock_wrlock(&ctx->table_lock);
+
+	int matching_file_index = find_matching_filename(ctx, filename);
+	if (matching_file_index == -1){
+		// fprintf(stderr, "Error in fs_create(): file named %s does not exist\n", filename);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	struct File* old_file = ctx->root[matching_file_index];
+
+	// check if the requested file is opened, and reject it if it is
+	if (old_file->num_open > 0){
+		// fprintf(stderr, "Error in fs_delete(): open files cannot be deleted\n");
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	if (old_file->first_index != FAT_EOC){
+		drain_async(ctx);
+	}
+
+	// free all of the data blocks in the FAT the file was using
+	// the next index has to be read before the current entry is cleared
+	pthread_mutex_lock(&ctx->alloc_lock);
+	// if a FAT block cannot be read, the rest of the chain is left allocated, but the file is still deleted
+	// like in release_tail(), cached data of the freed blocks is dropped rather than written back over their next owner
+	uint16_t block_index = old_file->first_index;
+	uint16_t next_block_index;
+	while (block_index != FAT_EOC && get_fat_entry(ctx, block_index, &next_block_index) == 0){
+		set_fat_entry(ctx, block_index, 0);
+		release_block(ctx, block_index);
+		cache_discard(ctx->cache, block_index + ctx->sb.data_start_index, 1);
+		block_index = next_block_index;
+	}
+	trim_fat_pages(ctx);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+
+	// the chain no longer exists, so neither should its map
+	free_block_map(old_file);
+
+	// initialize the members of the file to be an empty entry
+	name_index_remove(ctx, matching_file_index);
+	old_file->filename[0] = '\0';
+	old_file->file_size = 0;
+	old_file->first_index = FAT_EOC;
+	bitmap_free(&ctx->free_entries, matching_file_index);
+
+	pthread_mutex_lock(&ctx->alloc_lock);
+	mark_entry_dirty(ctx, old_file);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+
+	// with a journal, the file is gone for good once fs_delete() returns
+	if (ctx->journal != NULL){
+		return commit_journal(ctx);
+	}
+	return 0;
+}
+
+int fs_delete_ctx(fs_ctx* ctx, const char *filename)
+{
+	TRACE_API(TRACE_ENTER, "fs_delete");
+	STATS_START(start);
+	int ret = delete_file(ctx, filename);
+	STATS_END(FS_OP_DELETE, start);
+	TRACE_API(TRACE_EXIT, "fs_delete");
+	return ret;
+}
+
+int fs_ls_ctx(fs_ctx* ctx)
+{
+	/* TODO: Phase 2 */
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_ls(): no disk is mounted\n");
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	printf("FS Ls:\n");
+	for (size_t i = 0; i < ctx->num_root_entries; i++){
+		struct File* file = ctx->root[i];
+		if (file->filename[0] != 0){
+			// printf("File #%d\n", i);
+			// printf("Name: %s\n", ctx->root[i]->filename);
+			// printf("Size: %d\n", ctx->root[i]->file_size);
+			// printf("First index: %d\n", ctx->root[i]->first_index);
+			// the file may be growing, so its size has to be read under its lock
+			pthread_rwlock_rdlock(&file->lock);
+			printf("file: %s, size: %d, data_blk: %d\n", file->filename, file->file_size, file->first_index);
+			pthread_rwlock_unlock(&file->lock);
+		}
+	}
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return 0;
+}
+
+// this function is very simple, since most of the heavy lifting is done in helper functions
+// helper function for fs_open_ctx()
+// looks the file up in the hash index and gives it a free slot of the descriptor table
+int open_file(fs_ctx* ctx, const char *filename)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_open(): no disk is mounted\n");
+		return -1;
+	}
+
+	if (is_filename_invalid(filename)){
+		// fprintf(stderr, "Error in fs_create(): invalid file name\n");
+		return -1;
+	}
+
+	// the descriptor table changes, so nobody else may use it meanwhile
+	pthread_rwlock_wrlock(&ctx->table_lock);
+
+	int file_index = find_matching_filename(ctx, filename);
+	if (file_index == -1){
+		// fprintf(stderr, "Error in fs_open(): file %s not found\n", filename);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	int fd = add_file_to_fd_array(ctx, ctx->root[file_index]);
+	pthread_rwlock_unlock(&ctx->table_lock);
+	if (fd == -1){
+		// fprintf(stderr, "Error in fs_open(): max number of files already open\n");
+		return -1;
+	}
+
+	return fd;
+}
+
+int fs_open_ctx(fs_ctx* ctx, const char *filename)
+{
+	TRACE_API(TRACE_ENTER, "fs_open");
+	STATS_START(start);
+	int fd = open_file(ctx, filename);
+	STATS_END(FS_OP_OPEN, start);
+	TRACE_API(TRACE_EXIT, "fs_open");
+	return fd;
+}
+
+// helper function for fs_close_ctx()
+// puts the descriptor's slot back on the free list, under a new generation so fd stops working
+int close_file(fs_ctx* ctx, int fd)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_close(): no disk is mounted\n");
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_close(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	// the descriptor's slot in the FD table is free again, under a new generation so fd stops working
+	desc->file->num_open--;
+	desc->file = NULL;
+	desc->generation = (desc->generation + 1) & FD_GENERATION_MASK;
+	desc->next_free = ctx->fd_free_head;
+	ctx->fd_free_head = fd & FD_SLOT_MASK;
+	ctx->num_open_files--;
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return 0;
+}
+
+int fs_close_ctx(fs_ctx* ctx, int fd)
+{
+	TRACE_API(TRACE_ENTER, "fs_close");
+	int ret = close_file(ctx, fd);
+	TRACE_API(TRACE_EXIT, "fs_close");
+	return ret;
+}
+
+int fs_stat_ctx(fs_ctx* ctx, int fd)
+{
+	/* TODO: Phase 3 */
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_stat(): no disk is mounted\n");
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_stat(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	struct File* file = desc->file;
+	pthread_rwlock_rdlock(&file->lock);
+	int file_size = file->file_size;
+	pthread_rwlock_unlock(&file->lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return file_size;
+}
+
+int fs_lseek_ctx(fs_ctx* ctx, int fd, size_t offset)
+{
+	/* TODO: Phase 3 */
+	// printf("running lseek\n");
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_lseek(): no disk is mounted\n");
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_lseek(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	struct File* file = desc->file;
+	pthread_rwlock_rdlock(&file->lock);
+	int ret = 0;
+	if (offset > file->file_size){
+		// fprintf(stderr, "Error in fs_lseek(): specified offset too large (%ld vs %d)\n", offset, file->file_size);
+		ret = -1;
+	} else {
+		desc->offset = offset;
+	}
+	pthread_rwlock_unlock(&file->lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return ret;
+}
+
+// helper function for truncate_file() and fs_fallocate()
+// cuts the file's chain after its first num_blocks blocks, and gives the rest back to the allocator
+// only the blocks given back are walked, through the block map, so the cost is the number of blocks freed
+// returns -1 if the FAT block of the new last block cannot be read, in which case nothing changes
+// must be called with alloc_lock held, and the file locked exclusively
+int release_tail(fs_ctx* ctx, struct File* file, const int num_blocks){
+	struct BlockMap* map = &file->map;
+	if (num_blocks >= map->num_blocks){
+		return 0;
+	}
+
+	// the new last block needs its FAT block in memory to be marked as the end of the chain
+	if (num_blocks > 0 && fat_page(ctx, map->blocks[num_blocks-1]) == NULL){
+		return -1;
+	}
+
+	if (num_blocks == 0){
+		file->first_index = FAT_EOC;
+		mark_entry_dirty(ctx, file);
+	} else {
+		set_fat_entry(ctx, map->blocks[num_blocks-1], FAT_EOC);
+	}
+
+	// the tail goes back to the allocator, and its cached data is dropped rather than written back
+	// if a FAT block cannot be read, the rest of the tail is left allocated, but the file is still cut
+	for (int i = num_blocks; i < map->num_blocks; i++){
+		if (fat_page(ctx, map->blocks[i]) == NULL){
+			break;
+		}
+		set_fat_entry(ctx, map->blocks[i], 0);
+		release_block(ctx, map->blocks[i]);
+		cache_discard(ctx->cache, map->blocks[i] + ctx->sb.data_start_index, 1);
+	}
+	map->num_blocks = num_blocks;
+
+	return 0;
+}
+
+// helper function for fs_truncate() and fs_ftruncate()
+// cuts the file down to size bytes, with the file locked exclusively
+// blocks preallocated by fs_fallocate() past the new end go too, even if the size does not change
+// descriptors whose offset is now past the end are clamped the next time they read or write
+int truncate_file(fs_ctx* ctx, struct File* file, const size_t size){
+	if (size > file->file_size){
+		// fprintf(stderr, "Error in fs_truncate(): files can only be shrunk (%zu vs %d)\n", size, file->file_size);
+		return -1;
+	}
+
+	if (build_block_map(ctx, file) != 0){
+		return -1;
+	}
+
+	int num_blocks = find_num_target_blocks(0, size);
+	if (size == file->file_size && num_blocks >= file->map.num_blocks){
+		return 0;
+	}
+
+	if (num_blocks < file->map.num_blocks){
+		drain_async(ctx);
+	}
+
+	pthread_mutex_lock(&ctx->alloc_lock);
+
+	int ret = release_tail(ctx, file, num_blocks);
+	if (ret == 0 && size != file->file_size){
+		file->file_size = size;
+		mark_entry_dirty(ctx, file);
+	}
+
+	trim_fat_pages(ctx);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+	return ret;
+}
+
+int fs_truncate_ctx(fs_ctx* ctx, const char *filename, size_t size)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_truncate(): no disk is mounted\n");
+		return -1;
+	}
+
+	if (is_filename_invalid(filename)){
+		// fprintf(stderr, "Error in fs_truncate(): invalid file name\n");
+		return -1;
+	}
+
+	// holding the table shared keeps the file from being deleted, and the file's own lock keeps out its readers and writers
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	int file_index = find_matching_filename(ctx, filename);
+	if (file_index == -1){
+		// fprintf(stderr, "Error in fs_truncate(): file %s not found\n", filename);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	struct File* file = ctx->root[file_index];
+	pthread_rwlock_wrlock(&file->lock);
+	int ret = truncate_file(ctx, file, size);
+	pthread_rwlock_unlock(&file->lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+
+	// with a journal, the file is cut for good once fs_truncate() returns, like it is gone once fs_delete() does
+	if (ret == 0 && ctx->journal != NULL){
+		return commit_journal(ctx);
+	}
+	return ret;
+}
+
+int fs_ftruncate_ctx(fs_ctx* ctx, int fd, size_t size)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_ftruncate(): no disk is mounted\n");
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_ftruncate(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	struct File* file = desc->file;
+	pthread_rwlock_wrlock(&file->lock);
+	int ret = truncate_file(ctx, file, size);
+	pthread_rwlock_unlock(&file->lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+
+	if (ret == 0 && ctx->journal != NULL){
+		return commit_journal(ctx);
+	}
+	return ret;
+}
+
+// helper function for fs_fallocate()
+// gives the file num_target_blocks blocks, as one run of contiguous free blocks if there is one that long
+// otherwise it takes the longest runs it can, halving the length it asks for whenever no run is that long
+// either every block is linked, or none is
+// must be called with the file locked exclusively, and its block map built
+int preallocate_blocks(fs_ctx* ctx, struct File* file, const int num_target_blocks){
+	struct BlockMap* map = &file->map;
+	int old_num_blocks = map->num_blocks;
+
+	pthread_mutex_lock(&ctx->alloc_lock);
+
+	int ret = 0;
+	size_t run_len = num_target_blocks - map->num_blocks;
+	while (map->num_blocks < num_target_blocks){
+		if (run_len > (size_t)(num_target_blocks - map->num_blocks)){
+			run_len = num_target_blocks - map->num_blocks;
+		}
+
+		size_t run_start;
+		if (alloc_free_run(ctx, run_len, &run_start) != 0){
+			if (run_len == 1){
+				// fprintf(stderr, "Error in fs_fallocate(): no free FAT entry for block %d\n", map->num_blocks);
+				ret = -1;
+				break;
+			}
+			run_len /= 2;
+			continue;
+		}
+
+		if (link_blocks(ctx, file, run_start, run_len) != 0){
+			ret = -1;
+			break;
+		}
+	}
+
+	// a partial reservation is no use to the caller, so the disk is left as it was
+	if (ret != 0){
+		release_tail(ctx, file, old_num_blocks);
+	}
+
+	trim_fat_pages(ctx);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+	return ret;
+}
+
+int fs_fallocate_ctx(fs_ctx* ctx, int fd, size_t size)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_fallocate(): no disk is mounted\n");
+		return -1;
+	}
+
+	// the block map counts its blocks in 16 bits, and so does the FAT
+	if (size > (size_t)UINT16_MAX * BLOCK_SIZE){
+		// fprintf(stderr, "Error in fs_fallocate(): %zu bytes can never fit\n", size);
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_fallocate(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	// the new blocks are linked after the last one, like a write would
+	struct File* file = desc->file;
+	pthread_rwlock_wrlock(&file->lock);
+	int ret = build_block_map(ctx, file);
+	if (ret == 0){
+		ret = preallocate_blocks(ctx, file, find_num_target_blocks(0, size));
+	}
+	pthread_rwlock_unlock(&file->lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return ret;
+}
+
+// helper function for fs_frag_stats(), fs_defrag() and fs_analyze()
+// counts the runs of contiguous blocks the file's block map is split into
+int count_extents(const struct BlockMap* map){
+	int extents = 0;
+	for (int i = 0; i < map->num_blocks; i++){
+		if (i == 0 || map->blocks[i] != map->blocks[i-1] + 1){
+			extents++;
+		}
+	}
+
+	return extents;
+}
+
+int fs_frag_stats_ctx(fs_ctx* ctx, struct fs_frag_stats* stats)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_frag_stats(): no disk is mounted\n");
+		return -1;
+	}
+
+	if (stats == NULL){
+		return -1;
+	}
+
+	memset(stats, 0, sizeof(struct fs_frag_stats));
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	int ret = 0;
+	for (size_t i = 0; i < ctx->num_root_entries; i++){
+		struct File* file = ctx->root[i];
+		if (file->filename[0] == 0){
+			continue;
+		}
+
+		if (lock_file_shared(ctx, file) != 0){
+			ret = -1;
+			break;
+		}
+		int extents = count_extents(&file->map);
+		stats->files++;
+		stats->blocks += file->map.num_blocks;
+		stats->extents += extents;
+		if (extents > 1){
+			stats->fragmented_files++;
+		}
+		pthread_rwlock_unlock(&file->lock);
+	}
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return ret;
+}
+
+// blocks copied at a time by relocate_file()
+#define DEFRAG_COPY_BLOCKS 64
+
+// a file picked by fs_defrag(), with how many extents it had when it was picked
+struct DefragCandidate{
+	size_t entry;
+	int extents;
+};
+
+// helper function for fs_defrag()
+// the most fragmented files come first, and files as fragmented as each other stay in directory order
+int compare_candidates(const void* a, const void* b){
+	const struct DefragCandidate* c1 = a;
+	const struct DefragCandidate* c2 = b;
+	if (c1->extents != c2->extents){
+		return c1->extents > c2->extents ? -1 : 1;
+	}
+	return c1->entry < c2->entry ? -1 : c1->entry > c2->entry;
+}
+
+// helper function for fs_defrag()
+// copies every block of the file to a run of contiguous free blocks, links the run in place of the old chain, and frees the old blocks
+// the data goes through the cache, so blocks written but not written back yet are copied too
+// returns the number of blocks moved, 0 if there is no free run long enough, or -1 if a block could not be read or written, in which case nothing changes
+// must be called with the file locked exclusively, its block map built, and no async request in flight
+int relocate_file(fs_ctx* ctx, struct File* file, uint8_t* buf){
+	struct BlockMap* map = &file->map;
+	size_t run_start;
+
+	pthread_mutex_lock(&ctx->alloc_lock);
+	int ret = alloc_free_run(ctx, map->num_blocks, &run_start);
+	trim_fat_pages(ctx);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+	if (ret != 0){
+		return 0;
+	}
+
+	// the old blocks are read a run of contiguous blocks at a time, and the new ones written the same way
+	for (int i = 0; i < map->num_blocks && ret == 0;){
+		int run_length = 1;
+		while (i + run_length < map->num_blocks && run_length < DEFRAG_COPY_BLOCKS && map->blocks[i+run_length] == map->blocks[i] + run_length){
+			run_length++;
+		}
+
+		if (cache_read_blocks(ctx->cache, map->blocks[i] + ctx->sb.data_start_index, run_length, buf) != 0 ||
+		    cache_write_blocks(ctx->cache, run_start + i + ctx->sb.data_start_index, run_length, buf) != 0){
+			ret = -1;
+		}
+		i += run_length;
+	}
+
+	// with a journal, the new chain may be durable as soon as it is logged, so the data it points to has to be on disk first
+	if (ret == 0 && ctx->journal != NULL){
+		if (cache_flush_blocks(ctx->cache, run_start + ctx->sb.data_start_index, map->num_blocks) != 0 || disk_sync(ctx->disk) != 0){
+			ret = -1;
+		}
+	}
+
+	pthread_mutex_lock(&ctx->alloc_lock);
+
+	// every FAT block about to change is paged in first, so the chain is swapped whole or not at all
+	for (int i = 0; i < map->num_blocks && ret == 0; i++){
+		if (fat_page(ctx, run_start + i) == NULL || fat_page(ctx, map->blocks[i]) == NULL){
+			ret = -1;
+		}
+	}
+
+	if (ret != 0){
+		cache_discard(ctx->cache, run_start + ctx->sb.data_start_index, map->num_blocks);
+		for (int i = 0; i < map->num_blocks; i++){
+			bitmap_free(&ctx->free_blocks, run_start + i);
+		}
+		trim_fat_pages(ctx);
+		pthread_mutex_unlock(&ctx->alloc_lock);
+		return -1;
+	}
+
+	for (int i = 0; i < map->num_blocks; i++){
+		set_fat_entry(ctx, run_start + i, i == map->num_blocks - 1 ? FAT_EOC : run_start + i + 1);
+	}
+	file->first_index = run_start;
+	mark_entry_dirty(ctx, file);
+
+	for (int i = 0; i < map->num_blocks; i++){
+		set_fat_entry(ctx, map->blocks[i], 0);
+		release_block(ctx, map->blocks[i]);
+		cache_discard(ctx->cache, map->blocks[i] + ctx->sb.data_start_index, 1);
+		map->blocks[i] = run_start + i;
+	}
+
+	trim_fat_pages(ctx);
+	pthread_mutex_unlock(&ctx->alloc_lock);
+	return map->num_blocks;
+}
+
+int fs_defrag_ctx(fs_ctx* ctx, size_t max_blocks)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_defrag(): no disk is mounted\n");
+		return -1;
+	}
+
+	// holding the table shared keeps files from being created or deleted, while each one is only locked while it moves
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	struct DefragCandidate* candidates = malloc(ctx->num_root_entries * sizeof(struct DefragCandidate));
+	uint8_t* buf = malloc(DEFRAG_COPY_BLOCKS * BLOCK_SIZE);
+	if (candidates == NULL || buf == NULL){
+		// fprintf(stderr, "Error in fs_defrag(): could not allocate buffers\n");
+		free(candidates);
+		free(buf);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	int ret = 0;
+	size_t num_candidates = 0;
+	for (size_t i = 0; i < ctx->num_root_entries; i++){
+		struct File* file = ctx->root[i];
+		if (file->filename[0] == 0){
+			continue;
+		}
+
+		if (lock_file_shared(ctx, file) != 0){
+			ret = -1;
+			break;
+		}
+		int extents = count_extents(&file->map);
+		pthread_rwlock_unlock(&file->lock);
+
+		if (extents > 1){
+			candidates[num_candidates].entry = i;
+			candidates[num_candidates].extents = extents;
+			num_candidates++;
+		}
+	}
+
+	qsort(candidates, num_candidates, sizeof(struct DefragCandidate), compare_candidates);
+
+	size_t moved = 0;
+	for (size_t c = 0; c < num_candidates && ret == 0 && (moved == 0 || moved < max_blocks); c++){
+		struct File* file = ctx->root[candidates[c].entry];
+		pthread_rwlock_wrlock(&file->lock);
+
+		// the file may have changed since it was looked at, and the first file moved may go over the budget
+		int r = 0;
+		if (build_block_map(ctx, file) != 0){
+			r = -1;
+		} else if (count_extents(&file->map) > 1 && (moved == 0 || moved + file->map.num_blocks <= max_blocks)){
+			drain_async(ctx);
+			r = relocate_file(ctx, file, buf);
+		}
+
+		pthread_rwlock_unlock(&file->lock);
+
+		if (r < 0){
+			ret = -1;
+		} else {
+			moved += r;
+		}
+	}
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	free(candidates);
+	free(buf);
+
+	// with a journal, the files are in their new place for good once fs_defrag() returns
+	if (moved > 0 && ctx->journal != NULL && commit_journal(ctx) != 0){
+		ret = -1;
+	}
+
+	return ret == 0 ? (int)moved : -1;
+}
+
+// helper function for fs_analyze()
+// counts the places where the file's chain goes back to a lower block, which a sequential read has to seek back for
+int count_inversions(const struct BlockMap* map){
+	int inversions = 0;
+	for (int i = 1; i < map->num_blocks; i++){
+		if (map->blocks[i] < map->blocks[i-1]){
+			inversions++;
+		}
+	}
+
+	return inversions;
+}
+
+// helper function for fs_analyze()
+// walks the free-space bitmap once, counting the runs of free blocks by length
+// must be called with alloc_lock held, once the whole FAT has been scanned
+void analyze_free_runs(fs_ctx* ctx, struct fs_layout* layout){
+	size_t run = 0;
+	for (size_t i = 0; i <= ctx->sb.num_data_blocks; i++){
+		if (i < ctx->sb.num_data_blocks && bitmap_is_free(&ctx->free_blocks, i)){
+			run++;
+			continue;
+		}
+		if (run == 0){
+			continue;
+		}
+
+		// the FAT has at most 65535 entries, so no run is too long for the last bucket
+		int bucket = 0;
+		while (bucket < FS_FREE_RUN_BUCKETS - 1 && (run >> (bucket + 1)) != 0){
+			bucket++;
+		}
+		layout->free_run_hist[bucket]++;
+		layout->free_runs++;
+		layout->free_blocks += run;
+		if (run > layout->largest_free_run){
+			layout->largest_free_run = run;
+		}
+		run = 0;
+	}
+}
+
+int fs_analyze_ctx(fs_ctx* ctx, struct fs_layout* layout, struct fs_file_layout* files, size_t max_files)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_analyze(): no disk is mounted\n");
+		return -1;
+	}
+
+	if (layout == NULL){
+		return -1;
+	}
+
+	memset(layout, 0, sizeof(struct fs_layout));
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	for (size_t i = 0; i < ctx->num_root_entries; i++){
+		struct File* file = ctx->root[i];
+		if (file->filename[0] == 0){
+			continue;
+		}
+
+		if (lock_file_shared(ctx, file) != 0){
+			pthread_rwlock_unlock(&ctx->table_lock);
+			return -1;
+		}
+		int extents = count_extents(&file->map);
+		int inversions = count_inversions(&file->map);
+		if (files != NULL && layout->files < max_files){
+			struct fs_file_layout* f = &files[layout->files];
+			memcpy(f->filename, file->filename, FS_FILENAME_LEN);
+			f->size = file->file_size;
+			f->blocks = file->map.num_blocks;
+			f->extents = extents;
+			f->inversions = inversions;
+		}
+		layout->blocks += file->map.num_blocks;
+		pthread_rwlock_unlock(&file->lock);
+
+		layout->files++;
+		layout->extents += extents;
+		layout->inversions += inversions;
+		if (extents > 1){
+			layout->fragmented_files++;
+		}
+	}
+
+	// like fs_info(), this needs every free block to be known
+	pthread_mutex_lock(&ctx->alloc_lock);
+	int ret = scan_whole_fat(ctx);
+	if (ret == 0){
+		analyze_free_runs(ctx, layout);
+	}
+	pthread_mutex_unlock(&ctx->alloc_lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return ret == 0 ? (int)layout->files : -1;
+}
+
+// helper function for fs_write()
+// does the actual write, once fs_write() has checked the descriptor and locked the file
+int write_to_file(fs_ctx* ctx, int fd, void *buf, size_t count){
+	// if there is nothing to write, dont bother with anything
+	if (count == 0){
+		return 0;
+	}
+
+	// the file may have been truncated under the descriptor, which then writes at the new end, leaving no gap
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc->offset > desc->file->file_size){
+		desc->offset = desc->file->file_size;
+	}
+	uint32_t offset = desc->offset;
+
+	// a file can never be larger than file_size can count, nor a write larger than we can return
+	if (count > UINT32_MAX - offset){
+		count = UINT32_MAX - offset;
+	}
+	if (count > INT_MAX){
+		count = INT_MAX;
+	}
+
+	// used for more readable error checking
+	int op_success = 0;
+
+	int bytes_written = 0;
+
+	// the index of the first block we will write fully to
+	int full_block_start_index = offset / BLOCK_SIZE;
+
+	// the number of blocks we will be writing to
+	// this includes blocks skipped by the offset
+	int num_target_blocks = find_num_target_blocks(offset, count);
+	// printf("write\noffset = %d\ncount = %ld\nnum target blocks = %d\n", offset, count, num_target_blocks);
+	
+	// if the file does not have enough blocks registered, allocate more of them
+	op_success = allocate_blocks_in_fat(ctx, fd, num_target_blocks);
+	if (op_success == -1){
+		// if this fails, then there are not enough blocks to complete the write
+		// however, the function will continue and write as much as it can
+		// fprintf(stderr, "Error in fs_write(): block allocation failed\n");
+	}
+
+	// partial first block (if applicable)
+	if (offset % BLOCK_SIZE != 0){
+		/*
+		scenarios:
+			if offset < BLOCK_SIZE, then offset / BLOCK_SIZE = 0
+			find data block will return the index of the first block of the file (block 0)
+			this is what we want
+
+			if offset >= BLOCK_SIZE, then offset / BLOCK_SIZE > 0 = n
+			find data block will return the index of the nth block of the file
+			eg if offset / BLOCK SIZE == 1, FDB will return the index of block 1
+			this is what we want
+			
+			offset % BLOCK SIZE does not matter for this part
+		*/
+
+		uint16_t first_index = find_data_block(ctx, fd, offset / BLOCK_SIZE);
+
+		// first_index will be FAT_EOC if offset / BLOCK SIZE is out of bounds
+		// since we do not have room to write anything, we must end the write here
+		if (first_index == FAT_EOC){
+			return bytes_written;
+		}
+
+		first_index += ctx->sb.data_start_index;
+		// printf("first index = %d\n", first_index);
+
+		// write_amount is the amount we are writing to this one block
+		// the old implementation was under the assumption offset is less than one block
+		// it was BLOCK_SIZE - offset, or the amount we are writing to the first block (partial block)
+		// this should be fixed by changing offset to offset % BLOCK_SIZE
+		size_t write_amount = 0;
+		if ((offset % BLOCK_SIZE) + count < BLOCK_SIZE){
+			write_amount = count;
+		} else {
+			write_amount = BLOCK_SIZE - (offset % BLOCK_SIZE);
+		}
+
+		// printf("write amount = %d\n", write_amount);
+		// copy from the buffer into the block starting from the offset
+		// copy enough to fill the block, or the entire buffer if it is smaller
+		// the cache does the read-modify-write of the block, and keeps it around for the next small write
+		TRACE_BLOCKS(TRACE_WRITE_HEAD, first_index, 1);
+		op_success = cache_write(ctx->cache, first_index, offset % BLOCK_SIZE, write_amount, buf);
+		if (op_success == -1){
+			// fprintf(stderr, "Error in fs_write(): failed to write first block, at index %d\n", first_index);
+			return -1;
+		}
+
+		bytes_written += write_amount;
+		full_block_start_index++;
+	}
+	
+	// full blocks (if applicable)
+
+	// num_full_blocks is the number of blocks we write to entirely
+	int num_full_blocks = num_target_blocks - (offset / BLOCK_SIZE) - (bytes_written != 0);
+	num_full_blocks -= (count - bytes_written) % BLOCK_SIZE != 0;
+	// the blocks are written a run at a time, where a run is a stretch of the file that is also contiguous on disk
+	int full_block_end_index = num_full_blocks + full_block_start_index;
+	for (int i = full_block_start_index; i < full_block_end_index;){
+		uint16_t block_index = find_data_block(ctx, fd, i);
+
+		// like for the partial block, if block_index == FAT_EOC, that means the request is out of bounds
+		// this either means the loop ran for too long, or we were not able to allocate enough data blocks for the whole write
+		// the first is an implementation error. lets hope it doesnt happen
+		if (block_index == FAT_EOC){
+			return bytes_written;
+		}
+
+		int run_length = find_run_length(ctx, fd, i, full_block_end_index - i);
+		block_index += ctx->sb.data_start_index;
 
 		// buf_offset is the part in buf we get the data from to write a block
 		// if there was no offset, it should just be BLOCK_SIZE*i
@@ -1037,218 +3070,797 @@ int fs_write(int fd, void *buf, size_t count)
 		// that would be (offset % BLOCK_SIZE) + (BLOCK_SIZE * (i-full_block_start_index))
 		int buf_offset = bytes_written;
 
-		op_success = block_write(block_index, buf+buf_offset);
-		uint8_t buffer[BLOCK_SIZE];
-		block_read(block_index, buffer);
-		// printf("write: full block %d\nindex%d\n", i, block_index);
-		// printblock(buffer);
+		TRACE_BLOCKS(TRACE_WRITE_BODY, block_index, run_length);
+		op_success = cache_write_blocks(ctx->cache, block_index, run_length, buf+buf_offset);
+		if (op_success == -1){
+			// fprintf(stderr, "Error in fs_write(): failed to write blocks %d-%d, at index %d\n", i, i+run_length-1, block_index);
+			return -1;
+		}
+
+		bytes_written += run_length * BLOCK_SIZE;
+		i += run_length;
+	}
+
+	// the remainder block is the last partial block
+	// if the last block we needed to write was a full block, we should skip this part
+	int remainder_block_size = count - bytes_written;
+	if (remainder_block_size >= BLOCK_SIZE){
+		// fprintf(stderr, "Error in fs_write(): something went wrong with portions\n");
+	}
+	// printf("remainder = %d\n", remainder_block_size);
+
+	if (remainder_block_size != 0){
+		uint16_t last_index = find_data_block(ctx, fd, num_target_blocks-1);
+
+		// like above, last_index will be FAT_EOC if there is not enough space to write the last block
+		// we must end the write here if so
+		if (last_index == FAT_EOC){
+			// fprintf(stderr, "Error in fs_write(): no space to write last block\n");
+			return bytes_written;
+		}
+
+		last_index += ctx->sb.data_start_index;
+		// printf("last index = %d\n", last_index);
+
+		// buf_offset is the starting point for the data we are writing
+		int buf_offset = bytes_written;
+		// printf("buf offset = %d\n", buf_offset);
+		// printf("index = %d\n", last_index);
 
+		// overwrite the block from 0 to remainder size with data
+		TRACE_BLOCKS(TRACE_WRITE_TAIL, last_index, 1);
+		op_success = cache_write(ctx->cache, last_index, 0, remainder_block_size, buf+buf_offset);
 		if (op_success == -1){
-			// fprintf(stderr, "Error in fs_write(): failed to write block %d, at index %d\n", i, block_index);
+			// fprintf(stderr, "Error in fs_write(): failed to write last block %d, at index %d\n", num_target_blocks-1, last_index);
+			return -1;
+		}
+
+		bytes_written += remainder_block_size;
+	}
+
+	desc->offset += bytes_written;
+	// overwriting existing bytes does not make the file any bigger, only writing past the end does
+	if (desc->offset > desc->file->file_size){
+		desc->file->file_size = desc->offset;
+
+		pthread_mutex_lock(&ctx->alloc_lock);
+		mark_entry_dirty(ctx, desc->file);
+		pthread_mutex_unlock(&ctx->alloc_lock);
+	}
+	return bytes_written;
+}
+
+// helper function for fs_write_ctx()
+// writes at the descriptor's offset with the file locked exclusively, allocating blocks as the file grows
+// returns the number of bytes written, fewer than count if the disk fills up
+int write_file(fs_ctx* ctx, int fd, void *buf, size_t count)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_write(): no disk is mounted\n");
+		return -1;
+	}
+
+	if (buf == NULL){
+		// fprintf(stderr, "Error in fs_write(): buf is null\n");
+		return -1;
+	}
+
+	// holding the table shared keeps the descriptor open, without holding up users of other descriptors
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_write(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
+
+	// a writer changes the file's size and block map, so it needs the file to itself
+	struct File* file = desc->file;
+	pthread_rwlock_wrlock(&file->lock);
+	int bytes_written = -1;
+	if (build_block_map(ctx, file) == 0){
+		bytes_written = write_to_file(ctx, fd, buf, count);
+	}
+	pthread_rwlock_unlock(&file->lock);
+
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return bytes_written;
+}
+
+int fs_write_ctx(fs_ctx* ctx, int fd, void *buf, size_t count)
+{
+	TRACE_API(TRACE_ENTER, "fs_write");
+	STATS_START(start);
+	int bytes_written = write_file(ctx, fd, buf, count);
+	if (bytes_written > 0){
+		STATS_ADD(bytes_written, bytes_written);
+	}
+	STATS_END(FS_OP_WRITE, start);
+	TRACE_API(TRACE_EXIT, "fs_write");
+	return bytes_written;
+}
+
+// helper function for fs_read()
+// detects sequential reads on the descriptor, and reads the blocks that come next into the cache before they are asked for
+// the window grows while the reads stay sequential, and collapses as soon as one is not
+void readahead(fs_ctx* ctx, const int fd, const uint32_t offset, const size_t count){
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	struct BlockMap* map = &desc->file->map;
+
+	if (ctx->readahead_max == 0 || count == 0){
+		return;
+	}
+
+	bool is_sequential = offset == desc->ra_next_offset;
+	desc->ra_next_offset = offset + count;
+	if (!is_sequential){
+		desc->ra_window = 0;
+		desc->ra_end = 0;
+		return;
+	}
+
+	// nothing to do until the reads get past what was already read ahead
+	int first_block = offset / BLOCK_SIZE;
+	int last_block = ((size_t)offset + count - 1) / BLOCK_SIZE;
+	if (last_block < desc->ra_end){
+		return;
+	}
+
+	if (desc->ra_window == 0){
+		desc->ra_window = READAHEAD_MIN_BLOCKS;
+	} else if (desc->ra_window * 2 <= ctx->readahead_max){
+		desc->ra_window *= 2;
+	} else {
+		desc->ra_window = ctx->readahead_max;
+	}
+
+	// a small read's own blocks are read ahead too, so they come in with the same disk access
+	// a large read bypasses the cache anyway, so only the blocks after it are
+	int start = first_block;
+	if (count >= CACHE_BYPASS_BLOCKS * BLOCK_SIZE){
+		start = last_block + 1;
+	}
+	if (start < desc->ra_end){
+		start = desc->ra_end;
+	}
+
+	// blocks preallocated past the end of the file hold nothing worth reading
+	int end = last_block + 1 + desc->ra_window;
+	if (end > find_num_target_blocks(0, desc->file->file_size)){
+		end = find_num_target_blocks(0, desc->file->file_size);
+	}
+
+	// each run of blocks that sit one after the other on disk is read with a single disk access
+	for (int i = start; i < end;){
+		int run_length = find_run_length(ctx, fd, i, end - i);
+		cache_prefetch(ctx->cache, map->blocks[i] + ctx->sb.data_start_index, run_length);
+		i += run_length;
+	}
+
+	desc->ra_end = end;
+}
+
+// helper function for fs_read()
+// does the actual read, once fs_read() has checked the descriptor and locked the file
+int read_from_file(fs_ctx* ctx, int fd, void *buf, size_t count){
+	// uint8_t* byte_buf = (uint8_t*)buf;
+	// the file may have been truncated under the descriptor, which then reads from the new end, and forgets its readahead
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc->offset > desc->file->file_size){
+		desc->offset = desc->file->file_size;
+		desc->ra_window = 0;
+		desc->ra_end = 0;
+	}
+	uint32_t offset = desc->offset;
+	uint32_t file_size = desc->file->file_size;
+
+	// a read stops at the end of the file
+	if (offset >= file_size){
+		return 0;
+	}
+	if (count > file_size - offset){
+		count = file_size - offset;
+	}
+	if (count > INT_MAX){
+		count = INT_MAX;
+	}
+
+	readahead(ctx, fd, offset, count);
+	int num_target_blocks = find_num_target_blocks(offset, count);
+	int read_success = 0;
+	int bytes_read = 0;
+	int full_block_start_index = offset / BLOCK_SIZE;
+	// printf("full block start index = %d\n", full_block_start_index);
+	// memcpy(dest, src, count)
+	// printf("offset = %d\n", offset);
+
+	// partial first block (if applicable)
+	if (offset % BLOCK_SIZE != 0){
+		uint16_t first_index = find_data_block(ctx, fd, offset / BLOCK_SIZE);
+
+		if (first_index == FAT_EOC){
+			return bytes_read;
+		}
+
+		first_index += ctx->sb.data_start_index;
+		// printf("read: partial block\nindex %d\n", first_index);
+
+		size_t read_amount = 0;
+		if ((offset % BLOCK_SIZE) + count < BLOCK_SIZE){
+			read_amount = count;
+		} else {
+			read_amount = BLOCK_SIZE - (offset % BLOCK_SIZE);
+		}
+		// printf("read amount = %d\n", read_amount);
+
+		TRACE_BLOCKS(TRACE_READ_HEAD, first_index, 1);
+		read_success = cache_read(ctx->cache, first_index, offset % BLOCK_SIZE, read_amount, buf);
+		if (read_success == -1){
+			// fprintf(stderr, "Error in fs_read(): failed to read first block, at index %d\n", first_index);
+			return -1;
+		}
+
+		bytes_read += read_amount;
+		full_block_start_index++;
+		// printf("bytes read after partial block: %d\n", bytes_read);
+	}
+
+	// full blocks (if applicable)
+	int num_full_blocks = num_target_blocks - (offset / BLOCK_SIZE) - (bytes_read != 0);
+	num_full_blocks -= (count - bytes_read) % BLOCK_SIZE != 0;
+
+	// printf("num_full_blocks = %d\n", num_full_blocks);
+	// like in fs_write(), the blocks are read a run of contiguous blocks at a time
+	int full_block_end_index = num_full_blocks + full_block_start_index;
+	for (int i = full_block_start_index; i < full_block_end_index;){
+		uint16_t block_index = find_data_block(ctx, fd, i);
+
+		if (block_index == FAT_EOC){
+			// fprintf(stderr, "Error in fs_read(): ran out of room for block %d; exiting prematurely\n", i);
+			return bytes_read;
+		}
+
+		int run_length = find_run_length(ctx, fd, i, full_block_end_index - i);
+		block_index += ctx->sb.data_start_index;
+		// printf("read: full blocks %d-%d\nindex %d\n", i, i+run_length-1, block_index);
+		
+		int buf_offset = bytes_read;
+
+		// printf("buf offset = %d\n", buf_offset);
+
+		TRACE_BLOCKS(TRACE_READ_BODY, block_index, run_length);
+		read_success = cache_read_blocks(ctx->cache, block_index, run_length, buf+buf_offset);
+		if (read_success == -1){
+			// fprintf(stderr, "Error in fs_read(): failed to read blocks %d-%d, at index %d\n", i, i+run_length-1, block_index);
+			return -1;
+		}
+		bytes_read += run_length * BLOCK_SIZE;
+		i += run_length;
+	}
+
+	int remainder_block_size = count - bytes_read;
+	// printf("remainder = %ld - %d = %d\n", count, bytes_read, remainder_block_size);
+	if (remainder_block_size < 0 || remainder_block_size >= BLOCK_SIZE){
+		// fprintf(stderr, "Error in fs_read(): something went wrong with read portions\n");
+		return -1;
+	}
+	// partial last block (if applicable)
+	if (remainder_block_size != 0){
+		uint16_t last_index = find_data_block(ctx, fd, num_target_blocks-1);
+
+		if (last_index == FAT_EOC){
+			// fprintf(stderr, "Error in fs_read(): ran out of room for last block; exiting prematurely\n");
+			return bytes_read;
+		}
+
+		last_index += ctx->sb.data_start_index;
+		// printf("read: last block\nindex %d\n", last_index);
+
+		int buf_offset = bytes_read;
+		// printf("buf offset = %d\n", buf_offset);
+		TRACE_BLOCKS(TRACE_READ_TAIL, last_index, 1);
+		read_success = cache_read(ctx->cache, last_index, 0, remainder_block_size, buf+buf_offset);
+		if (read_success == -1){
+			// fprintf(stderr, "Error in fs_read(): failed to read last block %d, at index %d\n", num_target_blocks-1, last_index);
 			return -1;
 		}
 
-		bytes_written += BLOCK_SIZE;
+		bytes_read += remainder_block_size;
+	}
+
+	desc->offset += bytes_read;
+	return bytes_read;
+	// printf("%d %p %ld\n", fd, buf, count);
+	return 0;
+}
+
+// helper function for fs_read_ctx()
+// reads from the descriptor's offset with the file locked shared, so readers of the same file run in parallel
+// returns the number of bytes read, fewer than count at the end of the file
+int read_file(fs_ctx* ctx, int fd, void *buf, size_t count)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_read(): no disk is mounted\n");
+		return -1;
+	}
+
+	if (buf == NULL){
+		// fprintf(stderr, "Error in fs_read(): buf is null\n");
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_read(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
 	}
 
-	// the remainder block is the last partial block
-	// if the last block we needed to write was a full block, we should skip this part
-	int remainder_block_size = count - bytes_written;
-	if (remainder_block_size >= BLOCK_SIZE){
-		// fprintf(stderr, "Error in fs_write(): something went wrong with portions\n");
+	// any number of readers can share the file, only writers are kept out
+	struct File* file = desc->file;
+	if (lock_file_shared(ctx, file) != 0){
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
 	}
-	// printf("remainder = %d\n", remainder_block_size);
+	int bytes_read = read_from_file(ctx, fd, buf, count);
+	pthread_rwlock_unlock(&file->lock);
 
-	if (remainder_block_size != 0){
-		uint16_t last_index = find_data_block(fd, num_target_blocks-1);
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return bytes_read;
+}
 
-		// like above, last_index will be FAT_EOC if there is not enough space to write the last block
-		// we must end the write here if so
-		if (last_index == FAT_EOC){
-			// fprintf(stderr, "Error in fs_write(): no space to write last block\n");
-			return bytes_written;
-		}
+int fs_read_ctx(fs_ctx* ctx, int fd, void *buf, size_t count)
+{
+	TRACE_API(TRACE_ENTER, "fs_read");
+	STATS_START(start);
+	int bytes_read = read_file(ctx, fd, buf, count);
+	if (bytes_read > 0){
+		STATS_ADD(bytes_read, bytes_read);
+	}
+	STATS_END(FS_OP_READ, start);
+	TRACE_API(TRACE_EXIT, "fs_read");
+	return bytes_read;
+}
 
-		last_index += sb->data_start_index;
-		// printf("last index = %d\n", last_index);
-		uint8_t bounce_buffer[BLOCK_SIZE];
+// helper function for fs_read_view()
+// fills iov with spans of the file's bytes from offset up to offset+count, or the end of the file
+// returns the number of spans, which stops early if iov is full or if no more blocks can be pinned
+// returns -1 if not even the first block could be pinned
+int view_file(fs_ctx* ctx, int fd, size_t offset, size_t count, struct iovec* iov, int iovcnt){
+	struct File* file = get_descriptor(ctx, fd)->file;
 
-		// bounce buffer contains the last data block in the file
-		op_success = block_read(last_index, bounce_buffer);
-		if (op_success == -1){
-			// fprintf(stderr, "Error in fs_write(): failed to read last block %d, at index %d\n", num_target_blocks-1, last_index);
-			return -1;
+	// a view never goes past the end of the file
+	// comparing against what is left of the file keeps offset+count from overflowing
+	size_t end = file->file_size;
+	if (offset < end && count < end - offset){
+		end = offset + count;
+	}
+
+	// mapped disks are never cached, so their blocks are not pinned
+	// spans of blocks that sit one after the other on disk are then one after the other in memory too
+	bool is_mapped = disk_block_ptr(ctx->disk, 0) != NULL;
+
+	int num_spans = 0;
+	size_t pos = offset;
+	while (pos < end){
+		uint16_t block_index = find_data_block(ctx, fd, pos / BLOCK_SIZE);
+		if (block_index == FAT_EOC){
+			break;
 		}
 
-		// printf("whole block\n");
-		// printblock(bounce_buffer);
+		const void* data;
+		if (cache_pin(ctx->cache, block_index + ctx->sb.data_start_index, &data) != 0){
+			// fprintf(stderr, "Error in fs_read_view(): unable to pin block %d\n", block_index);
+			if (num_spans == 0){
+				return -1;
+			}
+			break;
+		}
 
-		// buf_offset is the starting point for the data we are writing
-		int buf_offset = bytes_written;
-		// printf("buf offset = %d\n", buf_offset);
-		// printf("index = %d\n", last_index);
+		const uint8_t* start = (const uint8_t*)data + pos % BLOCK_SIZE;
+		size_t len = BLOCK_SIZE - pos % BLOCK_SIZE;
+		if (len > end - pos){
+			len = end - pos;
+		}
 
-		// overwrite buffer from 0 to remainder size with data
-		memcpy(&bounce_buffer[0], buf+buf_offset, remainder_block_size);
-		op_success = block_write(last_index, bounce_buffer);
-		// printf("write: partial last block at index %d\nbounce buffer after write and memcpy\n", last_index);
-		// printblock(bounce_buffer);
-		// uint8_t buffer[BLOCK_SIZE];
-		// block_read(last_index, buffer);
-		// printf("write result\n");
-		// printblock(buffer);
-		if (op_success == -1){
-			// fprintf(stderr, "Error in fs_write(): failed to write last block %d, at index %d\n", num_target_blocks-1, last_index);
-			return -1;
+		if (is_mapped && num_spans > 0 && (const uint8_t*)iov[num_spans-1].iov_base + iov[num_spans-1].iov_len == start){
+			iov[num_spans-1].iov_len += len;
+		} else if (num_spans < iovcnt){
+			iov[num_spans].iov_base = (void*)start;
+			iov[num_spans].iov_len = len;
+			num_spans++;
+		} else {
+			// no room left for another span, so give the block back
+			cache_unpin(ctx->cache, data);
+			break;
 		}
 
-		bytes_written += remainder_block_size;
+		pos += len;
 	}
 
-	open_files[fd]->offset += bytes_written;
-	open_files[fd]->file->file_size += bytes_written;
-	return bytes_written;
+	return num_spans;
 }
 
-int fs_read(int fd, void *buf, size_t count)
+int fs_read_view_ctx(fs_ctx* ctx, int fd, size_t offset, size_t count, struct iovec* iov, int iovcnt)
 {
-	/* TODO: Phase 4 */
-	// printf("running fs_read\n");
-	if (!is_disk_mounted){
-		// fprintf(stderr, "Error in fs_read(): no disk is mounted\n");
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_read_view(): no disk is mounted\n");
 		return -1;
 	}
 
-	if (fd < 0 || fd >= FS_FILE_MAX_COUNT){
-		// fprintf(stderr, "Error in fs_read(): file descriptor %d out of bounds\n", fd);
+	if (iov == NULL || iovcnt <= 0){
+		// fprintf(stderr, "Error in fs_read_view(): no room for spans\n");
 		return -1;
 	}
 
-	if (open_files[fd] == NULL){
-		// fprintf(stderr, "Error in fs_read(): file with descriptor %d not open\n", fd);
+	pthread_rwlock_rdlock(&ctx->table_lock);
+
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_read_view(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
 		return -1;
 	}
 
-	if (buf == NULL){
-		// fprintf(stderr, "Error in fs_read(): buf is null\n");
+	// the locks are only needed while the spans are found
+	// afterwards, the pins are what keeps the blocks in memory
+	struct File* file = desc->file;
+	if (lock_file_shared(ctx, file) != 0){
+		pthread_rwlock_unlock(&ctx->table_lock);
 		return -1;
 	}
+	int num_spans = view_file(ctx, fd, offset, count, iov, iovcnt);
+	pthread_rwlock_unlock(&file->lock);
 
-	// uint8_t* byte_buf = (uint8_t*)buf;
-	uint16_t offset = open_files[fd]->offset;
-	int num_target_blocks = find_num_target_blocks(offset, count);
-	int read_success = 0;
-	int bytes_read = 0;
-	uint16_t full_block_start_index = offset / BLOCK_SIZE;
-	// printf("full block start index = %d\n", full_block_start_index);
-	// memcpy(dest, src, count)
-	// printf("offset = %d\n", offset);
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return num_spans;
+}
 
-	// partial first block (if applicable)
-	if (offset % BLOCK_SIZE != 0){
-		uint16_t first_index = find_data_block(fd, offset / BLOCK_SIZE);
+int fs_release_view_ctx(fs_ctx* ctx, const struct iovec* iov, int iovcnt)
+{
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_release_view(): no disk is mounted\n");
+		return -1;
+	}
 
-		if (first_index == FAT_EOC){
-			return bytes_read;
-		}
+	if (iov == NULL && iovcnt > 0){
+		return -1;
+	}
 
-		first_index += sb->data_start_index;
-		// printf("read: partial block\nindex %d\n", first_index);
-		uint8_t bounce_buffer[BLOCK_SIZE];
-		read_success = block_read(first_index, bounce_buffer);
-		if (read_success == -1){
-			// fprintf(stderr, "Error in fs_read(): failed to read first block, at index %d\n", first_index);
-			return -1;
+	// every span given out by fs_read_view() starts inside the one block it pinned
+	for (int i = 0; i < iovcnt; i++){
+		cache_unpin(ctx->cache, iov[i].iov_base);
+	}
+
+	return 0;
+}
+
+// helper function for fs_read_async() and fs_write_async()
+// splits the file's bytes from offset to end into block operations, for the async engine
+// whole blocks that sit one after the other on disk become a single operation, up to AIO_MAX_OP_BLOCKS
+// returns the number of operations in ops, which must have room for one per block
+size_t build_aio_ops(fs_ctx* ctx, const int fd, size_t offset, size_t end, void* buf, struct aio_op* ops){
+	size_t num_ops = 0;
+	size_t pos = offset;
+	while (pos < end){
+		int block_num = pos / BLOCK_SIZE;
+		size_t in_block = pos % BLOCK_SIZE;
+		uint16_t block_index = find_data_block(ctx, fd, block_num);
+		if (block_index == FAT_EOC){
+			break;
 		}
 
-		// printf("whole block\n");
-		// printblock(bounce_buffer);
+		struct aio_op* op = &ops[num_ops++];
+		op->block = block_index + ctx->sb.data_start_index;
+		op->offset = in_block;
+		op->buf = (uint8_t*)buf + (pos - offset);
 
-		uint16_t read_amount = 0;
-		if ((offset % BLOCK_SIZE) + count < BLOCK_SIZE){
-			read_amount = count;
+		if (in_block != 0 || end - pos < BLOCK_SIZE){
+			// partial block
+			op->len = BLOCK_SIZE - in_block;
+			if (op->len > end - pos){
+				op->len = end - pos;
+			}
 		} else {
-			read_amount = BLOCK_SIZE - (offset % BLOCK_SIZE);
+			// run of whole blocks
+			size_t num_full_blocks = (end - pos) / BLOCK_SIZE;
+			if (num_full_blocks > AIO_MAX_OP_BLOCKS){
+				num_full_blocks = AIO_MAX_OP_BLOCKS;
+			}
+			op->len = find_run_length(ctx, fd, block_num, num_full_blocks) * BLOCK_SIZE;
 		}
-		// printf("read amount = %d\n", read_amount);
 
-		memcpy(buf, &bounce_buffer[offset % BLOCK_SIZE], read_amount);
-		bytes_read += read_amount;
-		full_block_start_index++;
-		// printf("bytes read after partial block: %d\n", bytes_read);
+		pos += op->len;
 	}
 
-	// full blocks (if applicable)
-	int num_full_blocks = num_target_blocks - (offset / BLOCK_SIZE) - (bytes_read != 0);
-	num_full_blocks -= (count - bytes_read) % BLOCK_SIZE != 0;
+	return num_ops;
+}
 
-	// printf("num_full_blocks = %d\n", num_full_blocks);
-	for (int i = full_block_start_index; i < num_full_blocks + full_block_start_index; i++){
-		uint16_t block_index = find_data_block(fd, i);
+// helper function for fs_read_async() and fs_write_async()
+// checks the request, locks the file, turns the request into block operations and submits them
+int submit_async(fs_ctx* ctx, int fd, void* buf, size_t count, size_t offset, unsigned long long user_data, bool is_write){
+	if (ctx == NULL){
+		// fprintf(stderr, "Error in fs_xxx_async(): no disk is mounted\n");
+		return -1;
+	}
 
-		if (block_index == FAT_EOC){
-			// fprintf(stderr, "Error in fs_read(): ran out of room for block %d; exiting prematurely\n", i);
-			return bytes_read;
-		}
+	if (buf == NULL || count > INT32_MAX){
+		// fprintf(stderr, "Error in fs_xxx_async(): invalid buffer\n");
+		return -1;
+	}
 
-		block_index += sb->data_start_index;
-		// printf("read: full block %d\nindex %d\n", i, block_index);
-		// printf("block index = %d\n", block_index);
-		
-		int buf_offset = bytes_read;
+	// nothing lies past what file_size can count, so keep offset+count within it
+	if (offset > UINT32_MAX){
+		offset = UINT32_MAX;
+	}
+	if (count > UINT32_MAX - offset){
+		count = UINT32_MAX - offset;
+	}
 
-		// printf("buf offset = %d\n", buf_offset);
+	pthread_rwlock_rdlock(&ctx->table_lock);
 
-		read_success = block_read(block_index, buf+buf_offset);
-		uint8_t buffer[BLOCK_SIZE];
-		block_read(block_index, buffer);
-		// printf("in read()\n");
-		// printblock(buffer);
+	struct FileDescriptor* desc = get_descriptor(ctx, fd);
+	if (desc == NULL){
+		// fprintf(stderr, "Error in fs_xxx_async(): file with descriptor %d not open\n", fd);
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
+	}
 
-		if (read_success == -1){
-			// fprintf(stderr, "Error in fs_read(): failed to read block %d, at index %d\n", i, block_index);
+	// the locks are only held while the request is split up
+	// the operations themselves only need the disk block numbers they were given
+	struct File* file = desc->file;
+	if (is_write){
+		pthread_rwlock_wrlock(&file->lock);
+		if (build_block_map(ctx, file) != 0){
+			pthread_rwlock_unlock(&file->lock);
+			pthread_rwlock_unlock(&ctx->table_lock);
 			return -1;
 		}
-		bytes_read += BLOCK_SIZE;
+	} else if (lock_file_shared(ctx, file) != 0){
+		pthread_rwlock_unlock(&ctx->table_lock);
+		return -1;
 	}
 
-	int remainder_block_size = count - bytes_read;
-	// printf("remainder = %ld - %d = %d\n", count, bytes_read, remainder_block_size);
-	if (remainder_block_size < 0 || remainder_block_size >= BLOCK_SIZE){
-		// fprintf(stderr, "Error in fs_read(): something went wrong with read portions\n");
+	int ret = 0;
+	size_t end = offset + count;
+	if (is_write){
+		// like fs_lseek(), a write cannot start past the end of the file
+		if (offset > file->file_size){
+			ret = -1;
+		} else if (count > 0){
+			// if the disk fills up, write as much as there is room for
+			allocate_blocks_in_fat(ctx, fd, find_num_target_blocks(0, end));
+			if (end > (size_t)file->map.num_blocks * BLOCK_SIZE){
+				end = (size_t)file->map.num_blocks * BLOCK_SIZE;
+			}
+			if (end < offset){
+				end = offset;
+			}
+
+			// the file grows now, so later requests can build on this one
+			if (end > file->file_size){
+				file->file_size = end;
+
+				pthread_mutex_lock(&ctx->alloc_lock);
+				mark_entry_dirty(ctx, file);
+				pthread_mutex_unlock(&ctx->alloc_lock);
+			}
+		}
+	} else {
+		// reads stop at the end of the file
+		if (offset > file->file_size){
+			offset = file->file_size;
+		}
+		if (end > file->file_size){
+			end = file->file_size;
+		}
+	}
+
+	if (ret == 0){
+		size_t max_ops = (end - offset) / BLOCK_SIZE + 2;
+		struct aio_op* ops = malloc(max_ops * sizeof(struct aio_op));
+		if (ops == NULL){
+			ret = -1;
+		} else {
+			size_t num_ops = build_aio_ops(ctx, fd, offset, end, buf, ops);
+			ret = aio_submit(ctx->aio, ops, num_ops, is_write, end - offset, user_data);
+			free(ops);
+		}
+	}
+
+	pthread_rwlock_unlock(&file->lock);
+	pthread_rwlock_unlock(&ctx->table_lock);
+	return ret;
+}
+
+int fs_read_async_ctx(fs_ctx* ctx, int fd, void *buf, size_t count, size_t offset, unsigned long long user_data)
+{
+	return submit_async(ctx, fd, buf, count, offset, user_data, false);
+}
+
+int fs_write_async_ctx(fs_ctx* ctx, int fd, void *buf, size_t count, size_t offset, unsigned long long user_data)
+{
+	return submit_async(ctx, fd, buf, count, offset, user_data, true);
+}
+
+int fs_aio_reap_ctx(fs_ctx* ctx, struct fs_aio_completion *completions, int max, int min)
+{
+	if (ctx == NULL || completions == NULL || max <= 0){
+		// fprintf(stderr, "Error in fs_aio_reap(): no disk is mounted\n");
 		return -1;
 	}
-	// partial last block (if applicable)
-	if (remainder_block_size != 0){
-		uint16_t last_index = find_data_block(fd, num_target_blocks-1);
 
-		if (last_index == FAT_EOC){
-			// fprintf(stderr, "Error in fs_read(): ran out of room for last block; exiting prematurely\n");
-			return bytes_read;
+	// reap a few at a time, so the engine's completions can be converted on the stack
+	struct aio_completion done[32];
+	int num_reaped = 0;
+	while (num_reaped < max){
+		int batch = max - num_reaped;
+		if (batch > 32){
+			batch = 32;
 		}
 
-		last_index += sb->data_start_index;
-		// printf("read: last block\nindex %d\n", last_index);
-		uint8_t bounce_buffer[BLOCK_SIZE];
-		read_success = block_read(last_index, bounce_buffer);
-		if (read_success == -1){
-			// fprintf(stderr, "Error in fs_read(): failed to read last block %d, at index %d\n", num_target_blocks-1, last_index);
-			return -1;
+		int n = aio_reap(ctx->aio, done, batch, min - num_reaped);
+		for (int i = 0; i < n; i++){
+			completions[num_reaped+i].user_data = done[i].user_data;
+			completions[num_reaped+i].result = done[i].result;
 		}
-		uint8_t buffer[BLOCK_SIZE];
-		block_read(last_index, buffer);
-		// printf("whole last block in read\n");
-		// printblock(buffer);
+		num_reaped += n;
 
-		int buf_offset = bytes_read;
-		// printf("buf offset = %d\n", buf_offset);
-		memcpy(buf+buf_offset, &bounce_buffer[0], remainder_block_size);
-		bytes_read += remainder_block_size;
+		if (n < batch){
+			break;
+		}
 	}
 
-	open_files[fd]->offset += bytes_read;
-	return bytes_read;
-	// printf("%d %p %ld\n", fd, buf, count);
+	return num_reaped;
+}
+
+// the original interface
+// each function works on the disk mounted by fs_mount(), which is kept in default_ctx
+
+int fs_mount(const char *diskname)
+{
+	if (default_ctx != NULL){
+		// fprintf(stderr, "Error in fs_mount(): disk already mounted\n");
+		return -1;
+	}
+
+	default_ctx = fs_mount_ctx(diskname);
+	if (default_ctx == NULL){
+		return -1;
+	}
+
+	return 0;
+}
+
+int fs_umount(void)
+{
+	if (fs_umount_ctx(default_ctx) != 0){
+		return -1;
+	}
+
+	default_ctx = NULL;
 	return 0;
 }
 
+int fs_info(void)
+{
+	return fs_info_ctx(default_ctx);
+}
+
+int fs_create(const char *filename)
+{
+	return fs_create_ctx(default_ctx, filename);
+}
+
+int fs_delete(const char *filename)
+{
+	return fs_delete_ctx(default_ctx, filename);
+}
+
+int fs_ls(void)
+{
+	return fs_ls_ctx(default_ctx);
+}
+
+int fs_open(const char *filename)
+{
+	return fs_open_ctx(default_ctx, filename);
+}
+
+int fs_close(int fd)
+{
+	return fs_close_ctx(default_ctx, fd);
+}
+
+int fs_stat(int fd)
+{
+	return fs_stat_ctx(default_ctx, fd);
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+	return fs_lseek_ctx(default_ctx, fd, offset);
+}
+
+int fs_write(int fd, void *buf, size_t count)
+{
+	return fs_write_ctx(default_ctx, fd, buf, count);
+}
+
+int fs_read(int fd, void *buf, size_t count)
+{
+	return fs_read_ctx(default_ctx, fd, buf, count);
+}
+
+int fs_sync(void)
+{
+	return fs_sync_ctx(default_ctx);
+}
+
+int fs_fsync(int fd)
+{
+	return fs_fsync_ctx(default_ctx, fd);
+}
+
+int fs_truncate(const char *filename, size_t size)
+{
+	return fs_truncate_ctx(default_ctx, filename, size);
+}
+
+int fs_ftruncate(int fd, size_t size)
+{
+	return fs_ftruncate_ctx(default_ctx, fd, size);
+}
+
+int fs_fallocate(int fd, size_t size)
+{
+	return fs_fallocate_ctx(default_ctx, fd, size);
+}
+
+int fs_frag_stats(struct fs_frag_stats *stats)
+{
+	return fs_frag_stats_ctx(default_ctx, stats);
+}
+
+int fs_defrag(size_t max_blocks)
+{
+	return fs_defrag_ctx(default_ctx, max_blocks);
+}
+
+int fs_analyze(struct fs_layout *layout, struct fs_file_layout *files, size_t max_files)
+{
+	return fs_analyze_ctx(default_ctx, layout, files, max_files);
+}
+
+int fs_cache_stats(struct fs_cache_stats *stats)
+{
+	return fs_cache_stats_ctx(default_ctx, stats);
+}
+
+int fs_read_view(int fd, size_t offset, size_t count, struct iovec *iov, int iovcnt)
+{
+	return fs_read_view_ctx(default_ctx, fd, offset, count, iov, iovcnt);
+}
+
+int fs_release_view(const struct iovec *iov, int iovcnt)
+{
+	return fs_release_view_ctx(default_ctx, iov, iovcnt);
+}
+
+int fs_read_async(int fd, void *buf, size_t count, size_t offset, unsigned long long user_data)
+{
+	return fs_read_async_ctx(default_ctx, fd, buf, count, offset, user_data);
+}
+
+int fs_write_async(int fd, void *buf, size_t count, size_t offset, unsigned long long user_data)
+{
+	return fs_write_async_ctx(default_ctx, fd, buf, count, offset, user_data);
+}
+
+int fs_aio_reap(struct fs_aio_completion *completions, int max, int min)
+{
+	return fs_aio_reap_ctx(default_ctx, completions, max, min);
+}
@@ -1,16 +1,16 @@
 #ifndef _FS_H
 #define _FS_H
 
-/**
- * WARNING: YOU ARE NOT ALLOWED TO MODIFY THIS FILE!
- */
-
 #include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
 
 /** Maximum filename length (including the NULL character) */
 #define FS_FILENAME_LEN 16
 
-/** Maximum number of files in the root directory */
+/**
+ * Number of files in one block of the root directory. The directory gets
+ * another block whenever it fills up.
+ */
 #define FS_FILE_MAX_COUNT 128
 
 /** Maximum number of open files */
@@ -33,10 +33,11 @@ int fs_mount(const char *diskname);
  * fs_umount - Unmount file system
  *
  * Unmount the currently mounted file system and close the underlying virtual
- * disk file.
+ * disk file. If this fails, the file system stays mounted as it was.
  *
- * Return: -1 if no FS is currently mounted, or if the virtual disk cannot be
- * closed, or if there are still open file descriptors. 0 otherwise.
+ * Return: -1 if no FS is currently mounted, or if the changes cannot be
+ * written back to the virtual disk, or if there are still open file
+ * descriptors. 0 otherwise.
  */
 int fs_umount(void);
 
@@ -58,9 +59,16 @@ int fs_info(void);
  * length cannot exceed %FS_FILENAME_LEN characters (including the NULL
  * character).
  *
+ * The root directory has no fixed size: once all of its entries are taken, it
+ * grows by one block of %FS_FILE_MAX_COUNT entries, taken from the data area.
+ * The first time this happens, the superblock is rewritten to record the new
+ * directory blocks in two fields that used to be padding.
+ *
  * Return: -1 if no FS is currently mounted, or if @filename is invalid, or if a
  * file named @filename already exists, or if string @filename is too long, or
- * if the root directory already contains %FS_FILE_MAX_COUNT files. 0 otherwise.
+ * if the root directory is full and cannot grow, because the disk has no free
+ * block left or the entries and their hash index cannot be allocated.
+ * 0 otherwise.
  */
 int fs_create(const char *filename);
 
@@ -96,12 +104,12 @@ int fs_ls(void);
  * of the file descriptor is set to 0 initially (beginning of the file). If the
  * same file is opened multiple files, fs_open() must return distinct file
  * descriptors. A maximum of %FS_OPEN_MAX_COUNT files can be open
- * simultaneously.
+ * simultaneously, unless fs_set_open_max() allowed more.
  *
  * Return: -1 if no FS is currently mounted, or if @filename is invalid, or if
  * there is no file named @filename to open, or if there are already
- * %FS_OPEN_MAX_COUNT files currently open. Otherwise, return the file
- * descriptor.
+ * %FS_OPEN_MAX_COUNT files (or as many as fs_set_open_max() allowed)
+ * currently open. Otherwise, return the file descriptor.
  */
 int fs_open(const char *filename);
 
@@ -112,7 +120,8 @@ int fs_open(const char *filename);
  * Close file descriptor @fd.
  *
  * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
- * invalid (out of bounds or not currently open). 0 otherwise.
+ * invalid (out of bounds, not currently open, or already closed). 0
+ * otherwise.
  */
 int fs_close(int fd);
 
@@ -186,4 +195,608 @@ int fs_write(int fd, void *buf, size_t count);
  */
 int fs_read(int fd, void *buf, size_t count);
 
+/** Counters kept by the block cache of the mounted file system */
+struct fs_cache_stats {
+	/* Block accesses served from the cache */
+	unsigned long long hits;
+	/* Block accesses that had to go to the disk */
+	unsigned long long misses;
+	/* Blocks dropped from the cache to make room for others */
+	unsigned long long evictions;
+	/* Modified blocks written back to the disk */
+	unsigned long long writebacks;
+	/* Blocks read ahead of sequential reads */
+	unsigned long long prefetches;
+};
+
+/**
+ * fs_sync - Write back every change
+ *
+ * Write every block modified through fs_write() that is still held in the
+ * block cache back to the virtual disk, followed by the FAT blocks, root
+ * directory blocks and superblock that changed since they were last written,
+ * and wait until the virtual disk file holds them durably. Reads and writes
+ * wait for the sync to finish. fs_umount() writes the same blocks back
+ * implicitly, so after a sync it has nothing left to write. With a journal
+ * (see fs_set_journal()), the journal is emptied afterwards.
+ *
+ * Return: -1 if no FS is currently mounted, or if a block could not be
+ * written or synced. 0 otherwise.
+ */
+int fs_sync(void);
+
+/**
+ * fs_fsync - Write back the changes to one file
+ * @fd: File descriptor
+ *
+ * Like fs_sync(), but only the data blocks of the file open as file descriptor
+ * @fd are written back. The metadata that changed is written back whole, as
+ * it is shared with other files, so that the FAT and root directory on the
+ * virtual disk stay consistent with each other. With a journal, the metadata
+ * is not written back: a single journal record holding its changes is, shared
+ * with every thread committing at the same time.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if a block could not be
+ * written or synced. 0 otherwise.
+ */
+int fs_fsync(int fd);
+
+/**
+ * fs_truncate - Shrink a file
+ * @filename: File name
+ * @size: New size of the file, in bytes
+ *
+ * Cut file @filename down to its first @size bytes, and free the data blocks
+ * past them, including any reserved by fs_fallocate(). Only those blocks are
+ * visited, so the cost does not depend on how much of the file is kept. The
+ * file may be open: the offset of a file descriptor left past the new end
+ * moves to the end on its next fs_read() or fs_write(). On a disk with a
+ * journal, the change is durable once fs_truncate() returns, like
+ * fs_delete().
+ *
+ * Return: -1 if no FS is currently mounted, or if @filename is invalid, or if
+ * there is no file named @filename, or if @size is larger than the current
+ * file size, or if the FAT could not be read. 0 otherwise.
+ */
+int fs_truncate(const char *filename, size_t size);
+
+/**
+ * fs_ftruncate - Shrink an open file
+ * @fd: File descriptor
+ * @size: New size of the file, in bytes
+ *
+ * Same as fs_truncate(), for the file open as @fd. The offset of @fd is
+ * unchanged until its next fs_read() or fs_write().
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds, not currently open, or already closed), or if @size
+ * is larger than the current file size, or if the FAT could not be read. 0
+ * otherwise.
+ */
+int fs_ftruncate(int fd, size_t size);
+
+/**
+ * fs_fallocate - Reserve the blocks of a file up front
+ * @fd: File descriptor
+ * @size: Number of bytes the file should have room for
+ *
+ * Give the file open as @fd enough data blocks to hold @size bytes, without
+ * changing its size. The missing blocks are taken as a single run of
+ * contiguous free blocks if the disk has one that long, and otherwise as few
+ * runs as can be found, and are linked after the file's last block. Later
+ * writes up to @size then fill them without allocating. Blocks the file
+ * already has are kept, so a smaller @size does nothing; fs_truncate() and
+ * fs_ftruncate() give back the blocks past the end of the file.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds, not currently open, or already closed), or if there
+ * are not enough free blocks, in which case none is taken. 0 otherwise.
+ */
+int fs_fallocate(int fd, size_t size);
+
+/** Fragmentation of the files of the mounted file system */
+struct fs_frag_stats {
+	/* Files in the root directory */
+	size_t files;
+	/* Files whose blocks are not all contiguous */
+	size_t fragmented_files;
+	/* Data blocks held by files, including blocks reserved by fs_fallocate() */
+	size_t blocks;
+	/* Runs of contiguous blocks those are split into, one per file at best */
+	size_t extents;
+};
+
+/**
+ * fs_frag_stats - Measure how fragmented the files are
+ * @stats: Filled with the counts of the mounted file system
+ *
+ * Return: -1 if no FS is currently mounted, or if @stats is NULL, or if the
+ * FAT chain of a file could not be read. 0 otherwise.
+ */
+int fs_frag_stats(struct fs_frag_stats *stats);
+
+/**
+ * fs_defrag - Move fragmented files into contiguous blocks
+ * @max_blocks: Number of blocks that may be moved in this call
+ *
+ * Copy the data blocks of fragmented files, the most fragmented first, each
+ * into a single run of contiguous free blocks, then link the run in place of
+ * the old chain and free the old blocks. A file is moved whole or not at all,
+ * and is skipped if the disk has no free run as long as it. Files that do not
+ * fit in what is left of @max_blocks are skipped too, except that the first
+ * file moved may be larger than @max_blocks, so that every call does some
+ * work. The file system stays mounted and usable meanwhile: each file is only
+ * locked while it is moved, so calling fs_defrag() repeatedly with a small
+ * @max_blocks spreads the work over time, until it returns 0.
+ *
+ * Return: -1 if no FS is currently mounted, or if a block could not be read,
+ * written or allocated. Otherwise return the number of blocks moved, which is
+ * 0 once no fragmented file can be moved.
+ */
+int fs_defrag(size_t max_blocks);
+
+/** Number of buckets of the free run histogram of struct fs_layout */
+#define FS_FREE_RUN_BUCKETS 16
+
+/** Layout of one file on the disk, as found by fs_analyze() */
+struct fs_file_layout {
+	char filename[FS_FILENAME_LEN];
+	size_t size;
+	/* Data blocks, including blocks reserved by fs_fallocate() */
+	size_t blocks;
+	/* Runs of contiguous blocks, so blocks / extents is their average length */
+	size_t extents;
+	/* Places where the chain goes on at a lower block than the one before */
+	size_t inversions;
+};
+
+/** Layout of the whole mounted file system, as found by fs_analyze() */
+struct fs_layout {
+	size_t files;
+	/* Files of two extents or more */
+	size_t fragmented_files;
+	/* Sums over every file */
+	size_t blocks;
+	size_t extents;
+	size_t inversions;
+	/* Free data blocks, the runs of contiguous ones they form, and the longest */
+	size_t free_blocks;
+	size_t free_runs;
+	size_t largest_free_run;
+	/* Bucket i counts the free runs of 2^i to 2^(i+1) - 1 blocks */
+	size_t free_run_hist[FS_FREE_RUN_BUCKETS];
+};
+
+/**
+ * fs_analyze - Describe how files and free space are laid out
+ * @layout: Filled with totals over every file, and with the free runs
+ * @files: Filled with the layout of each file, in directory order, or NULL
+ * @max_files: Number of entries @files has room for
+ *
+ * Walk the block map of every file and the whole free-space bitmap. A file
+ * made of few long extents, in increasing block order, reads with few large
+ * transfers; many short extents or inversions mean fs_defrag() would help.
+ * Many small free runs and a short largest run mean new files will be
+ * fragmented too, unless blocks are freed or the disk is made larger.
+ *
+ * Return: -1 if no FS is currently mounted, or if @layout is NULL, or if the
+ * FAT could not be read. Otherwise return the number of files, of which only
+ * the first @max_files are described in @files.
+ */
+int fs_analyze(struct fs_layout *layout, struct fs_file_layout *files,
+	       size_t max_files);
+
+/**
+ * fs_set_cache_size - Configure the block cache
+ * @num_blocks: Maximum number of blocks held in the cache
+ *
+ * Set the size of the block cache used by the next fs_mount(). A size of 0
+ * disables caching, so every access goes straight to the disk.
+ *
+ * Contexts mounted with fs_mount_ctx() also use this size.
+ *
+ * Return: -1 if a FS is currently mounted with fs_mount(). 0 otherwise.
+ */
+int fs_set_cache_size(size_t num_blocks);
+
+/** Largest readahead window when none was configured, in blocks */
+#define FS_READAHEAD_DEFAULT 32
+
+/**
+ * fs_set_readahead - Configure sequential readahead
+ * @max_blocks: Largest number of blocks read ahead at once
+ *
+ * Set the readahead used by the next fs_mount() or fs_mount_ctx(). Each file
+ * descriptor watches whether every fs_read() starts where the previous one
+ * ended. While it does, the blocks that come next in the file are read into
+ * the block cache ahead of demand, in a window that doubles up to @max_blocks
+ * blocks each time the reads catch up with it. Any other read resets the
+ * window. A @max_blocks of 0 disables readahead; so does a disabled block
+ * cache.
+ *
+ * Return: -1 if a FS is currently mounted with fs_mount(). 0 otherwise.
+ */
+int fs_set_readahead(size_t max_blocks);
+
+/** Access the virtual disk file with pread()/pwrite() (the default) */
+#define FS_BACKEND_PREAD 0
+
+/** Map the virtual disk file into memory and access it in place */
+#define FS_BACKEND_MMAP 1
+
+/**
+ * fs_set_backend - Choose how the virtual disk file is accessed
+ * @backend: %FS_BACKEND_PREAD or %FS_BACKEND_MMAP
+ *
+ * Set the backend used by the next fs_mount() or fs_mount_ctx(). With
+ * %FS_BACKEND_MMAP, the whole virtual disk file is mapped into memory at mount
+ * time, and reads and writes copy straight between the caller's buffer and
+ * the mapping. The mapping takes the place of the block cache, whose size is
+ * then ignored. Changes are synced to the file by fs_sync() and fs_umount().
+ *
+ * Return: -1 if a FS is currently mounted with fs_mount(), or if @backend is
+ * unknown. 0 otherwise.
+ */
+int fs_set_backend(int backend);
+
+/**
+ * fs_set_journal - Reserve a metadata journal
+ * @num_blocks: Number of blocks of the journal, at least 2, or 0 for none
+ *
+ * Set the size of the journal reserved by the next fs_mount() or
+ * fs_mount_ctx() of a disk that does not have one yet. The journal takes
+ * @num_blocks contiguous data blocks, and is recorded in the superblock, so
+ * every later mount of the disk uses it whatever this setting is.
+ *
+ * On a disk with a journal, every change to the FAT and the root directory is
+ * logged. fs_create() and fs_delete() return once their change is durable,
+ * and so does fs_fsync(), after writing back the file's data; each of them
+ * writes one journal record and syncs once, and threads committing at the
+ * same time share the record and the sync. The FAT and root directory blocks
+ * themselves are only written back by a checkpoint: in the background once
+ * the journal is half full, and on fs_sync() and fs_umount(). If the program
+ * crashes, the next mount replays the journal. Data written with fs_write()
+ * is only durable after fs_fsync() or fs_sync(), as without a journal.
+ *
+ * Return: -1 if a FS is currently mounted with fs_mount(), or if @num_blocks
+ * is neither 0 nor between 2 and 65535. 0 otherwise.
+ */
+int fs_set_journal(size_t num_blocks);
+
+/** Largest number of files that fs_set_open_max() lets be open at once */
+#define FS_OPEN_MAX_LIMIT 65536
+
+/**
+ * fs_set_open_max - Configure how many files can be open at once
+ * @max_open: Largest number of file descriptors open at the same time
+ *
+ * Set the limit of the file descriptor table of the next fs_mount() or
+ * fs_mount_ctx(), %FS_OPEN_MAX_COUNT by default. The table starts out with
+ * room for %FS_OPEN_MAX_COUNT descriptors (or @max_open, if smaller), and
+ * doubles whenever a file is opened while it is full, up to @max_open.
+ * Free descriptors are kept in a list, so fs_open() and fs_close() take the
+ * same time however many files are open.
+ *
+ * The low 16 bits of a file descriptor pick its slot in the table, and the
+ * bits above count how many times the slot was closed before, modulo 32768.
+ * Once closed, a descriptor is rejected by every function, even after its
+ * slot is reused, until the slot has been closed another 32768 times.
+ *
+ * Return: -1 if a FS is currently mounted with fs_mount(), or if @max_open is
+ * 0 or larger than %FS_OPEN_MAX_LIMIT. 0 otherwise.
+ */
+int fs_set_open_max(size_t max_open);
+
+/**
+ * fs_cache_stats - Get block cache counters
+ * @stats: Filled with the counters of the mounted file system's cache
+ *
+ * Return: -1 if no FS is currently mounted, or if @stats is NULL. 0 otherwise.
+ */
+int fs_cache_stats(struct fs_cache_stats *stats);
+
+/** Entry points whose latency fs_get_stats() reports, indexes of @latency */
+enum {
+	FS_OP_MOUNT,
+	FS_OP_OPEN,
+	FS_OP_READ,
+	FS_OP_WRITE,
+	FS_OP_DELETE,
+	FS_OP_UMOUNT,
+	FS_OP_COUNT
+};
+
+/** Number of buckets of a latency histogram */
+#define FS_LATENCY_BUCKETS 32
+
+/** Latency of the calls made to one entry point */
+struct fs_latency {
+	unsigned long long calls;
+	unsigned long long total_ns;
+	/* Bucket i counts calls of 2^i to 2^(i+1) - 1 ns, the last any slower */
+	unsigned long long hist[FS_LATENCY_BUCKETS];
+};
+
+/** Counters kept by the whole library, over every disk ever mounted */
+struct fs_stats {
+	/* Calls to the disk layer, and the blocks they moved */
+	unsigned long long disk_reads;
+	unsigned long long disk_writes;
+	unsigned long long blocks_read;
+	unsigned long long blocks_written;
+	/* Bytes returned by fs_read() and taken by fs_write() */
+	unsigned long long bytes_read;
+	unsigned long long bytes_written;
+	/* FAT entries looked up, one per step along a chain */
+	unsigned long long fat_steps;
+	/* Requests for free blocks, and FAT entries scanned to find some */
+	unsigned long long allocs;
+	unsigned long long alloc_scanned;
+	/* Partial block writes that had to read the block first */
+	unsigned long long rmw_cycles;
+	struct fs_latency latency[FS_OP_COUNT];
+};
+
+/**
+ * fs_get_stats - Get performance counters
+ * @stats: Filled with the counters of the library
+ *
+ * The counters are shared by every context, keep counting across mounts, and
+ * are never reset, so the cost of a call is the difference between two
+ * snapshots taken around it. Counting takes a few relaxed atomic additions
+ * per block and two clock reads per timed call; building libfs with
+ * `make STATS=0` removes them altogether.
+ *
+ * Return: -1 if @stats is NULL, or if libfs was built without counters. 0
+ * otherwise.
+ */
+int fs_get_stats(struct fs_stats *stats);
+
+/** Largest number of events fs_trace_start() can keep */
+#define FS_TRACE_MAX_EVENTS (1 << 22)
+
+/**
+ * fs_trace_start - Start recording events
+ * @num_events: Number of events to keep, rounded up to a power of two, and
+ * to at least 1024
+ *
+ * From then on, fs_mount(), fs_umount(), fs_create(), fs_delete(), fs_open(),
+ * fs_close(), fs_read() and fs_write() record when they are entered and when
+ * they return; fs_read() and fs_write() record each block they ask of the
+ * cache, as the partial first block (head), the runs of whole blocks (body)
+ * and the partial last block (tail); and every transfer of the disk layer
+ * records its first block and its number of blocks. Events are kept in a
+ * ring buffer, which any thread appends to without locking, so only the last
+ * @num_events are kept. Events of the previous trace are dropped.
+ *
+ * Tracing must not be started while another thread is inside libfs. While it
+ * is stopped, it costs each event a single branch.
+ *
+ * Return: -1 if tracing is on already, or if @num_events is 0 or larger than
+ * %FS_TRACE_MAX_EVENTS, or if memory could not be allocated. 0 otherwise.
+ */
+int fs_trace_start(size_t num_events);
+
+/**
+ * fs_trace_stop - Stop recording events
+ *
+ * The events recorded are kept until tracing is started again.
+ *
+ * Return: -1 if tracing is off. 0 otherwise.
+ */
+int fs_trace_stop(void);
+
+/**
+ * fs_trace_dump - Write the events recorded to a file
+ * @filename: Name of the file to create, or overwrite
+ *
+ * The file is in the Chrome trace event format, which chrome://tracing and
+ * Perfetto display as a timeline per thread: each public call is a slice,
+ * and each block event a mark with its block index and count. Events that
+ * were being recorded while the file was written are left out.
+ *
+ * Return: -1 if nothing was ever traced, or if @filename is NULL, or if the
+ * file could not be written. 0 otherwise.
+ */
+int fs_trace_dump(const char *filename);
+
+/**
+ * fs_read_view - Look at a file's content without copying it
+ * @fd: File descriptor
+ * @offset: Offset of the first byte to look at
+ * @count: Number of bytes to look at
+ * @iov: Array to be filled with spans of the file's content
+ * @iovcnt: Number of spans @iov can hold
+ *
+ * Fill @iov with pointers to the bytes of the file referenced by file
+ * descriptor @fd, from @offset to @offset + @count or to the end of the file,
+ * in order. The spans point straight into the block cache, or into the
+ * mapping of the virtual disk file with %FS_BACKEND_MMAP, so nothing is
+ * copied. The blocks they point to stay in memory until the spans are handed
+ * to fs_release_view(); writes to the file meanwhile show through them. The
+ * file offset of @fd is not used nor changed.
+ *
+ * Spans stay valid if the file is deleted, cut by fs_truncate() or moved by
+ * fs_defrag() before they are released, but they no longer follow the file.
+ * Spans into the block cache keep the bytes they held at that moment, while
+ * the freed blocks are read from the disk by whichever file gets them next.
+ * Spans into a mapping keep pointing at the same disk blocks, so they show
+ * whatever is written to those blocks next, by any file.
+ *
+ * Fewer bytes than @count may be covered, if @iov is full or if the block
+ * cache cannot hold more pinned blocks. Call fs_read_view() again from where
+ * the spans stopped, after releasing them if needed.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid, or if @iov is NULL or @iovcnt is not positive, or if nothing could
+ * be pinned, including when the block cache is disabled. Otherwise return the
+ * number of spans filled in @iov (0 at the end of the file).
+ */
+int fs_read_view(int fd, size_t offset, size_t count, struct iovec *iov,
+		 int iovcnt);
+
+/**
+ * fs_release_view - Release spans given by fs_read_view()
+ * @iov: Spans filled by fs_read_view()
+ * @iovcnt: Number of spans, as returned by fs_read_view()
+ *
+ * Every span must be released exactly once, and before the file system is
+ * unmounted.
+ *
+ * Return: -1 if no FS is currently mounted. 0 otherwise.
+ */
+int fs_release_view(const struct iovec *iov, int iovcnt);
+
+/** A completed asynchronous request */
+struct fs_aio_completion {
+	/* Value given when the request was submitted */
+	unsigned long long user_data;
+	/* Number of bytes read or written, or -1 if the request failed */
+	int result;
+};
+
+/**
+ * fs_read_async - Start reading from a file
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: Offset in the file of the first byte to read
+ * @user_data: Value to report with the completion
+ *
+ * Queue a read of @count bytes at @offset in the file referenced by file
+ * descriptor @fd, and return without waiting for it. The read is split into
+ * block operations that a pool of threads performs in parallel with each
+ * other and with other requests. Once all are done, a completion carrying
+ * @user_data and the number of bytes read (which stops at the end of the file)
+ * can be taken with fs_aio_reap(). @buf must stay valid until then. The file
+ * offset of @fd is not used nor changed.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid, or if @buf is NULL, or if the request could not be queued. 0
+ * otherwise.
+ */
+int fs_read_async(int fd, void *buf, size_t count, size_t offset,
+		  unsigned long long user_data);
+
+/**
+ * fs_write_async - Start writing to a file
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: Offset in the file of the first byte to write
+ * @user_data: Value to report with the completion
+ *
+ * Like fs_read_async(), for a write. Blocks are allocated, and the file is
+ * extended, before the function returns; only the data is written
+ * asynchronously. If the disk runs out of space, fewer than @count bytes are
+ * written, and the completion reports how many.
+ *
+ * Requests on overlapping ranges may complete in any order. Deleting the
+ * file, or cutting it with fs_truncate(), waits for every request in flight
+ * first, so a request never writes to blocks the file no longer has.
+ *
+ * The new size is logged when the request is queued, not when it completes.
+ * fs_fsync() and fs_sync() wait for every request in flight and write its
+ * data back before the size, but on a disk with a journal, a commit made
+ * meanwhile by another call, such as fs_create() or fs_delete(), can make the
+ * size durable first. If the system then crashes before the request
+ * completes and its data is synced, the range it was writing may show
+ * whatever its blocks held before, including bytes of a file deleted earlier.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid, or if @buf is NULL, or if @offset is larger than the current file
+ * size, or if the request could not be queued. 0 otherwise.
+ */
+int fs_write_async(int fd, void *buf, size_t count, size_t offset,
+		   unsigned long long user_data);
+
+/**
+ * fs_aio_reap - Collect completed asynchronous requests
+ * @completions: Array to be filled with completions
+ * @max: Number of completions @completions can hold
+ * @min: Number of completions to wait for (0 to only poll)
+ *
+ * Wait until at least @min requests have completed, or fewer if fewer are in
+ * flight, and take up to @max completions in the order the requests
+ * completed. fs_umount() waits for requests in flight, but drops the
+ * completions that were not taken.
+ *
+ * Return: -1 if no FS is currently mounted, or if @completions is NULL or @max
+ * is not positive. Otherwise return the number of completions taken.
+ */
+int fs_aio_reap(struct fs_aio_completion *completions, int max, int min);
+
+/**
+ * Context of one mounted file system
+ *
+ * The functions above all work on the single file system mounted by
+ * fs_mount(). The functions below take the context returned by fs_mount_ctx()
+ * instead, so that any number of virtual disks can be mounted at the same time.
+ * Each context has its own FAT, root directory, file descriptors and block
+ * cache, and file descriptors are only valid with the context that opened them.
+ *
+ * Every fs_xxx_ctx() function behaves like fs_xxx(), with "no FS is currently
+ * mounted" meaning that @ctx is NULL.
+ *
+ * Once mounted, a context may be used from several threads at once, and so may
+ * the default one. Reads of any files run in parallel, and writes to different
+ * files only wait for each other while allocating blocks. A file descriptor's
+ * offset is not protected though: threads that share a file should each open
+ * their own descriptor. fs_umount_ctx() must not run alongside anything else.
+ */
+typedef struct fs_ctx fs_ctx;
+
+/**
+ * fs_mount_ctx - Mount a file system into a new context
+ * @diskname: Name of the virtual disk file
+ *
+ * Return: NULL if virtual disk file @diskname cannot be opened, or if no valid
+ * file system can be located, or if memory could not be allocated. The new
+ * context otherwise.
+ */
+fs_ctx *fs_mount_ctx(const char *diskname);
+
+/**
+ * fs_umount_ctx - Unmount the file system of a context
+ * @ctx: Context returned by fs_mount_ctx()
+ *
+ * Write back everything held in memory, close the virtual disk file and free
+ * @ctx. If this fails, @ctx stays mounted as it was.
+ *
+ * Return: -1 if @ctx is NULL, if the changes cannot be written back, or if
+ * @ctx still has open file descriptors. 0 otherwise.
+ */
+int fs_umount_ctx(fs_ctx *ctx);
+
+int fs_info_ctx(fs_ctx *ctx);
+int fs_create_ctx(fs_ctx *ctx, const char *filename);
+int fs_delete_ctx(fs_ctx *ctx, const char *filename);
+int fs_ls_ctx(fs_ctx *ctx);
+int fs_open_ctx(fs_ctx *ctx, const char *filename);
+int fs_close_ctx(fs_ctx *ctx, int fd);
+int fs_stat_ctx(fs_ctx *ctx, int fd);
+int fs_lseek_ctx(fs_ctx *ctx, int fd, size_t offset);
+int fs_write_ctx(fs_ctx *ctx, int fd, void *buf, size_t count);
+int fs_read_ctx(fs_ctx *ctx, int fd, void *buf, size_t count);
+int fs_sync_ctx(fs_ctx *ctx);
+int fs_fsync_ctx(fs_ctx *ctx, int fd);
+int fs_truncate_ctx(fs_ctx *ctx, const char *filename, size_t size);
+int fs_ftruncate_ctx(fs_ctx *ctx, int fd, size_t size);
+int fs_fallocate_ctx(fs_ctx *ctx, int fd, size_t size);
+int fs_frag_stats_ctx(fs_ctx *ctx, struct fs_frag_stats *stats);
+int fs_defrag_ctx(fs_ctx *ctx, size_t max_blocks);
+int fs_analyze_ctx(fs_ctx *ctx, struct fs_layout *layout,
+		   struct fs_file_layout *files, size_t max_files);
+int fs_cache_stats_ctx(fs_ctx *ctx, struct fs_cache_stats *stats);
+int fs_read_view_ctx(fs_ctx *ctx, int fd, size_t offset, size_t count,
+		     struct iovec *iov, int iovcnt);
+int fs_release_view_ctx(fs_ctx *ctx, const struct iovec *iov, int iovcnt);
+int fs_read_async_ctx(fs_ctx *ctx, int fd, void *buf, size_t count,
+		      size_t offset, unsigned long long user_data);
+int fs_write_async_ctx(fs_ctx *ctx, int fd, void *buf, size_t count,
+		       size_t offset, unsigned long long user_data);
+int fs_aio_reap_ctx(fs_ctx *ctx, struct fs_aio_completion *completions,
+		    int max, int min);
+
 #endif /* _FS_H */
@@ -0,0 +1,440 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "journal.h"
+
+/* First bytes of the header block */
+#define HEADER_MAGIC "ECS150JL"
+#define HEADER_MAGIC_LEN 8
+
+/* First bytes of every record ("JREC" on disk) */
+#define RECORD_MAGIC 0x4345524a
+
+/* Magic, sequence number, length of the deltas and checksum */
+#define RECORD_HEADER_LEN 20
+
+/* Pads records to a whole number of blocks */
+static const uint8_t zeroes[BLOCK_SIZE];
+
+struct journal {
+	struct disk *disk;
+	/* First block of the journal, which holds the header */
+	size_t block;
+	size_t num_blocks;
+
+	/* Guards everything below */
+	pthread_mutex_t lock;
+	/* Signalled when a record is written or the journal is reset */
+	pthread_cond_t cond;
+
+	/* Sequence number of the first live record */
+	uint64_t start_seq;
+	/* Block, counted from @block, where the next record goes */
+	size_t tail;
+
+	/* Deltas of the pending batch, whose sequence number is @next_seq */
+	uint8_t *pending;
+	size_t pending_len;
+	size_t pending_cap;
+	uint64_t next_seq;
+	/* Where the last change logged starts in @pending */
+	size_t last_delta;
+	/*
+	 * Buffer of the last record written, which the next pending batch
+	 * takes over, so that logging does not allocate once both are big enough
+	 */
+	uint8_t *spare;
+	size_t spare_cap;
+	/* Some change never made it to the disk, so commits cannot be trusted */
+	bool lost;
+
+	/* Every batch before this one is durable */
+	uint64_t durable_seq;
+	/* Whether a thread is writing a record */
+	bool committing;
+};
+
+static void put_le(uint8_t *p, uint64_t value, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = value >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *p, size_t len)
+{
+	uint64_t value = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		value |= (uint64_t)p[i] << (8 * i);
+
+	return value;
+}
+
+/* FNV-1a of the sequence number and the deltas */
+static uint32_t checksum(uint64_t seq, const uint8_t *deltas, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < 8; i++) {
+		hash ^= (uint8_t)(seq >> (8 * i));
+		hash *= 16777619u;
+	}
+	for (i = 0; i < len; i++) {
+		hash ^= deltas[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Number of blocks taken by a record holding @len bytes of deltas */
+static size_t record_blocks(size_t len)
+{
+	return (RECORD_HEADER_LEN + len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/* Must be called with the journal locked, or before it is shared */
+static int write_header(struct journal *journal)
+{
+	uint8_t header[BLOCK_SIZE];
+
+	memset(header, 0, BLOCK_SIZE);
+	memcpy(header, HEADER_MAGIC, HEADER_MAGIC_LEN);
+	put_le(header + HEADER_MAGIC_LEN, journal->start_seq, 8);
+
+	if (disk_write(journal->disk, journal->block, header) ||
+	    disk_sync(journal->disk))
+		return -1;
+
+	return 0;
+}
+
+struct journal *journal_open(struct disk *disk, size_t block,
+			     size_t num_blocks, bool format)
+{
+	struct journal *journal;
+	uint8_t header[BLOCK_SIZE];
+
+	if (num_blocks < JOURNAL_MIN_BLOCKS)
+		return NULL;
+
+	journal = calloc(1, sizeof(struct journal));
+	if (!journal)
+		return NULL;
+
+	journal->disk = disk;
+	journal->block = block;
+	journal->num_blocks = num_blocks;
+
+	if (format) {
+		journal->start_seq = 1;
+		if (write_header(journal)) {
+			free(journal);
+			return NULL;
+		}
+	} else {
+		if (disk_read(disk, block, header) ||
+		    memcmp(header, HEADER_MAGIC, HEADER_MAGIC_LEN)) {
+			free(journal);
+			return NULL;
+		}
+		journal->start_seq = get_le(header + HEADER_MAGIC_LEN, 8);
+	}
+
+	journal->tail = 1;
+	journal->next_seq = journal->start_seq;
+	journal->durable_seq = journal->start_seq;
+
+	if (pthread_mutex_init(&journal->lock, NULL)) {
+		free(journal);
+		return NULL;
+	}
+	if (pthread_cond_init(&journal->cond, NULL)) {
+		pthread_mutex_destroy(&journal->lock);
+		free(journal);
+		return NULL;
+	}
+
+	return journal;
+}
+
+void journal_close(struct journal *journal)
+{
+	if (!journal)
+		return;
+
+	pthread_cond_destroy(&journal->cond);
+	pthread_mutex_destroy(&journal->lock);
+	free(journal->pending);
+	free(journal->spare);
+	free(journal);
+}
+
+int journal_recover(struct journal *journal, uint8_t **deltas, size_t *len)
+{
+	uint8_t *out = NULL, *record, *grown;
+	size_t out_len = 0, pos = 1, n, rec_len;
+	uint64_t seq = journal->start_seq;
+	struct iovec iov;
+
+	record = malloc(BLOCK_SIZE);
+	if (!record)
+		return -1;
+
+	/* Records run until one is torn, stale, or missing */
+	while (pos < journal->num_blocks) {
+		if (disk_read(journal->disk, journal->block + pos, record))
+			goto fail;
+
+		if (get_le(record, 4) != RECORD_MAGIC ||
+		    get_le(record + 4, 8) != seq)
+			break;
+
+		rec_len = get_le(record + 12, 4);
+		n = record_blocks(rec_len);
+		if (pos + n > journal->num_blocks)
+			break;
+
+		grown = realloc(record, n * BLOCK_SIZE);
+		if (!grown)
+			goto fail;
+		record = grown;
+
+		if (n > 1) {
+			iov.iov_base = record + BLOCK_SIZE;
+			iov.iov_len = (n - 1) * BLOCK_SIZE;
+			if (disk_readv(journal->disk, journal->block + pos + 1,
+				       &iov, 1))
+				goto fail;
+		}
+
+		if (get_le(record + 16, 4) !=
+		    checksum(seq, record + RECORD_HEADER_LEN, rec_len))
+			break;
+
+		grown = realloc(out, out_len + rec_len);
+		if (!grown && out_len + rec_len > 0)
+			goto fail;
+		out = grown;
+		memcpy(out + out_len, record + RECORD_HEADER_LEN, rec_len);
+		out_len += rec_len;
+
+		pos += n;
+		seq++;
+	}
+
+	free(record);
+
+	journal->tail = pos;
+	journal->next_seq = seq;
+	journal->durable_seq = seq;
+
+	*deltas = out;
+	*len = out_len;
+	return 0;
+
+fail:
+	free(record);
+	free(out);
+	return -1;
+}
+
+void journal_log(struct journal *journal, const void *delta, size_t len)
+{
+	uint8_t *grown;
+	size_t cap;
+
+	pthread_mutex_lock(&journal->lock);
+
+	if (journal->pending_len + len > journal->pending_cap) {
+		cap = journal->pending_cap ? journal->pending_cap : BLOCK_SIZE;
+		while (cap < journal->pending_len + len)
+			cap *= 2;
+
+		grown = realloc(journal->pending, cap);
+		if (!grown) {
+			journal->lost = true;
+			pthread_mutex_unlock(&journal->lock);
+			return;
+		}
+		journal->pending = grown;
+		journal->pending_cap = cap;
+	}
+
+	journal->last_delta = journal->pending_len;
+	memcpy(journal->pending + journal->pending_len, delta, len);
+	journal->pending_len += len;
+
+	pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_log_update(struct journal *journal, const void *delta, size_t len,
+			size_t key_len)
+{
+	uint8_t *last;
+
+	pthread_mutex_lock(&journal->lock);
+
+	/* The last change ends the batch only if nothing was logged after it */
+	last = journal->pending + journal->last_delta;
+	if (journal->last_delta + len == journal->pending_len &&
+	    !memcmp(last, delta, key_len)) {
+		memcpy(last, delta, len);
+		pthread_mutex_unlock(&journal->lock);
+		return;
+	}
+
+	pthread_mutex_unlock(&journal->lock);
+
+	journal_log(journal, delta, len);
+}
+
+uint64_t journal_pending(struct journal *journal)
+{
+	uint64_t seq;
+
+	pthread_mutex_lock(&journal->lock);
+	seq = journal->next_seq;
+	pthread_mutex_unlock(&journal->lock);
+
+	return seq;
+}
+
+int journal_commit(struct journal *journal, uint64_t seq)
+{
+	uint8_t header[RECORD_HEADER_LEN], *deltas;
+	uint64_t rec_seq;
+	size_t len, cap, n, pos;
+	struct iovec iov[3];
+	int ret = 0;
+
+	pthread_mutex_lock(&journal->lock);
+
+	/* Wait for the record being written, which may hold our batch */
+	for (;;) {
+		if (journal->durable_seq > seq) {
+			pthread_mutex_unlock(&journal->lock);
+			return 0;
+		}
+		if (!journal->committing)
+			break;
+		pthread_cond_wait(&journal->cond, &journal->lock);
+	}
+
+	if (journal->pending_len == 0 && !journal->lost) {
+		pthread_mutex_unlock(&journal->lock);
+		return 0;
+	}
+
+	n = record_blocks(journal->pending_len);
+	if (journal->lost || journal->tail + n > journal->num_blocks) {
+		pthread_mutex_unlock(&journal->lock);
+		return JOURNAL_FULL;
+	}
+
+	/*
+	 * This thread writes everything logged so far as one record. New
+	 * changes go to a new batch meanwhile, for the next thread to write.
+	 */
+	deltas = journal->pending;
+	len = journal->pending_len;
+	cap = journal->pending_cap;
+	rec_seq = journal->next_seq;
+	pos = journal->tail;
+
+	journal->pending = journal->spare;
+	journal->pending_len = 0;
+	journal->pending_cap = journal->spare_cap;
+	journal->spare = NULL;
+	journal->spare_cap = 0;
+	journal->next_seq++;
+	journal->tail += n;
+	journal->committing = true;
+
+	pthread_mutex_unlock(&journal->lock);
+
+	put_le(header, RECORD_MAGIC, 4);
+	put_le(header + 4, rec_seq, 8);
+	put_le(header + 12, len, 4);
+	put_le(header + 16, checksum(rec_seq, deltas, len), 4);
+
+	/* The record is gathered straight from the batch, padded with zeroes */
+	iov[0].iov_base = header;
+	iov[0].iov_len = RECORD_HEADER_LEN;
+	iov[1].iov_base = deltas;
+	iov[1].iov_len = len;
+	iov[2].iov_base = (void *)zeroes;
+	iov[2].iov_len = n * BLOCK_SIZE - RECORD_HEADER_LEN - len;
+	if (disk_writev(journal->disk, journal->block + pos, iov, 3) ||
+	    disk_sync(journal->disk))
+		ret = -1;
+
+	pthread_mutex_lock(&journal->lock);
+	if (!journal->spare) {
+		journal->spare = deltas;
+		journal->spare_cap = cap;
+	} else {
+		free(deltas);
+	}
+	journal->committing = false;
+	if (ret == 0)
+		journal->durable_seq = rec_seq + 1;
+	else
+		journal->lost = true;
+	pthread_cond_broadcast(&journal->cond);
+	pthread_mutex_unlock(&journal->lock);
+
+	return ret;
+}
+
+int journal_reset(struct journal *journal)
+{
+	int ret;
+
+	pthread_mutex_lock(&journal->lock);
+
+	while (journal->committing)
+		pthread_cond_wait(&journal->cond, &journal->lock);
+
+	/* Pending changes are home already, so their batch counts as durable */
+	journal->pending_len = 0;
+	journal->next_seq++;
+
+	journal->start_seq = journal->next_seq;
+	journal->durable_seq = journal->next_seq;
+	journal->tail = 1;
+
+	/* Without the new header, records written from now on would be ignored */
+	ret = write_header(journal);
+	journal->lost = ret != 0;
+
+	pthread_cond_broadcast(&journal->cond);
+	pthread_mutex_unlock(&journal->lock);
+
+	return ret;
+}
+
+bool journal_needs_reset(struct journal *journal)
+{
+	size_t used;
+	bool ret;
+
+	pthread_mutex_lock(&journal->lock);
+
+	used = journal->tail - 1;
+	if (journal->pending_len > 0)
+		used += record_blocks(journal->pending_len);
+	ret = journal->lost || used * 2 > journal->num_blocks - 1;
+
+	pthread_mutex_unlock(&journal->lock);
+
+	return ret;
+}
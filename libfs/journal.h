@@ -0,0 +1,144 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h> /* for size_t definition */
+#include <stdint.h>
+
+#include "disk.h"
+
+/** Smallest journal: its header block and one block of records */
+#define JOURNAL_MIN_BLOCKS 2
+
+/** Returned by journal_commit() when the records do not fit in the journal */
+#define JOURNAL_FULL 1
+
+/**
+ * Write-ahead journal of metadata changes
+ *
+ * The journal is a run of contiguous blocks on a disk. Its first block is a
+ * header naming the sequence number of the first live record; the records
+ * follow, one after the other. Each record holds a batch of changes (opaque
+ * to the journal, called deltas), starts on a block boundary, and carries its
+ * sequence number and a checksum, so that a record torn by a crash, or left
+ * over from before the journal was last reset, is never taken as live.
+ *
+ * Changes are logged into a pending batch in memory. journal_commit() writes
+ * the pending batch as a single record followed by a single sync. Threads
+ * that commit while another thread's record is being written wait for it,
+ * and then the first of them writes everything logged in the meantime as the
+ * next record, so concurrent commits share one write and one sync.
+ *
+ * Once the changes are written to their home locations, journal_reset()
+ * drops every record. Every function may be called from several threads at
+ * once.
+ */
+struct journal;
+
+/**
+ * journal_open - Open the journal of a disk
+ * @disk: Disk the journal is on
+ * @block: Index of the first block of the journal
+ * @num_blocks: Number of blocks of the journal, at least %JOURNAL_MIN_BLOCKS
+ * @format: Whether to start an empty journal instead of reading the header
+ *
+ * Return: NULL if memory could not be allocated, or if the header could not
+ * be read, written or synced, or if it is not a journal header. The journal
+ * otherwise.
+ */
+struct journal *journal_open(struct disk *disk, size_t block,
+			     size_t num_blocks, bool format);
+
+/**
+ * journal_close - Release a journal
+ * @journal: Journal to close
+ *
+ * Changes logged but not committed are dropped.
+ */
+void journal_close(struct journal *journal);
+
+/**
+ * journal_recover - Read the live records of a journal
+ * @journal: Journal, freshly opened
+ * @deltas: Filled with the deltas of every live record in order, in a buffer
+ * to be freed by the caller, or NULL if there are none
+ * @len: Filled with the number of bytes in @deltas
+ *
+ * New records are written after the live ones, so the changes they hold do
+ * not have to be logged again.
+ *
+ * Return: -1 if memory could not be allocated or if a block could not be
+ * read. 0 otherwise.
+ */
+int journal_recover(struct journal *journal, uint8_t **deltas, size_t *len);
+
+/**
+ * journal_log - Add a change to the pending batch
+ * @journal: Journal
+ * @delta: Change to log
+ * @len: Length of @delta in bytes
+ *
+ * If memory cannot be allocated, the change is dropped, and the next commit
+ * reports %JOURNAL_FULL so that nothing relies on the journal alone.
+ */
+void journal_log(struct journal *journal, const void *delta, size_t len);
+
+/**
+ * journal_log_update - Add a change that may replace the previous one
+ * @journal: Journal
+ * @delta: Change to log
+ * @len: Length of @delta in bytes
+ * @key_len: Number of leading bytes of @delta that name what it changes
+ *
+ * If the last change of the pending batch is @len bytes long and starts with
+ * the same @key_len bytes as @delta, it is overwritten with @delta, as
+ * replaying both would leave what @delta says anyway. This keeps the batch
+ * from growing when the same thing changes over and over. Otherwise the same
+ * as journal_log().
+ */
+void journal_log_update(struct journal *journal, const void *delta, size_t len,
+			size_t key_len);
+
+/**
+ * journal_pending - Get the sequence number of the pending batch
+ * @journal: Journal
+ *
+ * Return: the number to hand to journal_commit() to make durable every change
+ * logged until now.
+ */
+uint64_t journal_pending(struct journal *journal);
+
+/**
+ * journal_commit - Make changes durable
+ * @journal: Journal
+ * @seq: Sequence number from journal_pending()
+ *
+ * Return: 0 once the batch @seq and every batch before it are durable.
+ * %JOURNAL_FULL if they do not fit in the journal, in which case the caller
+ * has to write them to their home locations and reset the journal. -1 if the
+ * record could not be written or synced.
+ */
+int journal_commit(struct journal *journal, uint64_t seq);
+
+/**
+ * journal_reset - Drop every record and every pending change
+ * @journal: Journal
+ *
+ * To be called once the changes are durable at their home locations. Waits
+ * for a record being written, and counts every change logged so far as
+ * durable.
+ *
+ * Return: -1 if the header could not be written or synced. 0 otherwise.
+ */
+int journal_reset(struct journal *journal);
+
+/**
+ * journal_needs_reset - Check whether the journal is filling up
+ * @journal: Journal
+ *
+ * Return: true once the records and the pending batch take more than half of
+ * the journal, which is a good time to write the changes home and reset it.
+ */
+bool journal_needs_reset(struct journal *journal);
+
+#endif /* _JOURNAL_H */
@@ -0,0 +1,57 @@
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+#ifndef FS_NO_STATS
+
+struct fs_stats fs_counters;
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_record(int op, uint64_t start)
+{
+	struct fs_latency *latency = &fs_counters.latency[op];
+	uint64_t ns = stats_now() - start;
+	int bucket = 0;
+
+	/* Bucket i holds 2^i to 2^(i+1) - 1 ns */
+	while (bucket < FS_LATENCY_BUCKETS - 1 && (ns >> (bucket + 1)))
+		bucket++;
+
+	__atomic_fetch_add(&latency->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&latency->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&latency->hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+int fs_get_stats(struct fs_stats *stats)
+{
+	const unsigned long long *src = (const unsigned long long *)&fs_counters;
+	unsigned long long *dst = (unsigned long long *)stats;
+	size_t i;
+
+	if (!stats)
+		return -1;
+
+	/* Every member is an unsigned long long, so they are read one by one */
+	for (i = 0; i < sizeof(struct fs_stats) / sizeof(*dst); i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+#else
+
+int fs_get_stats(struct fs_stats *stats)
+{
+	(void)stats;
+	return -1;
+}
+
+#endif /* FS_NO_STATS */
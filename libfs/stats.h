@@ -0,0 +1,63 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+
+#include "fs.h"
+
+/**
+ * Performance counters behind fs_get_stats()
+ *
+ * The counters live in a single process-wide struct fs_stats, updated with
+ * relaxed atomic additions so that any thread may count without a lock. When
+ * FS_NO_STATS is defined (`make STATS=0`), every macro below expands to
+ * nothing and no counter exists.
+ */
+#ifndef FS_NO_STATS
+
+extern struct fs_stats fs_counters;
+
+/**
+ * STATS_ADD - Add to a counter
+ * @field: Member of struct fs_stats
+ * @n: Amount to add
+ */
+#define STATS_ADD(field, n) \
+	__atomic_fetch_add(&fs_counters.field, (n), __ATOMIC_RELAXED)
+
+/**
+ * STATS_START - Start timing a call
+ * @var: Name of the variable declared to hold the start time
+ */
+#define STATS_START(var) uint64_t var = stats_now()
+
+/**
+ * STATS_END - Count a call timed since STATS_START()
+ * @op: One of the FS_OP_* entry points
+ * @var: Variable named in STATS_START()
+ */
+#define STATS_END(op, var) stats_record((op), (var))
+
+/**
+ * stats_now - Read the monotonic clock
+ *
+ * Return: the current time in nanoseconds.
+ */
+uint64_t stats_now(void);
+
+/**
+ * stats_record - Add a call to the latency histogram of an entry point
+ * @op: One of the FS_OP_* entry points
+ * @start: Time the call started, from stats_now()
+ */
+void stats_record(int op, uint64_t start);
+
+#else
+
+#define STATS_ADD(field, n) do { } while (0)
+#define STATS_START(var) do { } while (0)
+#define STATS_END(op, var) do { } while (0)
+
+#endif /* FS_NO_STATS */
+
+#endif /* _STATS_H */
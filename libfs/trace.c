@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "trace.h"
+
+/* Smallest ring, so that a thread is almost never lapped while recording */
+#define TRACE_MIN_EVENTS 1024
+
+struct trace_event {
+	/* Number of the event plus one once it is filled in, 0 before */
+	uint64_t seq;
+	uint64_t ts;
+	const char *name;
+	uint32_t tid;
+	uint32_t type;
+	uint32_t block;
+	uint32_t count;
+};
+
+bool trace_on;
+
+/* Ring buffer, kept after tracing stops so that it can be dumped */
+static struct trace_event *ring;
+static size_t ring_mask;
+/* Number of events recorded since tracing started */
+static uint64_t ring_head;
+
+/* Names of the block events, in Chrome's timeline */
+static const char *const type_names[] = {
+	[TRACE_DISK_READ] = "disk_read",
+	[TRACE_DISK_WRITE] = "disk_write",
+	[TRACE_READ_HEAD] = "read_head",
+	[TRACE_READ_BODY] = "read_body",
+	[TRACE_READ_TAIL] = "read_tail",
+	[TRACE_WRITE_HEAD] = "write_head",
+	[TRACE_WRITE_BODY] = "write_body",
+	[TRACE_WRITE_TAIL] = "write_tail",
+};
+
+static uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t trace_tid(void)
+{
+	static __thread uint32_t tid;
+
+	if (!tid)
+		tid = syscall(SYS_gettid);
+	return tid;
+}
+
+void trace_record(enum trace_type type, const char *name, size_t block,
+		  size_t count)
+{
+	uint64_t seq = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+	struct trace_event *ev = &ring[seq & ring_mask];
+
+	/* The slot may hold an older event, which must not be dumped half new */
+	__atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	/*
+	 * Another thread writes the slot too only if the ring wraps around
+	 * while this one is here, which the smallest ring makes unlikely
+	 */
+	__atomic_store_n(&ev->ts, trace_now(), __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->tid, trace_tid(), __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->type, type, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->block, block, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->count, count, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&ev->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+int fs_trace_start(size_t num_events)
+{
+	size_t capacity = TRACE_MIN_EVENTS;
+
+	if (trace_on || num_events == 0 || num_events > FS_TRACE_MAX_EVENTS)
+		return -1;
+
+	while (capacity < num_events)
+		capacity *= 2;
+
+	free(ring);
+	ring = calloc(capacity, sizeof(struct trace_event));
+	if (!ring)
+		return -1;
+	ring_mask = capacity - 1;
+	ring_head = 0;
+
+	__atomic_store_n(&trace_on, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int fs_trace_stop(void)
+{
+	if (!trace_on)
+		return -1;
+
+	__atomic_store_n(&trace_on, false, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int fs_trace_dump(const char *filename)
+{
+	struct trace_event ev, *slot;
+	uint64_t head, seq, first, t0 = 0;
+	bool comma = false;
+	FILE *f;
+
+	if (!ring || !filename)
+		return -1;
+
+	f = fopen(filename, "w");
+	if (!f)
+		return -1;
+
+	/* Only the last events fit in the ring */
+	head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+	first = head > ring_mask + 1 ? head - (ring_mask + 1) : 0;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (seq = first; seq < head; seq++) {
+		/* Copy the slot, and keep the copy only if it was not rewritten */
+		slot = &ring[seq & ring_mask];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq + 1)
+			continue;
+		ev.ts = __atomic_load_n(&slot->ts, __ATOMIC_RELAXED);
+		ev.name = __atomic_load_n(&slot->name, __ATOMIC_RELAXED);
+		ev.tid = __atomic_load_n(&slot->tid, __ATOMIC_RELAXED);
+		ev.type = __atomic_load_n(&slot->type, __ATOMIC_RELAXED);
+		ev.block = __atomic_load_n(&slot->block, __ATOMIC_RELAXED);
+		ev.count = __atomic_load_n(&slot->count, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq + 1)
+			continue;
+
+		/*
+		 * Timestamps are in microseconds, from the first event dumped.
+		 * An event may be stamped just before the one ahead of it.
+		 */
+		if (!t0)
+			t0 = ev.ts;
+
+		fprintf(f, "%s", comma ? ",\n" : "");
+		comma = true;
+		if (ev.type == TRACE_ENTER || ev.type == TRACE_EXIT)
+			fprintf(f, "{\"name\":\"%s\",\"cat\":\"api\","
+				"\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,"
+				"\"tid\":%u}", ev.name,
+				ev.type == TRACE_ENTER ? 'B' : 'E',
+				(int64_t)(ev.ts - t0) / 1e3, ev.tid);
+		else
+			fprintf(f, "{\"name\":\"%s\",\"cat\":\"%s\","
+				"\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+				"\"pid\":1,\"tid\":%u,\"args\":{\"block\":%u,"
+				"\"count\":%u}}", type_names[ev.type],
+				ev.type <= TRACE_DISK_WRITE ? "disk" : "cache",
+				(int64_t)(ev.ts - t0) / 1e3, ev.tid, ev.block,
+				ev.count);
+	}
+	fprintf(f, "\n]}\n");
+
+	if (fclose(f))
+		return -1;
+
+	return 0;
+}
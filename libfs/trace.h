@@ -0,0 +1,63 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h> /* for size_t definition */
+#include <stdint.h>
+
+/**
+ * Event tracer behind fs_trace_start()
+ *
+ * Events are appended to a ring buffer without any lock: each one claims a
+ * slot with an atomic increment, and marks it complete with the number of
+ * the event once it is filled in, so a dump skips slots still being written
+ * or already reused. While tracing is off, every TRACE_*() macro costs a
+ * single load of @trace_on and a branch that is never taken.
+ */
+
+/** Kinds of events */
+enum trace_type {
+	/* A public function was called, or returned */
+	TRACE_ENTER,
+	TRACE_EXIT,
+	/* The disk layer was asked to transfer blocks */
+	TRACE_DISK_READ,
+	TRACE_DISK_WRITE,
+	/*
+	 * fs_read() and fs_write() asked the cache for the partial first block
+	 * (head), a run of whole blocks (body), or the partial last block (tail)
+	 */
+	TRACE_READ_HEAD,
+	TRACE_READ_BODY,
+	TRACE_READ_TAIL,
+	TRACE_WRITE_HEAD,
+	TRACE_WRITE_BODY,
+	TRACE_WRITE_TAIL,
+};
+
+/** Whether events are being recorded */
+extern bool trace_on;
+
+/**
+ * trace_record - Append an event to the ring buffer
+ * @type: Kind of event
+ * @name: Name of the public function, for %TRACE_ENTER and %TRACE_EXIT
+ * @block: Index of the first block, for block events
+ * @count: Number of blocks, for block events
+ */
+void trace_record(enum trace_type type, const char *name, size_t block,
+		  size_t count);
+
+#define TRACE_EVENT(type, name, block, count)				\
+do {									\
+	if (__builtin_expect(__atomic_load_n(&trace_on, __ATOMIC_RELAXED), 0)) \
+		trace_record((type), (name), (block), (count));		\
+} while (0)
+
+/** TRACE_API - Record the entry into, or exit from, public function @name */
+#define TRACE_API(type, name) TRACE_EVENT(type, name, 0, 0)
+
+/** TRACE_BLOCKS - Record an access to @count blocks from @block */
+#define TRACE_BLOCKS(type, block, count) TRACE_EVENT(type, NULL, block, count)
+
+#endif /* _TRACE_H */